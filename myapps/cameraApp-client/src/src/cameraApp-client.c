@@ -30,12 +30,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <glib.h>
-#include <poll.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <dirent.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdint.h>
 #include "libgstcam.h"
 
 /****************************************************************
@@ -45,6 +58,94 @@
 
 #define MAX_STR 255
 
+/* Maximum number of input devices and GPIO lines that can trigger a capture */
+#define MAX_TRIGGER_SOURCES 8
+
+/* Pending triggers between the event loop and the snapshot worker,
+ * must be a power of two */
+#define TRIGGER_QUEUE_SIZE 16
+
+#define DEFAULT_DEBOUNCE_MS 50
+
+/* Recording pipe set on START. The daemon can't be asked for its current
+ * pipe, so the modes borrowing the recording branch put this one back */
+#define RECORDING_PIPE "queue ! dmaienc_h264 encodingpreset=2 ratecontrol=2 targetbitrate=1500000 ! " \
+    "qtmux name=mux ! filesink location=/tmp/video.mov"
+
+/* View finder and video source set on START */
+#define VIEWFINDER_PIPE "queue ! TIDmaiVideoSink videoOutput=composite sync=false"
+#define VIDEO_FRAMERATE "30000/1001"
+#define VIDEO_SRC_PIPE "v4l2src always-copy=FALSE input-src=composite%s ! dmaiaccel ! " \
+    "capsfilter caps=video/x-raw-yuv,format=(fourcc)NV12,width=720,height=480,pitch=736,framerate=(fraction)" VIDEO_FRAMERATE
+#define SNAPSHOT_PIPE "queue ! dmaienc_jpeg ! jifmux ! multifilesink async=false location=" SNAPSHOT_NAME
+#define SNAPSHOT_NAME "snapshot_%d.jpg"
+
+/* Frame ring (gst-framering): with -F the view finder branch keeps the
+ * last raw NV12 frames, and a trigger asks for the frame captured
+ * closest to its time. The JPEG encoder sits behind the ring and works
+ * while the trigger loop goes on. The frames are v4l2src buffers held
+ * in place, the capture queue grows by the size of the ring. */
+#define RING_SOCKET "/tmp/framering"
+#define RING_PIPE "tee name=vt ! " VIEWFINDER_PIPE " vt. ! " \
+    "framering frames=%d socket-path=" RING_SOCKET " ! queue max-size-buffers=2 max-size-bytes=0 max-size-time=0 ! " \
+    "dmaienc_jpeg ! jifmux ! multifilesink async=false location=%s"
+#define RING_QUEUE_EXTRA 4
+#define MAX_RING_FRAMES 64
+
+/* Pre-record ring: while armed the H.264 recording branch runs all the
+ * time and writes one file per GOP into a tmpfs directory, so every file
+ * starts with an IDR frame and the ring is indexed by keyframe */
+#define PRERECORD_DIR "/tmp/prerecord"
+#define PRERECORD_PIPE "queue ! dmaienc_h264 encodingpreset=2 ratecontrol=2 targetbitrate=1500000 ! " \
+    "multifilesink next-file=key-frame location=" PRERECORD_DIR "/gop_%05d.264"
+
+#define DEFAULT_RECORD_S 10
+
+/* Longest the encoder may lag behind the end of an event clip, a few
+ * GOPs, before the clip is closed with what it has */
+#define RECORD_GRACE_S 5
+
+/* The GOPs of a clip are a raw H.264 stream without timestamps, once
+ * complete it is muxed into a QuickTime file by a separate gst-launch
+ * with the frame rate of the source. Nothing is re-encoded. */
+#define CLIP_RAW "event_%u.264"
+#define CLIP_NAME "event_%u.mov"
+#define CLIP_MUXER "gst-launch-0.10"
+#define CLIP_CAPS "video/x-h264,framerate=(fraction)" VIDEO_FRAMERATE
+
+/* Segmented recording: one encoder runs for the whole recording and
+ * writes one file per GOP next to the segments, so the open segment
+ * survives a power loss as raw H.264. Segments are cut at GOP
+ * boundaries and muxed into MP4 once complete, every segment starts
+ * with the IDR of its first GOP and no frame is lost at a rotation. */
+#define SEGMENT_GOP_DIR "segment_gops"
+#define SEGMENT_PIPE "queue ! dmaienc_h264 encodingpreset=2 ratecontrol=2 targetbitrate=1500000 ! " \
+    "multifilesink next-file=key-frame location=%s/gop_%%05d.264"
+#define SEGMENT_NAME "segment_%05d.mp4"
+#define SEGMENT_RAW "segment.264"
+
+/* Burst mode: the snapshot branch queues the shots in front of the
+ * encoder, which stays open and encodes them back to back into tmpfs.
+ * The storage thread then moves each JPEG to its destination, so no
+ * request waits on the card. The queue holds as many shots as can be
+ * outstanding, so it never blocks the camera nor drops a shot, which
+ * would shift the multifilesink index of the ones behind it. */
+#define BURST_DIR "/tmp/burst"
+#define BURST_PIPE "queue max-size-buffers=%d max-size-bytes=0 max-size-time=0 ! " \
+    "dmaienc_jpeg ! jifmux ! multifilesink async=false location=" BURST_DIR "/shot_%%05d.jpg"
+#define BURST_SHOT BURST_DIR "/shot_%05d.jpg"
+
+/* multifilesink index of the next shot, kept across invocations since
+ * the snapshot branch lives as long as the camera */
+#define BURST_NEXT BURST_DIR "/next"
+
+/* Shots between the snapshot worker and the storage thread, must be a
+ * power of two. Also the most shots outstanding and the longest burst. */
+#define SHOT_QUEUE_SIZE 64
+
+/* Longest a requested shot may take to show up encoded */
+#define SHOT_TIMEOUT_MS 5000
+
 /***************************************************************************
  * Debug Macros
  ***************************************************************************/
@@ -81,22 +182,115 @@ static int bus = 0;             /* 0: system, 1: session */
 cameraHandler camera;
 GMainLoop *loop;
 
-static struct input_event in_event;
-static struct pollfd fds[1];
-
 static pthread_t loop_thread_t;
 
+/* Input devices (/dev/input/eventX) and GPIO lines that trigger a capture */
+struct trigger_source {
+    const char *name;
+    int gpio;                   /* -1 for input devices */
+    int fd;
+    struct timeval last;        /* last accepted trigger, for debouncing */
+};
+
+static struct trigger_source trigger_sources[MAX_TRIGGER_SOURCES];
+static int n_trigger_sources = 0;
+static int debounce_ms = DEFAULT_DEBOUNCE_MS;
+
+/* Triggers are handed from the event loop to the snapshot worker through
+ * a single producer / single consumer ring, so the event loop never blocks
+ * on the encoder or the disk. The semaphore only puts the worker to sleep
+ * while the ring is empty. */
+struct trigger {
+    struct timeval time;
+    unsigned int seq;
+    int source;
+};
+
+static struct trigger trigger_queue[TRIGGER_QUEUE_SIZE];
+static volatile unsigned int trigger_head = 0;  /* written by the event loop */
+static volatile unsigned int trigger_tail = 0;  /* written by the worker */
+static unsigned int triggers_dropped = 0;
+static sem_t trigger_sem;
+
+static pthread_t snapshot_thread_t;
+
+/* Number of snapshots taken on each trigger */
+static int burst_count = 1;
+
+/* Set with -B, shots are encoded into BURST_DIR and stored in the background */
+static int burst_mode = 0;
+
+/* Frames kept by the frame ring, set with -F when starting the camera */
+static int ring_frames = 0;
+
+/* Request and reply of the frame ring, as in gst-framering's framering.h */
+struct ring_message {
+    int64_t sec;
+    int64_t usec;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+/* Seconds kept before a trigger (0 disables pre-record) and recorded after it */
+static int prerecord_s = 0;
+static int record_s = DEFAULT_RECORD_S;
+
+/* Every trigger queued for a clip pins the GOPs it still needs: the ones
+ * completed after its pre-record window starts until its clip has found
+ * its first GOP, from then on the GOPs from the one being copied. A GOP
+ * is only pruned once no pin holds it. */
+struct ring_pin {
+    unsigned int seq;           /* 0 if the pin is free */
+    int64_t since;              /* start of the window, us */
+    int index;                  /* GOP being copied, -1 before the first */
+};
+
+/* Oldest GOP kept in the pre-record ring and the pins of the triggers
+ * queued and being recorded */
+static pthread_mutex_t ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int ring_first = 0;
+static struct ring_pin ring_pins[TRIGGER_QUEUE_SIZE + 1];
+
+/* Set on SIGINT/SIGTERM or a failing event loop in event mode */
+static volatile sig_atomic_t event_stop = 0;
+
+/* Shots requested in burst mode waiting for the storage thread, same
+ * single producer / single consumer scheme as the triggers. A shot with
+ * index 0 stops the thread. */
+struct shot {
+    struct timeval trigger;
+    struct timeval requested;
+    int index;
+    int file;                   /* multifilesink index */
+    char source[MAX_STR];
+};
+
+static struct shot shot_queue[SHOT_QUEUE_SIZE];
+static volatile unsigned int shot_head = 0;     /* written by the snapshot worker */
+static volatile unsigned int shot_tail = 0;     /* written by the storage thread */
+static sem_t shot_sem;
+
+static pthread_t store_thread_t;
+static int burst_fd = -1;               /* inotify on BURST_DIR, -1 if not in burst mode */
+static int burst_next = 0;              /* written by the snapshot worker */
+static int burst_closed = -1;           /* last shot closed by the encoder */
+static const char *burst_dest = ".";
+
+/* Segment rotation limits, 0 disables each limit */
+static int segment_s = 0;
+static int segment_kb = 0;
+
 enum mode {
     START,
     STOP,
     SNAPSHOT,
     STARTV,
     STOPV,
-    EVENT
+    EVENT,
+    SEGMENTS
 };
 
 static enum mode mode = START;
-static const char *filename;
 
 /****************************************************************
  * process_error
@@ -114,7 +308,7 @@ inline void process_error(int err, char *error_string)
  ****************************************************************/
 static void show_usage(char *progname)
 {
-    fprintf(stderr, "\n%s [-h] [-d <debug lvl>] [-S] < -s | -p | -c | -v | -V | -w gpio > \n\n", progname);
+    fprintf(stderr, "\n%s [-h] [-d <debug lvl>] [-S] [-b <count>] [-B] [-F <frames>] [-o <dir>] [-D <ms>] [-P <s> [-R <s>]] [-Z <KB>] < -s | -p | -c | -v | -V | -G <s> | -w event | -g gpio > \n\n", progname);
 
     fprintf(stderr,
             "             -s                   starts the camera\n");
@@ -127,7 +321,35 @@ static void show_usage(char *progname)
     fprintf(stderr,
             "             -V                   stops the video recording\n");
     fprintf(stderr,
-            "             -w /dev/input/eventX waits for the EVKEY event to trigger camera capture\n");
+            "             -G <seconds>         records MP4 segments of about <seconds>, split at key frames, until interrupted\n");
+    fprintf(stderr,
+            "             -Z <KB>              also rotates segments when they reach <KB>\n");
+    fprintf(stderr,
+            "             -w /dev/input/eventX waits for EVKEY events to trigger camera capture, may be repeated\n");
+    fprintf(stderr,
+            "             -g <gpio number>     waits for rising edges on a GPIO line to trigger camera capture, may be repeated\n");
+    fprintf(stderr,
+            "             -D <ms>              ignore triggers closer than <ms> on the same source (default %d)\n",
+            DEFAULT_DEBOUNCE_MS);
+    fprintf(stderr,
+            "             -P <seconds>         with -w/-g, keep <seconds> of H.264 before each trigger and record a clip (event_N.mov) instead of a snapshot\n");
+    fprintf(stderr,
+            "             -R <seconds>         seconds recorded after the trigger in pre-record mode (default %d)\n",
+            DEFAULT_RECORD_S);
+    fprintf(stderr,
+            "             -b <count>           number of snapshots taken on each capture (burst), up to %d\n",
+            SHOT_QUEUE_SIZE);
+    fprintf(stderr,
+            "                                  with a frame ring the first shot is the frame nearest the trigger, otherwise shots are taken when requested\n");
+    fprintf(stderr,
+            "             -B                   burst mode, with -s sets up the snapshot branch to encode the shots into tmpfs,\n");
+    fprintf(stderr,
+            "                                  with -c/-w/-g stores the shots in the background, the camera must have been started with -B\n");
+    fprintf(stderr,
+            "             -F <frames>          with -s keeps the last <frames> raw frames (up to %d), -c/-w/-g then snapshot from them\n",
+            MAX_RING_FRAMES);
+    fprintf(stderr,
+            "             -o <dir>             directory bursts are stored into in the background (default current)\n");
     fprintf(stderr,
             "             -h                   print usage information\n");
     fprintf(stderr,
@@ -148,7 +370,7 @@ static void parse_options(int argc, char *argv[])
     /* for show_usage */
     progname = argv[0];
 
-    while ((opt = getopt(argc, argv, "spcvVw:hd:S")) != -1) {
+    while ((opt = getopt(argc, argv, "spcvVG:Z:w:g:b:BF:o:D:P:R:hd:S")) != -1) {
         switch (opt) {
         case 's':
             mode = START;
@@ -171,8 +393,65 @@ static void parse_options(int argc, char *argv[])
             break;
 
         case 'w':
+        case 'g':
+            if (n_trigger_sources == MAX_TRIGGER_SOURCES) {
+                printf("ERROR: at most %d trigger sources are supported\n",
+                       MAX_TRIGGER_SOURCES);
+                exit(-1);
+            }
             mode = EVENT;
-            filename = optarg;
+            trigger_sources[n_trigger_sources].name = optarg;
+            trigger_sources[n_trigger_sources].gpio =
+                (opt == 'g') ? atoi(optarg) : -1;
+            trigger_sources[n_trigger_sources].fd = -1;
+            n_trigger_sources++;
+            break;
+
+        case 'D':
+            debounce_ms = atoi(optarg);
+            break;
+
+        case 'P':
+            prerecord_s = atoi(optarg);
+            break;
+
+        case 'R':
+            record_s = atoi(optarg);
+            break;
+
+        case 'G':
+            mode = SEGMENTS;
+            segment_s = atoi(optarg);
+            break;
+
+        case 'Z':
+            segment_kb = atoi(optarg);
+            break;
+
+        case 'b':
+            burst_count = atoi(optarg);
+            if (burst_count < 1 || burst_count > SHOT_QUEUE_SIZE) {
+                show_usage(progname);
+                printf("ERROR: invalid burst count '%s'\n", optarg);
+                exit(-1);
+            }
+            break;
+
+        case 'B':
+            burst_mode = 1;
+            break;
+
+        case 'F':
+            ring_frames = atoi(optarg);
+            if (ring_frames < 1 || ring_frames > MAX_RING_FRAMES) {
+                show_usage(progname);
+                printf("ERROR: invalid number of ring frames '%s'\n", optarg);
+                exit(-1);
+            }
+            break;
+
+        case 'o':
+            burst_dest = optarg;
             break;
                 
         case 'h':
@@ -199,6 +478,12 @@ static void parse_options(int argc, char *argv[])
         }
     }
 
+    if (segment_kb && mode != SEGMENTS) {
+        show_usage(progname);
+        printf("ERROR: -Z only applies to segmented recording (-G)\n");
+        exit(-1);
+    }
+
     if (optind < argc) {
         show_usage(progname);
         printf("ERROR: unexpected command line parameter: %s\n",
@@ -224,145 +509,1557 @@ struct input_event {
 
 
 /***************************************************************************
- * input_event
+ * elapsed_ms
+ *
+ * Milliseconds elapsed from start to end
  ***************************************************************************/
-void *input_event(void *parm)
+static long elapsed_ms(const struct timeval *start, const struct timeval *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000 +
+        (end->tv_usec - start->tv_usec) / 1000;
+}
+
+/***************************************************************************
+ * shot_space
+ *
+ * Shots that can still be queued for the storage thread
+ ***************************************************************************/
+static unsigned int shot_space(void)
+{
+    return SHOT_QUEUE_SIZE - (shot_head - shot_tail);
+}
+
+/***************************************************************************
+ * shot_push
+ *
+ * Called only from the thread requesting snapshots. Returns -1 if the
+ * storage thread is too far behind.
+ ***************************************************************************/
+static int shot_push(const struct shot *shot)
+{
+    unsigned int head = shot_head;
+
+    if (head - shot_tail == SHOT_QUEUE_SIZE)
+        return -1;
+
+    shot_queue[head & (SHOT_QUEUE_SIZE - 1)] = *shot;
+    /* Publish the entry before the new head */
+    __sync_synchronize();
+    shot_head = head + 1;
+    sem_post(&shot_sem);
+
+    return 0;
+}
+
+/***************************************************************************
+ * burst_save
+ *
+ * Records the multifilesink index of the next shot for later invocations
+ ***************************************************************************/
+static void burst_save(void)
+{
+    FILE *file;
+
+    file = fopen(BURST_NEXT, "w");
+    if (!file)
+        return;
+    fprintf(file, "%d\n", burst_next);
+    fclose(file);
+}
+
+/***************************************************************************
+ * ring_request
+ *
+ * Asks the frame ring for count frames starting with the one captured
+ * closest to time. Returns how many it is going to encode, with the
+ * capture time of the first one, 0 if it has none or -1 if the camera
+ * runs without a ring.
+ ***************************************************************************/
+static int ring_request(const struct timeval *time, int count,
+                        struct timeval *frame)
+{
+    struct sockaddr_un address;
+    struct ring_message message;
+    int fd;
+    int n = 0;
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd < 0)
+        return -1;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, RING_SOCKET);
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address))) {
+        close(fd);
+        return -1;
+    }
+
+    memset(&message, 0, sizeof(message));
+    message.sec = time->tv_sec;
+    message.usec = time->tv_usec;
+    message.count = count;
+    if (send(fd, &message, sizeof(message), MSG_NOSIGNAL) == sizeof(message))
+        n = recv(fd, &message, sizeof(message), 0);
+    close(fd);
+
+    if (n != sizeof(message))
+        return 0;
+    frame->tv_sec = message.sec;
+    frame->tv_usec = message.usec;
+
+    return message.count;
+}
+
+/***************************************************************************
+ * take_burst
+ *
+ * Requests burst_count snapshots back to back, in one go from the frame
+ * ring if the camera has one. Encoding and storing happen behind the
+ * request, the storage thread reports each shot. A burst the storage
+ * thread has no room to track is refused before any shot is requested,
+ * an untracked shot would never be stored.
+ ***************************************************************************/
+static int take_burst(const struct timeval *trigger, const char *source)
 {
+    struct shot shot;
+    struct timeval frame;
+    int count;
+    int ret;
     int i;
-    /* */
-    if (poll(fds, 2, -1) <= 0) {
-        fprintf(stderr, "Error while doing poll of events");
-        return (void *)-1;
-    }
-    for (i = 0; i <= sizeof(fds) / sizeof(struct pollfd); i++) {
-        if (fds[i].revents == POLLIN) {
-            if (read(fds[i].fd, &in_event, sizeof(in_event)) <
-                sizeof(in_event)) {
-                fprintf(stderr, "Error reading event from %d", fds[i].fd);
-                return (void *)-1;
-            }
-            if (in_event.type == EVKEY) {
-                /* Button down */
-                if (in_event.value == 1) {
-                    printf("Button is down!\n");
-                    camera_snapshot(camera);
-                } else {
-                    printf("Button is up!\n");
-                }
+
+    shot.trigger = *trigger;
+    strncpy(shot.source, source, MAX_STR - 1);
+    shot.source[MAX_STR - 1] = '\0';
+
+    /* Only this thread queues shots, the room can only grow from here */
+    if (shot_space() < (unsigned int) burst_count) {
+        fprintf(stderr, "%s: storage is %u snapshot(s) behind, burst refused\n",
+                source, SHOT_QUEUE_SIZE - shot_space());
+        return -1;
+    }
+
+    count = ring_request(trigger, burst_count, &frame);
+    if (count == 0) {
+        fprintf(stderr, "%s: no frame to take from the ring\n", source);
+        return -1;
+    }
+    if (count > 0) {
+        gettimeofday(&shot.requested, NULL);
+        printf("%s: burst starts with the frame captured %+ld ms from the trigger\n",
+               source, elapsed_ms(trigger, &frame));
+    }
+
+    for (i = 0; i < burst_count; i++) {
+        if (count > 0 && i == count)
+            break;
+        if (count < 0) {
+            ret = camera_snapshot(camera);
+            if (ret) {
+                fprintf(stderr, "Failed to request snapshot %d of %d\n", i + 1,
+                        burst_count);
+                return ret;
             }
+            gettimeofday(&shot.requested, NULL);
+        }
+        shot.index = i + 1;
+        shot.file = burst_next++;
+        burst_save();
+        if (shot_push(&shot)) {
+            fprintf(stderr, "%s: failed to queue snapshot %d of %d for storage\n",
+                    source, i + 1, burst_count);
+            return -1;
         }
     }
-    
-    return NULL;
+
+    return 0;
 }
 
-/****************************************************************
- * main
- ****************************************************************/
-int main(int argc, char *argv[])
+/***************************************************************************
+ * take_snapshots
+ *
+ * Takes burst_count snapshots. From the frame ring they start with the
+ * frame captured closest to the trigger and are encoded behind the
+ * request, otherwise they are of the frames current when each request
+ * is served and the report says how late each one completed respect to
+ * the trigger.
+ ***************************************************************************/
+static int take_snapshots(const struct timeval *trigger, const char *source)
 {
-
-    parse_options(argc, argv);
+    struct timeval done;
+    struct timeval frame;
+    int count;
     int ret;
+    int i;
 
-    /* We have our own main loop */
-    vdbg("Initializing library");
-    ret = cameraClient_init(0);
-    process_error(ret, "can't connect to cameraClient");
-
-    loop = g_main_loop_new(NULL, TRUE);
+    if (burst_fd >= 0)
+        return take_burst(trigger, source);
 
-    camera = camera_connect();
-    if (!camera) {
-        fprintf(stderr, "\nFailed to connect to the camera daemon\n");
+    count = ring_request(trigger, burst_count, &frame);
+    if (count == 0) {
+        fprintf(stderr, "%s: no frame to take from the ring\n", source);
         return -1;
     }
-    
-    switch (mode) {
-        case START:
-            vdbg("Starting camera");
-            if (camera_is_running(camera)){
-                printf("Camera is already running\n");
-                exit(255);
-            }
+    if (count > 0) {
+        printf("%s: %d snapshot(s) being encoded, the first captured %+ld ms from the trigger\n",
+               source, count, elapsed_ms(trigger, &frame));
+        return 0;
+    }
 
-            /* Set properties of image capture, video recording and viewfinder */
-#if 1
-            vdbg("Setting view finder");
-            //ret = camera_set_view_finder_pipe(camera, "queue ! TIDmaiVideoSink videoOutput=component videoStd=720p_60");
-            ret = camera_set_view_finder_pipe(camera, "queue ! TIDmaiVideoSink videoOutput=composite sync=false");
-            process_error(ret, "can't set view finder");
-#endif
-            vdbg("Setting video src");		
-            //ret = camera_set_video_src_pipe(camera, "v4l2src always-copy=false chain-ipipe=false ! dmaiaccel ! capsfilter caps=video/x-raw-yuv,format=(fourcc)NV12,width=1280,height=720,framerate=(fraction)23/1 ");
-            ret = camera_set_video_src_pipe(camera, "v4l2src always-copy=FALSE input-src=composite ! dmaiaccel ! capsfilter caps=video/x-raw-yuv,format=(fourcc)NV12,width=720,height=480,pitch=736,framerate=(fraction)30000/1001");
-            process_error(ret, "can't set video src");
-            
-            vdbg("Setting snapshot pipe ");
-            ret = camera_set_snapshot_pipe(camera, "queue ! dmaienc_jpeg ! jifmux ! multifilesink async=false location=snapshot_%d.jpg");
-            process_error(ret, "can't set snapshot pipe");
+    for (i = 0; i < burst_count; i++) {
+        ret = camera_snapshot(camera);
+        if (ret) {
+            fprintf(stderr, "Failed to take snapshot %d of %d\n", i + 1,
+                    burst_count);
+            return ret;
+        }
+        gettimeofday(&done, NULL);
+        printf("%s: snapshot %d of %d taken, %ld ms after trigger\n", source,
+               i + 1, burst_count, elapsed_ms(trigger, &done));
+    }
 
-            vdbg("Setting video record pipe ");
-            ret = camera_set_video_recording_pipe(camera, "queue ! dmaienc_h264 encodingpreset=2 ratecontrol=2 targetbitrate=1500000 ! qtmux name=mux ! filesink location=/tmp/video.mov");
-            process_error(ret, "can't set video pipe");
-            
-            vdbg("Setting audio src ");
-            ret = camera_set_audio_src_pipe(camera, "alsasrc ! capsfilter caps=audio/x-raw-int,rate=(int)44100,channels=(int)2");
-            process_error(ret, "can't set audio src pipe");
-            
-            vdbg("Setting audio record pipe ");
-            ret = camera_set_audio_recording_pipe(camera, "queue ! dmaienc_aac bitrate=64000");
-            process_error(ret, "can't set audio recording pipe");
-            
-            ret = camera_start(camera);
-            process_error(ret, "Failed to start camera");
-            break;
-        case STOP:
-            vdbg("Stoping camera");
-            if (!camera_is_running(camera)){
-                printf("Camera is not running\n");
-                exit(255);
-            }
-            ret = camera_stop(camera);
-            process_error(ret, "Failed to stop camera");
-            break;
-        case SNAPSHOT:
-            if (!camera_is_running(camera)){
-                printf("Camera is not running\n");
-                exit(255);
-            }
-            ret = camera_snapshot(camera);
-            process_error(ret, "Failed to take snapshot");
-            printf("Snapshot taken\n");
-            break;
-        case STARTV:
-            if (!camera_is_running(camera)){
-                printf("Camera is not running\n");
-                exit(255);
-            }            
-            ret = camera_start_video_recording(camera);
-            process_error(ret, "Failed to start video recording");
-            printf("Video recording started\n");
-            break;
-        case STOPV:
-            if (!camera_is_running(camera)){
-                printf("Camera is not running\n");
-                exit(255);
-            }            
-            ret = camera_stop_video_recording(camera);
-            process_error(ret, "Failed to stop video recording");
-            printf("Video recording stoped\n");
-            break;
-        case EVENT:
-            fds[0].fd = open(filename, O_RDONLY);
-            fds[0].events = POLLIN;
-            fds[0].revents = 0;
-            
-            in_event.type = 0;
-            in_event.value = 0;
-            pthread_create(&loop_thread_t, NULL, input_event, NULL);
+    return 0;
+}
+
+/***************************************************************************
+ * trigger_push
+ *
+ * Called only from the event loop thread. Returns -1 if the worker is
+ * too far behind and the trigger had to be dropped.
+ ***************************************************************************/
+static int trigger_push(const struct trigger *trigger)
+{
+    unsigned int head = trigger_head;
+
+    if (head - trigger_tail == TRIGGER_QUEUE_SIZE)
+        return -1;
+
+    trigger_queue[head & (TRIGGER_QUEUE_SIZE - 1)] = *trigger;
+    /* Publish the entry before the new head */
+    __sync_synchronize();
+    trigger_head = head + 1;
+    sem_post(&trigger_sem);
+
+    return 0;
+}
+
+/***************************************************************************
+ * trigger_pop
+ *
+ * Called only from the snapshot worker, blocks until a trigger is queued
+ ***************************************************************************/
+static void trigger_pop(struct trigger *trigger)
+{
+    unsigned int tail;
+
+    while (sem_wait(&trigger_sem) && errno == EINTR);
+
+    tail = trigger_tail;
+    *trigger = trigger_queue[tail & (TRIGGER_QUEUE_SIZE - 1)];
+    /* Done with the entry before handing the slot back */
+    __sync_synchronize();
+    trigger_tail = tail + 1;
+}
+
+/***************************************************************************
+ * timeval_us
+ ***************************************************************************/
+static int64_t timeval_us(const struct timeval *time)
+{
+    return (int64_t)time->tv_sec * 1000000 + time->tv_usec;
+}
+
+/***************************************************************************
+ * gop_file
+ *
+ * Gets the path of a GOP written by multifilesink into dir, the time it
+ * was completed in microseconds and its size. Returns -1 if the GOP
+ * hasn't been written yet.
+ ***************************************************************************/
+static int gop_file(const char *dir, int index, char *path, int64_t *end,
+                    off_t *size)
+{
+    struct stat st;
+
+    snprintf(path, MAX_STR, "%s/gop_%05d.264", dir, index);
+    if (stat(path, &st))
+        return -1;
+    if (end)
+        *end = (int64_t)st.st_mtim.tv_sec * 1000000 + st.st_mtim.tv_nsec / 1000;
+    if (size)
+        *size = st.st_size;
+
+    return 0;
+}
 
-            g_main_loop_run(loop);            
+/***************************************************************************
+ * ring_gop
+ *
+ * Same for a GOP in the pre-record ring
+ ***************************************************************************/
+static int ring_gop(int index, char *path, int64_t *end)
+{
+    return gop_file(PRERECORD_DIR, index, path, end, NULL);
+}
+
+/***************************************************************************
+ * ring_pin_set
+ *
+ * Pins the ring for a trigger, or moves its pin to the GOP index when
+ * index isn't -1. Called with ring_mutex held. Returns -1 if every pin
+ * is taken.
+ ***************************************************************************/
+static int ring_pin_set(unsigned int seq, int64_t since, int index)
+{
+    struct ring_pin *free_pin = NULL;
+    int i;
+
+    for (i = 0; i < TRIGGER_QUEUE_SIZE + 1; i++) {
+        if (ring_pins[i].seq == seq) {
+            ring_pins[i].index = index;
+            return 0;
+        }
+        if (!ring_pins[i].seq && !free_pin)
+            free_pin = &ring_pins[i];
+    }
+    if (!free_pin)
+        return -1;
+
+    free_pin->seq = seq;
+    free_pin->since = since;
+    free_pin->index = index;
+
+    return 0;
+}
+
+/***************************************************************************
+ * ring_unpin
+ *
+ * Called with ring_mutex held
+ ***************************************************************************/
+static void ring_unpin(unsigned int seq)
+{
+    int i;
+
+    for (i = 0; i < TRIGGER_QUEUE_SIZE + 1; i++)
+        if (ring_pins[i].seq == seq)
+            ring_pins[i].seq = 0;
+}
+
+/***************************************************************************
+ * ring_pinned
+ *
+ * Whether a GOP completed at end is still needed by a trigger. Called
+ * with ring_mutex held.
+ ***************************************************************************/
+static int ring_pinned(int index, int64_t end)
+{
+    int i;
+
+    for (i = 0; i < TRIGGER_QUEUE_SIZE + 1; i++) {
+        if (!ring_pins[i].seq)
+            continue;
+        if (ring_pins[i].index >= 0 ? index >= ring_pins[i].index :
+            end >= ring_pins[i].since)
+            return 1;
+    }
+
+    return 0;
+}
+
+/***************************************************************************
+ * prerecord_prune
+ *
+ * Periodic callback on the main loop dropping the GOPs that fell out of
+ * the pre-record window and no trigger needs anymore. A GOP is only
+ * complete once the next one exists.
+ ***************************************************************************/
+static gboolean prerecord_prune(gpointer data)
+{
+    char path[MAX_STR];
+    char next[MAX_STR];
+    struct timeval now;
+    int64_t end;
+    int64_t limit;
+
+    gettimeofday(&now, NULL);
+    limit = timeval_us(&now) - (int64_t)prerecord_s * 1000000;
+
+    pthread_mutex_lock(&ring_mutex);
+    while (!ring_gop(ring_first, path, &end) && end < limit &&
+           !ring_pinned(ring_first, end) &&
+           !ring_gop(ring_first + 1, next, NULL)) {
+        unlink(path);
+        ring_first++;
+    }
+    pthread_mutex_unlock(&ring_mutex);
+
+    return TRUE;
+}
+
+/***************************************************************************
+ * prerecord_clear
+ *
+ * Removes the GOPs left in the pre-record directory
+ ***************************************************************************/
+static int prerecord_clear(void)
+{
+    DIR *dir;
+    struct dirent *entry;
+    char path[MAX_STR];
+
+    dir = opendir(PRERECORD_DIR);
+    if (!dir)
+        return -1;
+    while ((entry = readdir(dir))) {
+        if (!strncmp(entry->d_name, "gop_", 4)) {
+            snprintf(path, MAX_STR, PRERECORD_DIR "/%s", entry->d_name);
+            unlink(path);
+        }
+    }
+    closedir(dir);
+
+    return 0;
+}
+
+/***************************************************************************
+ * prerecord_start
+ *
+ * Starts the recording branch into the pre-record ring
+ ***************************************************************************/
+static int prerecord_start(void)
+{
+    int ret;
+
+    mkdir(PRERECORD_DIR, 0755);
+    if (prerecord_clear())
+        return -1;
+
+    ret = camera_set_video_recording_pipe(camera, PRERECORD_PIPE);
+    if (ret)
+        return ret;
+    ret = camera_start_video_recording(camera);
+    if (ret)
+        return ret;
+
+    g_timeout_add_seconds(1, prerecord_prune, NULL);
+    prt("Keeping %d seconds of video before each trigger", prerecord_s);
+
+    return 0;
+}
+
+/***************************************************************************
+ * prerecord_finish
+ *
+ * Stops the recording branch, puts the default recording pipe back and
+ * removes the pre-record ring
+ ***************************************************************************/
+static int prerecord_finish(void)
+{
+    int ret;
+
+    ret = camera_stop_video_recording(camera);
+    if (ret)
+        return ret;
+    ret = camera_set_video_recording_pipe(camera, RECORDING_PIPE);
+    if (ret)
+        return ret;
+
+    prerecord_clear();
+    rmdir(PRERECORD_DIR);
+    dbg("Pre-record ring removed");
+
+    return 0;
+}
+
+/***************************************************************************
+ * event_interrupt
+ ***************************************************************************/
+static void event_interrupt(int sig)
+{
+    event_stop = 1;
+}
+
+/***************************************************************************
+ * event_check
+ *
+ * Periodic callback on the main loop ending event mode once interrupted
+ ***************************************************************************/
+static gboolean event_check(gpointer data)
+{
+    if (!event_stop)
+        return TRUE;
+
+    g_main_loop_quit(loop);
+    return FALSE;
+}
+
+/***************************************************************************
+ * append_file
+ ***************************************************************************/
+static int append_file(int out, const char *path)
+{
+    char buf[64 * 1024];
+    int in;
+    int n;
+    int total = 0;
+
+    in = open(path, O_RDONLY);
+    if (in < 0)
+        return -1;
+    while ((n = read(in, buf, sizeof(buf))) > 0) {
+        if (write(out, buf, n) != n) {
+            total = -1;
+            break;
+        }
+        total += n;
+    }
+    close(in);
+
+    return total;
+}
+
+/***************************************************************************
+ * burst_wait
+ *
+ * Waits for the encoder to close the JPEG with the given multifilesink
+ * index. The encoder closes the shots in order, so once a later one is
+ * closed this one is either complete or lost. Returns -1 if it is lost
+ * or doesn't show up in time.
+ ***************************************************************************/
+static int burst_wait(int file, char *path)
+{
+    static char events[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    static int length = 0;
+    static int offset = 0;
+    struct inotify_event *event;
+    struct pollfd pfd;
+    char late[MAX_STR];
+    int closed;
+
+    snprintf(path, MAX_STR, BURST_SHOT, file);
+
+    for (;;) {
+        while (offset < length) {
+            event = (struct inotify_event *) (events + offset);
+            offset += sizeof(struct inotify_event) + event->len;
+            if (!event->len || sscanf(event->name, "shot_%d.jpg", &closed) != 1)
+                continue;
+            if (closed < file) {
+                /* A shot given up on earlier, nobody will store it */
+                snprintf(late, MAX_STR, BURST_SHOT, closed);
+                unlink(late);
+            } else if (closed > burst_closed) {
+                burst_closed = closed;
+            }
+        }
+
+        if (burst_closed >= file)
+            return access(path, F_OK) ? -1 : 0;
+
+        pfd.fd = burst_fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, SHOT_TIMEOUT_MS) <= 0)
+            return -1;
+
+        length = read(burst_fd, events, sizeof(events));
+        offset = 0;
+        if (length < 0)
+            length = 0;
+    }
+}
+
+/***************************************************************************
+ * store_shot
+ *
+ * Moves an encoded shot out of tmpfs, returns once it is on the card
+ ***************************************************************************/
+static int store_shot(const char *path, char *dest)
+{
+    int out;
+    int n;
+
+    snprintf(dest, MAX_STR, "%s/%s", burst_dest, strrchr(path, '/') + 1);
+    out = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+        return -1;
+
+    n = append_file(out, path);
+    if (n >= 0)
+        n = fsync(out);
+    close(out);
+    unlink(path);
+
+    return (n < 0) ? -1 : 0;
+}
+
+/***************************************************************************
+ * store_worker
+ *
+ * Storage thread of burst mode. Each shot is matched to its JPEG by the
+ * multifilesink index, so a shot that never shows up doesn't shift the
+ * ones behind it.
+ ***************************************************************************/
+void *store_worker(void *parm)
+{
+    struct shot shot;
+    struct timeval encoded;
+    struct timeval stored;
+    struct stat st;
+    char path[MAX_STR];
+    char dest[MAX_STR];
+    unsigned int tail;
+
+    while (1) {
+        while (sem_wait(&shot_sem) && errno == EINTR);
+
+        tail = shot_tail;
+        shot = shot_queue[tail & (SHOT_QUEUE_SIZE - 1)];
+        __sync_synchronize();
+        shot_tail = tail + 1;
+
+        if (!shot.index)
+            break;
+
+        if (burst_wait(shot.file, path)) {
+            fprintf(stderr, "%s: snapshot %d of %d lost or not encoded within %d ms\n",
+                    shot.source, shot.index, burst_count, SHOT_TIMEOUT_MS);
+            continue;
+        }
+
+        /* The events may have queued up while storing earlier shots,
+         * the file itself knows when the encoder finished it */
+        encoded.tv_sec = 0;
+        if (!stat(path, &st)) {
+            encoded.tv_sec = st.st_mtim.tv_sec;
+            encoded.tv_usec = st.st_mtim.tv_nsec / 1000;
+        }
+
+        if (store_shot(path, dest)) {
+            fprintf(stderr, "%s: failed to store snapshot %d of %d into %s\n",
+                    shot.source, shot.index, burst_count, dest);
+            continue;
+        }
+        gettimeofday(&stored, NULL);
+
+        printf("%s: snapshot %d of %d requested %ld ms, encoded %ld ms, stored %ld ms after trigger (%s)\n",
+               shot.source, shot.index, burst_count,
+               elapsed_ms(&shot.trigger, &shot.requested),
+               encoded.tv_sec ? elapsed_ms(&shot.trigger, &encoded) : -1,
+               elapsed_ms(&shot.trigger, &stored), dest);
+    }
+
+    return NULL;
+}
+
+/***************************************************************************
+ * burst_clear
+ *
+ * Removes the shots left in BURST_DIR
+ ***************************************************************************/
+static int burst_clear(void)
+{
+    DIR *dir;
+    struct dirent *entry;
+    char path[MAX_STR];
+
+    dir = opendir(BURST_DIR);
+    if (!dir)
+        return -1;
+    while ((entry = readdir(dir))) {
+        if (!strncmp(entry->d_name, "shot_", 5)) {
+            snprintf(path, MAX_STR, BURST_DIR "/%s", entry->d_name);
+            unlink(path);
+        }
+    }
+    closedir(dir);
+
+    return 0;
+}
+
+/***************************************************************************
+ * burst_start
+ *
+ * Starts the storage thread in burst mode. The watch is in place before
+ * any shot is requested so none is missed, shots left by an earlier
+ * invocation are dropped.
+ ***************************************************************************/
+static int burst_start(void)
+{
+    FILE *file;
+
+    if (!burst_mode)
+        return 0;
+
+    burst_fd = inotify_init();
+    if (burst_fd < 0)
+        return -1;
+    if (inotify_add_watch(burst_fd, BURST_DIR, IN_CLOSE_WRITE) < 0) {
+        fprintf(stderr, "%s missing, was the camera started with -B?\n",
+                BURST_DIR);
+        close(burst_fd);
+        burst_fd = -1;
+        return -1;
+    }
+    burst_clear();
+
+    file = fopen(BURST_NEXT, "r");
+    if (file) {
+        if (fscanf(file, "%d", &burst_next) != 1)
+            burst_next = 0;
+        fclose(file);
+    }
+    burst_closed = burst_next - 1;
+
+    sem_init(&shot_sem, 0, 0);
+    pthread_create(&store_thread_t, NULL, store_worker, NULL);
+    dbg("Burst mode, storing into %s", burst_dest);
+
+    return 0;
+}
+
+/***************************************************************************
+ * burst_stop
+ *
+ * Lets the storage thread finish the queued shots
+ ***************************************************************************/
+static void burst_stop(void)
+{
+    struct shot shot;
+
+    if (burst_fd < 0)
+        return;
+
+    memset(&shot, 0, sizeof(shot));
+    while (shot_push(&shot))
+        usleep(10000);
+    pthread_join(store_thread_t, NULL);
+
+    close(burst_fd);
+    burst_fd = -1;
+}
+
+/***************************************************************************
+ * ring_setup
+ *
+ * Sets the view finder and the video source when starting the camera.
+ * With a frame ring the view finder branch also feeds the ring and its
+ * encoder, which write the shots where the snapshot branch would.
+ ***************************************************************************/
+static int ring_setup(void)
+{
+    char pipe[MAX_STR * 2];
+    char queue[MAX_STR];
+    int ret;
+
+    if (!ring_frames) {
+        ret = camera_set_view_finder_pipe(camera, VIEWFINDER_PIPE);
+        if (ret)
+            return ret;
+        snprintf(pipe, sizeof(pipe), VIDEO_SRC_PIPE, "");
+        return camera_set_video_src_pipe(camera, pipe);
+    }
+
+    snprintf(pipe, sizeof(pipe), RING_PIPE, ring_frames,
+             burst_mode ? BURST_SHOT : SNAPSHOT_NAME);
+    ret = camera_set_view_finder_pipe(camera, pipe);
+    if (ret)
+        return ret;
+
+    /* Capture buffers for the frames held in the ring on top of the ones
+     * on their way to the display and the encoder */
+    snprintf(queue, MAX_STR, " queue-size=%d", ring_frames + RING_QUEUE_EXTRA);
+    snprintf(pipe, sizeof(pipe), VIDEO_SRC_PIPE, queue);
+
+    return camera_set_video_src_pipe(camera, pipe);
+}
+
+/***************************************************************************
+ * burst_setup
+ *
+ * Chooses the snapshot branch when starting the camera. In burst mode
+ * the shot index starts over with the new encoder.
+ ***************************************************************************/
+static int burst_setup(void)
+{
+    char snapshot_pipe[MAX_STR];
+
+    burst_clear();
+    unlink(BURST_NEXT);
+    rmdir(BURST_DIR);
+
+    if (!burst_mode)
+        return camera_set_snapshot_pipe(camera, SNAPSHOT_PIPE);
+
+    if (mkdir(BURST_DIR, 0755))
+        return -1;
+    burst_next = 0;
+    burst_save();
+
+    /* The ring's encoder numbers the shots, keep the snapshot branch out
+     * of BURST_DIR */
+    if (ring_frames)
+        return camera_set_snapshot_pipe(camera, SNAPSHOT_PIPE);
+
+    snprintf(snapshot_pipe, MAX_STR, BURST_PIPE, SHOT_QUEUE_SIZE);
+
+    return camera_set_snapshot_pipe(camera, snapshot_pipe);
+}
+
+/***************************************************************************
+ * mux_stream
+ *
+ * Muxes a raw H.264 stream into a file with the given muxer element,
+ * runs the muxing pipeline to completion
+ ***************************************************************************/
+static int mux_stream(const char *raw, const char *muxed, const char *muxer)
+{
+    char src[MAX_STR];
+    char sink[MAX_STR];
+    pid_t pid;
+    int status;
+
+    snprintf(src, MAX_STR, "location=%s", raw);
+    snprintf(sink, MAX_STR, "location=%s", muxed);
+
+    pid = fork();
+    if (pid < 0)
+        return -1;
+    if (!pid) {
+        execlp(CLIP_MUXER, CLIP_MUXER, "-q", "filesrc", src, "!", CLIP_CAPS,
+               "!", "h264parse", "!", muxer, "!", "filesink", sink,
+               (char *)NULL);
+        _exit(127);
+    }
+
+    while (waitpid(pid, &status, 0) < 0)
+        if (errno != EINTR)
+            return -1;
+
+    return (WIFEXITED(status) && !WEXITSTATUS(status)) ? 0 : -1;
+}
+
+/***************************************************************************
+ * record_clip
+ *
+ * Writes a clip starting at the oldest IDR inside the pre-record window
+ * and following the live stream until record_s seconds after the
+ * trigger. GOPs are appended as they are and the result is muxed,
+ * nothing is re-encoded. The trigger pinned the ring when it was queued,
+ * the pin follows the GOP being copied.
+ ***************************************************************************/
+static int record_clip(const struct trigger *trigger, const char *source)
+{
+    char raw[MAX_STR];
+    char clip[MAX_STR];
+    char path[MAX_STR];
+    char next[MAX_STR];
+    int64_t end;
+    int64_t since = timeval_us(&trigger->time) - (int64_t)prerecord_s * 1000000;
+    int64_t until = timeval_us(&trigger->time) + (int64_t)record_s * 1000000;
+    int64_t give_up = until + (int64_t)RECORD_GRACE_S * 1000000;
+    struct timeval now;
+    struct timeval done;
+    int index;
+    int first;
+    int bytes = 0;
+    int n;
+    int out;
+
+    snprintf(raw, MAX_STR, CLIP_RAW, trigger->seq);
+    snprintf(clip, MAX_STR, CLIP_NAME, trigger->seq);
+    out = open(raw, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        fprintf(stderr, "%s: can't create %s\n", source, raw);
+        pthread_mutex_lock(&ring_mutex);
+        ring_unpin(trigger->seq);
+        pthread_mutex_unlock(&ring_mutex);
+        return -1;
+    }
+
+    pthread_mutex_lock(&ring_mutex);
+    index = ring_first;
+    while (!ring_gop(index, path, &end) && end < since)
+        index++;
+    ring_pin_set(trigger->seq, since, index);
+    pthread_mutex_unlock(&ring_mutex);
+    first = index;
+
+    do {
+        /* Wait for the GOP to be completed by the encoder */
+        gettimeofday(&now, NULL);
+        while (ring_gop(index + 1, next, NULL) && timeval_us(&now) < give_up) {
+            usleep(100000);
+            gettimeofday(&now, NULL);
+        }
+        if (ring_gop(index + 1, next, NULL)) {
+            fprintf(stderr, "%s: encoder stalled, clip %s cut short\n",
+                    source, clip);
+            n = -1;
+            break;
+        }
+        ring_gop(index, path, &end);
+
+        n = append_file(out, path);
+        if (n < 0) {
+            fprintf(stderr, "%s: failed to copy %s into %s\n", source,
+                    path, raw);
+            break;
+        }
+        bytes += n;
+
+        pthread_mutex_lock(&ring_mutex);
+        ring_pin_set(trigger->seq, since, ++index);
+        pthread_mutex_unlock(&ring_mutex);
+    } while (end < until);
+
+    pthread_mutex_lock(&ring_mutex);
+    ring_unpin(trigger->seq);
+    pthread_mutex_unlock(&ring_mutex);
+    close(out);
+
+    if (bytes && mux_stream(raw, clip, "qtmux")) {
+        fprintf(stderr, "%s: failed to mux %s, raw stream kept\n", source,
+                clip);
+        return -1;
+    }
+    unlink(raw);
+
+    gettimeofday(&done, NULL);
+    printf("%s: clip %s written, %d GOPs (%d bytes), %ld ms after trigger\n",
+           source, clip, index - first, bytes,
+           elapsed_ms(&trigger->time, &done));
+
+    return (n < 0) ? -1 : 0;
+}
+
+/***************************************************************************
+ * snapshot_worker
+ ***************************************************************************/
+void *snapshot_worker(void *parm)
+{
+    struct trigger trigger;
+    char label[MAX_STR];
+
+    while (1) {
+        trigger_pop(&trigger);
+        /* Sequence numbers start at 1, 0 stops the worker */
+        if (!trigger.seq)
+            break;
+        snprintf(label, MAX_STR, "trigger %u (%s)", trigger.seq,
+                 trigger_sources[trigger.source].name);
+        if (prerecord_s > 0)
+            record_clip(&trigger, label);
+        else
+            take_snapshots(&trigger.time, label);
+    }
+
+    return NULL;
+}
+
+/***************************************************************************
+ * trigger_fire
+ *
+ * Debounces a trigger from the given source and queues it for capture
+ ***************************************************************************/
+static void trigger_fire(int source, const struct timeval *time)
+{
+    static unsigned int seq = 0;
+    struct trigger_source *src = &trigger_sources[source];
+    struct trigger trigger;
+
+    if (src->last.tv_sec && elapsed_ms(&src->last, time) < debounce_ms) {
+        vdbg("Bouncing trigger on %s ignored", src->name);
+        return;
+    }
+    src->last = *time;
+
+    trigger.time = *time;
+    trigger.seq = ++seq;
+    trigger.source = source;
+    dbg("Trigger %u from %s", trigger.seq, src->name);
+
+    /* Keeps the window of the clip from being pruned while it waits */
+    if (prerecord_s > 0) {
+        pthread_mutex_lock(&ring_mutex);
+        ring_pin_set(trigger.seq,
+                     timeval_us(time) - (int64_t)prerecord_s * 1000000, -1);
+        pthread_mutex_unlock(&ring_mutex);
+    }
+
+    if (trigger_push(&trigger)) {
+        if (prerecord_s > 0) {
+            pthread_mutex_lock(&ring_mutex);
+            ring_unpin(trigger.seq);
+            pthread_mutex_unlock(&ring_mutex);
+        }
+        triggers_dropped++;
+        fprintf(stderr, "Trigger %u from %s dropped, %u dropped so far\n",
+                trigger.seq, src->name, triggers_dropped);
+    }
+}
+
+/***************************************************************************
+ * gpio_write
+ ***************************************************************************/
+static int gpio_write(const char *path, const char *value)
+{
+    int fd;
+    int ret;
+
+    fd = open(path, O_WRONLY);
+    if (fd < 0)
+        return -1;
+    ret = write(fd, value, strlen(value));
+    close(fd);
+
+    return (ret < 0) ? -1 : 0;
+}
+
+/***************************************************************************
+ * trigger_source_open
+ *
+ * Input devices are read as a stream of input_event structures. GPIO
+ * lines are exported through sysfs and configured to report rising
+ * edges as POLLPRI on their value file.
+ ***************************************************************************/
+static int trigger_source_open(struct trigger_source *src)
+{
+    char path[MAX_STR];
+    char value[8];
+
+    if (src->gpio < 0) {
+        src->fd = open(src->name, O_RDONLY | O_NONBLOCK);
+        return src->fd;
+    }
+
+    snprintf(path, MAX_STR, "/sys/class/gpio/gpio%d/value", src->gpio);
+    if (access(path, F_OK)) {
+        snprintf(value, sizeof(value), "%d", src->gpio);
+        gpio_write("/sys/class/gpio/export", value);
+    }
+
+    snprintf(path, MAX_STR, "/sys/class/gpio/gpio%d/direction", src->gpio);
+    gpio_write(path, "in");
+    snprintf(path, MAX_STR, "/sys/class/gpio/gpio%d/edge", src->gpio);
+    if (gpio_write(path, "rising")) {
+        fprintf(stderr, "GPIO %d doesn't support edge interrupts\n", src->gpio);
+        return -1;
+    }
+
+    snprintf(path, MAX_STR, "/sys/class/gpio/gpio%d/value", src->gpio);
+    src->fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (src->fd < 0)
+        return -1;
+
+    /* Consume the current value so only new edges wake us up */
+    read(src->fd, value, sizeof(value));
+
+    return src->fd;
+}
+
+/***************************************************************************
+ * trigger_source_read
+ ***************************************************************************/
+static void trigger_source_read(int source)
+{
+    struct trigger_source *src = &trigger_sources[source];
+    struct input_event events[16];
+    struct timeval now;
+    char value[8];
+    int n;
+    int i;
+
+    if (src->gpio >= 0) {
+        gettimeofday(&now, NULL);
+        lseek(src->fd, 0, SEEK_SET);
+        if (read(src->fd, value, sizeof(value)) > 0)
+            trigger_fire(source, &now);
+        return;
+    }
+
+    while ((n = read(src->fd, events, sizeof(events))) > 0) {
+        for (i = 0; i < n / (int)sizeof(struct input_event); i++) {
+            /* Button down */
+            if (events[i].type == EVKEY && events[i].value == 1)
+                trigger_fire(source, &events[i].time);
+        }
+    }
+
+    if (n < 0 && errno != EAGAIN)
+        fprintf(stderr, "Error reading events from %s\n", src->name);
+}
+
+/***************************************************************************
+ * trigger_loop_open
+ *
+ * Opens the trigger sources and watches them on a new epoll instance.
+ * A source that fails is left out, returns -1 if none is left.
+ ***************************************************************************/
+static int trigger_loop_open(void)
+{
+    struct epoll_event ev;
+    int epfd;
+    int watched = 0;
+    int i;
+
+    epfd = epoll_create(MAX_TRIGGER_SOURCES);
+    if (epfd < 0) {
+        fprintf(stderr, "Error creating the event loop\n");
+        return -1;
+    }
+
+    for (i = 0; i < n_trigger_sources; i++) {
+        if (trigger_source_open(&trigger_sources[i]) < 0) {
+            fprintf(stderr, "Error opening trigger source %s\n",
+                    trigger_sources[i].name);
+            continue;
+        }
+        memset(&ev, 0, sizeof(ev));
+        ev.events = (trigger_sources[i].gpio < 0) ? EPOLLIN : EPOLLPRI;
+        ev.data.u32 = i;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, trigger_sources[i].fd, &ev)) {
+            fprintf(stderr, "Error watching trigger source %s\n",
+                    trigger_sources[i].name);
+            close(trigger_sources[i].fd);
+            trigger_sources[i].fd = -1;
+            continue;
+        }
+        prt("Waiting for triggers on %s", trigger_sources[i].name);
+        watched++;
+    }
+
+    if (!watched) {
+        close(epfd);
+        return -1;
+    }
+
+    return epfd;
+}
+
+/***************************************************************************
+ * input_event
+ *
+ * Event loop waiting on the trigger sources watched by the given epoll
+ * instance, runs until cancelled. A failure ends event mode.
+ ***************************************************************************/
+void *input_event(void *parm)
+{
+    struct epoll_event events[MAX_TRIGGER_SOURCES];
+    int epfd = (int)(long)parm;
+    int n;
+    int i;
+
+    while (1) {
+        n = epoll_wait(epfd, events, MAX_TRIGGER_SOURCES, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Error while waiting for events\n");
+            break;
+        }
+        for (i = 0; i < n; i++)
+            trigger_source_read(events[i].data.u32);
+    }
+
+    event_stop = 1;
+
+    return NULL;
+}
+
+/***************************************************************************
+ * trigger_loop_stop
+ *
+ * Stops waiting for triggers and lets the worker finish the captures
+ * already queued
+ ***************************************************************************/
+static void trigger_loop_stop(void)
+{
+    struct trigger stop;
+
+    pthread_cancel(loop_thread_t);
+    pthread_join(loop_thread_t, NULL);
+
+    /* The event loop is gone, this thread is the producer now */
+    memset(&stop, 0, sizeof(stop));
+    while (trigger_push(&stop))
+        usleep(10000);
+    pthread_join(snapshot_thread_t, NULL);
+}
+
+/***************************************************************************
+ * Segmented recording
+ *
+ * The recording branch runs from start to stop and segments are cut
+ * from its GOP files, see SEGMENT_PIPE. libgstcam only lets a client
+ * set pipes and start or stop them, and its sources are not part of
+ * this tree, so the segment closed notification is a callback of this
+ * application rather than of the library.
+ ***************************************************************************/
+typedef void (*SegmentClosedCallback) (const char *path, int index,
+                                       long duration_ms, off_t size);
+
+static SegmentClosedCallback segment_closed_cb = NULL;
+static volatile sig_atomic_t segment_stop = 0;
+static char segment_dir[MAX_STR];
+static int segment_index = 0;
+static int segment_gop = 0;             /* first GOP of the open segment */
+static int64_t segment_start = 0;       /* when the open segment started, us */
+
+/***************************************************************************
+ * on_segment_closed
+ ***************************************************************************/
+static void on_segment_closed(const char *path, int index, long duration_ms,
+                              off_t size)
+{
+    printf("Segment %d closed: %s, %ld ms, %ld bytes\n", index, path,
+           duration_ms, (long)size);
+}
+
+/***************************************************************************
+ * segment_close
+ *
+ * Muxes GOPs segment_gop to last into the next segment, flushes it to
+ * storage and only then drops the GOPs and reports it as closed
+ ***************************************************************************/
+static int segment_close(int last)
+{
+    char raw[MAX_STR];
+    char path[MAX_STR];
+    char gop[MAX_STR];
+    int64_t end = segment_start;
+    struct stat st;
+    int out;
+    int fd;
+    int i;
+
+    snprintf(raw, MAX_STR, "%s/" SEGMENT_RAW, segment_dir);
+    snprintf(path, MAX_STR, SEGMENT_NAME, segment_index);
+
+    out = open(raw, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+        return -1;
+    for (i = segment_gop; i <= last; i++) {
+        if (gop_file(segment_dir, i, gop, &end, NULL) ||
+            append_file(out, gop) < 0) {
+            close(out);
+            return -1;
+        }
+    }
+    close(out);
+
+    if (mux_stream(raw, path, "mp4mux"))
+        return -1;
+    unlink(raw);
+
+    fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+
+    for (i = segment_gop; i <= last; i++) {
+        gop_file(segment_dir, i, gop, NULL, NULL);
+        unlink(gop);
+    }
+
+    if (stat(path, &st))
+        st.st_size = 0;
+    if (segment_closed_cb)
+        segment_closed_cb(path, segment_index, (end - segment_start) / 1000,
+                          st.st_size);
+
+    segment_index++;
+    segment_gop = last + 1;
+    segment_start = end;
+
+    return 0;
+}
+
+/***************************************************************************
+ * segment_last_gop
+ *
+ * Last GOP written so far, segment_gop - 1 if none
+ ***************************************************************************/
+static int segment_last_gop(void)
+{
+    char gop[MAX_STR];
+    int last = segment_gop - 1;
+
+    while (!gop_file(segment_dir, last + 1, gop, NULL, NULL))
+        last++;
+
+    return last;
+}
+
+/***************************************************************************
+ * segment_start_recording
+ *
+ * Starts the recording branch into the GOP directory. GOPs left there by
+ * a recording that was cut off are saved as a segment of their own
+ * first, multifilesink starts over from GOP 0.
+ ***************************************************************************/
+static int segment_start_recording(void)
+{
+    char pipe[MAX_STR * 2];
+    char cwd[MAX_STR];
+    struct timeval now;
+    int last;
+    int ret;
+
+    /* The daemon resolves the path, not this process */
+    if (!getcwd(cwd, sizeof(cwd)))
+        return -1;
+    snprintf(segment_dir, MAX_STR, "%s/" SEGMENT_GOP_DIR, cwd);
+    mkdir(segment_dir, 0755);
+
+    segment_gop = 0;
+    last = segment_last_gop();
+    if (last >= 0) {
+        /* Its start is lost, the segment counts from its first GOP */
+        gop_file(segment_dir, 0, pipe, &segment_start, NULL);
+        prt("Saving %d GOPs left by an interrupted recording", last + 1);
+        if (segment_close(last))
+            return -1;
+    }
+    segment_gop = 0;
+
+    snprintf(pipe, sizeof(pipe), SEGMENT_PIPE, segment_dir);
+    ret = camera_set_video_recording_pipe(camera, pipe);
+    if (ret)
+        return ret;
+    ret = camera_start_video_recording(camera);
+    if (ret)
+        return ret;
+
+    gettimeofday(&now, NULL);
+    segment_start = timeval_us(&now);
+    dbg("Recording GOPs into %s", segment_dir);
+
+    return 0;
+}
+
+/***************************************************************************
+ * segment_stop_recording
+ *
+ * Stops the recording branch, which completes the last GOP, and closes
+ * the open segment with it
+ ***************************************************************************/
+static int segment_stop_recording(void)
+{
+    int last;
+    int ret;
+
+    ret = camera_stop_video_recording(camera);
+    if (ret)
+        return ret;
+
+    last = segment_last_gop();
+    if (last >= segment_gop && segment_close(last))
+        return -1;
+    rmdir(segment_dir);
+
+    return 0;
+}
+
+/***************************************************************************
+ * segment_check
+ *
+ * Periodic callback on the main loop closing the open segment at the
+ * first complete GOP that takes it to its duration or size limit. A GOP
+ * is only complete once the next one exists.
+ ***************************************************************************/
+static gboolean segment_check(gpointer data)
+{
+    char gop[MAX_STR];
+    char next[MAX_STR];
+    int64_t end;
+    off_t size;
+    off_t bytes = 0;
+    int ret;
+    int i;
+
+    if (segment_stop) {
+        ret = segment_stop_recording();
+        process_error(ret, "Failed to close segment");
+        g_main_loop_quit(loop);
+        return FALSE;
+    }
+
+    for (i = segment_gop; !gop_file(segment_dir, i, gop, &end, &size) &&
+         !gop_file(segment_dir, i + 1, next, NULL, NULL); i++) {
+        bytes += size;
+        if ((segment_s && end - segment_start >= (int64_t)segment_s * 1000000) ||
+            (segment_kb && bytes >= (off_t)segment_kb * 1024)) {
+            ret = segment_close(i);
+            process_error(ret, "Failed to close segment");
+            break;
+        }
+    }
+
+    return TRUE;
+}
+
+/***************************************************************************
+ * segment_interrupt
+ ***************************************************************************/
+static void segment_interrupt(int sig)
+{
+    segment_stop = 1;
+}
+
+/****************************************************************
+ * main
+ ****************************************************************/
+int main(int argc, char *argv[])
+{
+
+    parse_options(argc, argv);
+    int ret;
+    int epfd;
+    struct timeval now;
+
+    /* We have our own main loop */
+    vdbg("Initializing library");
+    ret = cameraClient_init(0);
+    process_error(ret, "can't connect to cameraClient");
+
+    loop = g_main_loop_new(NULL, TRUE);
+
+    camera = camera_connect();
+    if (!camera) {
+        fprintf(stderr, "\nFailed to connect to the camera daemon\n");
+        return -1;
+    }
+    
+    switch (mode) {
+        case START:
+            vdbg("Starting camera");
+            if (camera_is_running(camera)){
+                printf("Camera is already running\n");
+                exit(255);
+            }
+
+            /* Set properties of image capture, video recording and viewfinder */
+            vdbg("Setting view finder and video src");
+            //ret = camera_set_view_finder_pipe(camera, "queue ! TIDmaiVideoSink videoOutput=component videoStd=720p_60");
+            //ret = camera_set_video_src_pipe(camera, "v4l2src always-copy=false chain-ipipe=false ! dmaiaccel ! capsfilter caps=video/x-raw-yuv,format=(fourcc)NV12,width=1280,height=720,framerate=(fraction)23/1 ");
+            ret = ring_setup();
+            process_error(ret, "can't set view finder or video src");
+            
+            vdbg("Setting snapshot pipe ");
+            ret = burst_setup();
+            process_error(ret, "can't set snapshot pipe");
+
+            vdbg("Setting video record pipe ");
+            ret = camera_set_video_recording_pipe(camera, RECORDING_PIPE);
+            process_error(ret, "can't set video pipe");
+            
+            vdbg("Setting audio src ");
+            ret = camera_set_audio_src_pipe(camera, "alsasrc ! capsfilter caps=audio/x-raw-int,rate=(int)44100,channels=(int)2");
+            process_error(ret, "can't set audio src pipe");
+            
+            vdbg("Setting audio record pipe ");
+            ret = camera_set_audio_recording_pipe(camera, "queue ! dmaienc_aac bitrate=64000");
+            process_error(ret, "can't set audio recording pipe");
+            
+            ret = camera_start(camera);
+            process_error(ret, "Failed to start camera");
+            break;
+        case STOP:
+            vdbg("Stoping camera");
+            if (!camera_is_running(camera)){
+                printf("Camera is not running\n");
+                exit(255);
+            }
+            ret = camera_stop(camera);
+            process_error(ret, "Failed to stop camera");
+            break;
+        case SNAPSHOT:
+            if (!camera_is_running(camera)){
+                printf("Camera is not running\n");
+                exit(255);
+            }
+            ret = burst_start();
+            process_error(ret, "Failed to start burst mode");
+            gettimeofday(&now, NULL);
+            ret = take_snapshots(&now, "snapshot");
+            burst_stop();
+            process_error(ret, "Failed to take snapshot");
+            break;
+        case STARTV:
+            if (!camera_is_running(camera)){
+                printf("Camera is not running\n");
+                exit(255);
+            }            
+            ret = camera_start_video_recording(camera);
+            process_error(ret, "Failed to start video recording");
+            printf("Video recording started\n");
+            break;
+        case STOPV:
+            if (!camera_is_running(camera)){
+                printf("Camera is not running\n");
+                exit(255);
+            }            
+            ret = camera_stop_video_recording(camera);
+            process_error(ret, "Failed to stop video recording");
+            printf("Video recording stoped\n");
+            break;
+        case SEGMENTS:
+            if (!camera_is_running(camera)){
+                printf("Camera is not running\n");
+                exit(255);
+            }
+            segment_closed_cb = on_segment_closed;
+            signal(SIGINT, segment_interrupt);
+            signal(SIGTERM, segment_interrupt);
+
+            ret = segment_start_recording();
+            process_error(ret, "Failed to start video recording");
+            printf("Segmented recording started, interrupt to stop\n");
+
+            g_timeout_add_seconds(1, segment_check, NULL);
+            g_main_loop_run(loop);
+
+            ret = camera_set_video_recording_pipe(camera, RECORDING_PIPE);
+            process_error(ret, "Failed to restore video recording pipe");
+            break;
+        case EVENT:
+            if (prerecord_s > 0 && !camera_is_running(camera)){
+                printf("Camera is not running\n");
+                exit(255);
+            }
+
+            epfd = trigger_loop_open();
+            process_error(epfd < 0, "No trigger source could be opened");
+
+            signal(SIGINT, event_interrupt);
+            signal(SIGTERM, event_interrupt);
+
+            if (prerecord_s > 0) {
+                ret = prerecord_start();
+                process_error(ret, "Failed to start pre-record");
+            } else {
+                ret = burst_start();
+                process_error(ret, "Failed to start burst mode");
+            }
+
+            sem_init(&trigger_sem, 0, 0);
+            pthread_create(&snapshot_thread_t, NULL, snapshot_worker, NULL);
+            pthread_create(&loop_thread_t, NULL, input_event, (void *)(long)epfd);
+
+            g_timeout_add_seconds(1, event_check, NULL);
+            g_main_loop_run(loop);
+
+            trigger_loop_stop();
+            close(epfd);
+
+            if (prerecord_s > 0) {
+                ret = prerecord_finish();
+                process_error(ret, "Failed to stop pre-record");
+            } else {
+                burst_stop();
+            }
             break;
 
         default:
@@ -0,0 +1,242 @@
+/*
+ * Ridgerun
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Host test of the frame link transport, runs a producer and a consumer
+ * process over memfd backed slots, then over memory lent by physical
+ * address with a plain file standing in for /dev/cmem:
+ *
+ *   make test
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "framelink.h"
+
+#define SOCKET_PATH "/tmp/framelink-test"
+#define SLOTS 3
+#define FRAME_SIZE (720 * 480 * 3 / 2)
+#define FRAMES 500
+#define CAPS "video/x-raw-yuv, format=(fourcc)NV12, width=(int)720, height=(int)480"
+
+/* Lent buffers, at an offset that is not page aligned */
+#define BUFFERS (SLOTS + 1)
+#define BUFFER_PHYS(i) (4096 + 100 + (i) * FRAME_SIZE)
+
+#define check(condition) do {                                           \
+    if (!(condition)) {                                               \
+      fprintf (stderr, "%s:%d: %s failed\n", __FILE__, __LINE__,      \
+          #condition);                                                \
+      exit (1);                                                       \
+    }                                                                 \
+  } while (0)
+
+static volatile int lent[BUFFERS];
+
+static void
+release (void *data)
+{
+  lent[(long) data] = 0;
+}
+
+/* Takes every frame, checks it is the one the producer wrote and holds
+ * the last SLOTS - 1 so the producer runs out of slots now and then */
+static void
+consumer (void)
+{
+  struct framelink_client *client;
+  struct framelink_frame frame;
+  struct framelink_frame held[SLOTS];
+  unsigned char *data;
+  int n_held = 0;
+  int received = 0;
+  int ret;
+  int i;
+
+  client = framelink_client_connect (SOCKET_PATH);
+  check (client);
+
+  while ((ret = framelink_client_receive (client, &frame, 2000)) == 1) {
+    data = frame.data;
+    if (!received)
+      check (!strcmp (framelink_client_caps (client), CAPS));
+    check (frame.size == FRAME_SIZE);
+    check (data[0] == (unsigned char) frame.timestamp);
+    check (data[FRAME_SIZE - 1] == (unsigned char) frame.timestamp);
+    received++;
+
+    held[n_held++] = frame;
+    if (n_held == SLOTS - 1) {
+      for (i = 0; i < n_held; i++)
+        framelink_client_release (client, held[i].slot);
+      n_held = 0;
+    }
+
+    if (frame.timestamp == FRAMES - 1)
+      break;
+  }
+  check (ret == 1);
+
+  /* Frames held across close stay mapped until released */
+  framelink_client_close (client);
+  for (i = 0; i < n_held; i++) {
+    data = held[i].data;
+    check (data[0] == (unsigned char) held[i].timestamp);
+    framelink_client_release (client, held[i].slot);
+  }
+
+  printf ("consumer: %d frames received\n", received);
+  exit (0);
+}
+
+/* Lends the frames from a mapping of the stand-in device when cmem is
+ * set, writes them into slots otherwise */
+static void
+run (unsigned char *cmem)
+{
+  struct framelink_server *server;
+  struct framelink_frame frame;
+  int slots[SLOTS];
+  int waits = 0;
+  int sent = 0;
+  int status;
+  pid_t pid;
+  long buffer;
+  int slot;
+  int i;
+
+  server = framelink_server_new (SOCKET_PATH, SLOTS);
+  check (server);
+  check (!framelink_server_set_caps (server, CAPS));
+
+  /* Or the consumer prints it again when it exits */
+  fflush (stdout);
+  pid = fork ();
+  check (pid >= 0);
+  if (!pid)
+    consumer ();
+
+  /* Let the consumer connect before the first frame */
+  usleep (200000);
+
+  memset (&frame, 0, sizeof (frame));
+  frame.size = FRAME_SIZE;
+  for (i = 0; i < FRAMES; i++) {
+    frame.timestamp = i;
+
+    if (cmem) {
+      buffer = i % BUFFERS;
+      while (lent[buffer]) {
+        waits++;
+        usleep (1000);
+      }
+      memset (cmem + BUFFER_PHYS (buffer), i, FRAME_SIZE);
+      lent[buffer] = 1;
+      while ((slot = framelink_server_acquire_phys (server,
+                  BUFFER_PHYS (buffer), release, (void *) buffer)) < 0) {
+        waits++;
+        usleep (1000);
+      }
+    } else {
+      while ((slot = framelink_server_acquire (server, FRAME_SIZE)) < 0) {
+        waits++;
+        usleep (1000);
+      }
+      memset (framelink_server_data (server, slot), i, FRAME_SIZE);
+    }
+
+    sent += framelink_server_send (server, slot, &frame);
+    framelink_server_unref (server, slot);
+  }
+
+  check (waitpid (pid, &status, 0) == pid);
+  check (WIFEXITED (status) && WEXITSTATUS (status) == 0);
+  check (sent == FRAMES);
+
+  /* Everything came back, either released or with the disconnect */
+  usleep (100000);
+  for (i = 0; i < BUFFERS; i++)
+    check (!lent[i]);
+  for (i = 0; i < SLOTS; i++) {
+    slots[i] = framelink_server_acquire (server, FRAME_SIZE);
+    check (slots[i] >= 0);
+  }
+  for (i = 0; i < SLOTS; i++)
+    framelink_server_unref (server, slots[i]);
+
+  framelink_server_free (server);
+
+  printf ("producer: %d frames %s, waited %d times for a free slot\n",
+      sent, cmem ? "lent" : "sent", waits);
+}
+
+int
+main (int argc, char *argv[])
+{
+  size_t size = BUFFER_PHYS (BUFFERS);
+  unsigned char *cmem;
+  int fd;
+
+  run (NULL);
+
+  fd = open (FRAMELINK_CMEM_DEVICE, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  check (fd >= 0);
+  check (!ftruncate (fd, size));
+  cmem = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  check (cmem != MAP_FAILED);
+  close (fd);
+
+  run (cmem);
+
+  munmap (cmem, size);
+  unlink (FRAMELINK_CMEM_DEVICE);
+
+  printf ("PASS\n");
+
+  return 0;
+}
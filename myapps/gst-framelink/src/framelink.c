@@ -0,0 +1,917 @@
+/*
+ * Ridgerun
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Physical addresses past 2 GB as mmap offsets */
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#ifdef FRAMELINK_CMEM
+#include <ti/sdo/linuxutils/cmem/include/cmem.h>
+#endif
+
+#include "framelink.h"
+
+#ifndef FRAMELINK_CMEM_DEVICE
+#define FRAMELINK_CMEM_DEVICE "/dev/cmem"
+#endif
+
+enum
+{
+  MESSAGE_CAPS = 1,             /* server: caps string follows */
+  MESSAGE_SLOT,                 /* server: slot memory fd attached */
+  MESSAGE_FRAME,                /* server: slot holds a frame */
+  MESSAGE_RELEASE,              /* client: done with the slot */
+  MESSAGE_CMEM,                 /* server: slot holds a frame at phys */
+};
+
+struct message
+{
+  uint32_t type;
+  uint32_t slot;
+  uint32_t generation;
+  uint32_t flags;
+  uint64_t size;
+  uint64_t timestamp;
+  uint64_t duration;
+  uint64_t phys;
+};
+
+struct packet
+{
+  struct message message;
+  char caps[FRAMELINK_MAX_CAPS];
+};
+
+struct slot
+{
+  int fd;
+  void *data;
+  size_t size;
+  /* Bumped whenever the slot gets new memory */
+  uint32_t generation;
+  int refs;
+  /* Server: the frame is memory the producer lent at this physical
+   * address, 0 for the slot's own. Client: what cmem maps. */
+  uint64_t phys;
+  void (*release) (void *data);
+  void *release_data;
+  void *cmem;
+  size_t cmem_size;
+};
+
+struct client
+{
+  int fd;
+  uint32_t known[FRAMELINK_MAX_SLOTS];
+  uint32_t held;
+};
+
+struct framelink_server
+{
+  pthread_mutex_t lock;
+  pthread_t thread;
+  int listen_fd;
+  int wake[2];
+  int closed;
+  int cmem;
+  char path[sizeof (((struct sockaddr_un *) 0)->sun_path)];
+  char caps[FRAMELINK_MAX_CAPS];
+  unsigned int n_slots;
+  struct slot slots[FRAMELINK_MAX_SLOTS];
+  struct client clients[FRAMELINK_MAX_CLIENTS];
+};
+
+struct framelink_client
+{
+  pthread_mutex_t lock;
+  int fd;
+  int cmem_fd;
+  /* One for the connection, one per frame not yet released */
+  int refs;
+  struct slot maps[FRAMELINK_MAX_SLOTS];
+  char caps[FRAMELINK_MAX_CAPS];
+};
+
+/* Anonymous shared memory, memfd where the kernel has it */
+static int
+shared_memory (size_t size)
+{
+  char path[] = "/dev/shm/framelink-XXXXXX";
+  int fd = -1;
+
+#ifdef __NR_memfd_create
+  fd = syscall (__NR_memfd_create, "framelink", 0);
+#endif
+  if (fd < 0) {
+    fd = mkstemp (path);
+    if (fd < 0)
+      return -1;
+    unlink (path);
+  }
+
+  if (ftruncate (fd, size) < 0) {
+    close (fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static int
+send_message (int fd, const struct message *message, const char *caps,
+    int attach, int flags)
+{
+  struct packet packet;
+  struct iovec iov;
+  struct msghdr msg;
+  char control[CMSG_SPACE (sizeof (int))];
+  struct cmsghdr *cmsg;
+  size_t length = sizeof (struct message);
+  ssize_t sent;
+
+  packet.message = *message;
+  if (caps) {
+    strncpy (packet.caps, caps, FRAMELINK_MAX_CAPS);
+    length += strlen (packet.caps) + 1;
+  }
+
+  iov.iov_base = &packet;
+  iov.iov_len = length;
+
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  if (attach >= 0) {
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof (control);
+    cmsg = CMSG_FIRSTHDR (&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+    memcpy (CMSG_DATA (cmsg), &attach, sizeof (int));
+  }
+
+  do
+    sent = sendmsg (fd, &msg, flags | MSG_NOSIGNAL);
+  while (sent < 0 && errno == EINTR);
+
+  return sent == (ssize_t) length ? 0 : -1;
+}
+
+/*
+ * Server
+ */
+
+static void
+server_destroy (struct framelink_server *server)
+{
+  unsigned int i;
+
+  for (i = 0; i < server->n_slots; i++) {
+    if (server->slots[i].data)
+      munmap (server->slots[i].data, server->slots[i].size);
+    if (server->slots[i].fd >= 0)
+      close (server->slots[i].fd);
+  }
+
+  pthread_mutex_destroy (&server->lock);
+  free (server);
+}
+
+/* With the lock held, 1 once the server is closed and nothing is held */
+static int
+server_idle (struct framelink_server *server)
+{
+  unsigned int i;
+
+  if (!server->closed)
+    return 0;
+  for (i = 0; i < server->n_slots; i++)
+    if (server->slots[i].refs)
+      return 0;
+
+  return 1;
+}
+
+/* With the lock held, gives lent memory back with the last reference */
+static void
+slot_unref (struct slot *slot)
+{
+  if (--slot->refs || !slot->release)
+    return;
+
+  slot->release (slot->release_data);
+  slot->release = NULL;
+  slot->release_data = NULL;
+}
+
+static void
+client_drop (struct framelink_server *server, struct client *client)
+{
+  unsigned int i;
+
+  for (i = 0; i < server->n_slots; i++)
+    if (client->held & (1u << i))
+      slot_unref (&server->slots[i]);
+
+  close (client->fd);
+  client->fd = -1;
+  client->held = 0;
+}
+
+static void
+client_accept (struct framelink_server *server)
+{
+  struct message message = { MESSAGE_CAPS };
+  struct client *client = NULL;
+  int fd;
+  int i;
+
+  fd = accept (server->listen_fd, NULL, NULL);
+  if (fd < 0)
+    return;
+
+  for (i = 0; i < FRAMELINK_MAX_CLIENTS && !client; i++)
+    if (server->clients[i].fd < 0)
+      client = &server->clients[i];
+
+  if (!client) {
+    close (fd);
+    return;
+  }
+
+  memset (client, 0, sizeof (struct client));
+  client->fd = fd;
+  if (server->caps[0])
+    send_message (fd, &message, server->caps, -1, MSG_DONTWAIT);
+}
+
+static void
+client_read (struct framelink_server *server, struct client *client)
+{
+  struct message message;
+  ssize_t length;
+
+  length = recv (client->fd, &message, sizeof (message), MSG_DONTWAIT);
+  if (length < 0 && (errno == EAGAIN || errno == EINTR))
+    return;
+
+  if (length != sizeof (message)) {
+    client_drop (server, client);
+    return;
+  }
+
+  if (message.type == MESSAGE_RELEASE && message.slot < server->n_slots &&
+      (client->held & (1u << message.slot))) {
+    client->held &= ~(1u << message.slot);
+    slot_unref (&server->slots[message.slot]);
+  }
+}
+
+static void *
+server_run (void *data)
+{
+  struct framelink_server *server = data;
+  struct pollfd fds[FRAMELINK_MAX_CLIENTS + 2];
+  struct client *clients[FRAMELINK_MAX_CLIENTS];
+  int n;
+  int i;
+
+  for (;;) {
+    fds[0].fd = server->wake[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = server->listen_fd;
+    fds[1].events = POLLIN;
+    n = 2;
+
+    pthread_mutex_lock (&server->lock);
+    for (i = 0; i < FRAMELINK_MAX_CLIENTS; i++) {
+      if (server->clients[i].fd < 0)
+        continue;
+      clients[n - 2] = &server->clients[i];
+      fds[n].fd = server->clients[i].fd;
+      fds[n].events = POLLIN;
+      n++;
+    }
+    pthread_mutex_unlock (&server->lock);
+
+    if (poll (fds, n, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    if (fds[0].revents)
+      break;
+
+    pthread_mutex_lock (&server->lock);
+    for (i = 2; i < n; i++)
+      if (fds[i].revents)
+        client_read (server, clients[i - 2]);
+    if (fds[1].revents)
+      client_accept (server);
+    pthread_mutex_unlock (&server->lock);
+  }
+
+  return NULL;
+}
+
+struct framelink_server *
+framelink_server_new (const char *path, unsigned int slots)
+{
+  struct framelink_server *server;
+  struct sockaddr_un address;
+  int i;
+
+  if (!slots || slots > FRAMELINK_MAX_SLOTS ||
+      strlen (path) >= sizeof (address.sun_path))
+    return NULL;
+
+  server = calloc (1, sizeof (struct framelink_server));
+  if (!server)
+    return NULL;
+
+  pthread_mutex_init (&server->lock, NULL);
+  strcpy (server->path, path);
+  server->n_slots = slots;
+  for (i = 0; i < FRAMELINK_MAX_SLOTS; i++)
+    server->slots[i].fd = -1;
+  for (i = 0; i < FRAMELINK_MAX_CLIENTS; i++)
+    server->clients[i].fd = -1;
+  server->wake[0] = server->wake[1] = -1;
+
+  server->listen_fd = socket (AF_UNIX, SOCK_SEQPACKET, 0);
+  if (server->listen_fd < 0)
+    goto fail;
+
+  memset (&address, 0, sizeof (address));
+  address.sun_family = AF_UNIX;
+  strcpy (address.sun_path, path);
+  unlink (path);
+
+  if (bind (server->listen_fd, (struct sockaddr *) &address,
+          sizeof (address)) < 0 || listen (server->listen_fd, 4) < 0)
+    goto fail;
+
+  if (pipe (server->wake) < 0)
+    goto fail;
+
+  if (pthread_create (&server->thread, NULL, server_run, server))
+    goto fail;
+
+#ifdef FRAMELINK_CMEM
+  server->cmem = CMEM_init () == 0;
+#endif
+
+  return server;
+
+fail:
+  if (server->listen_fd >= 0)
+    close (server->listen_fd);
+  if (server->wake[0] >= 0) {
+    close (server->wake[0]);
+    close (server->wake[1]);
+  }
+  server_destroy (server);
+  return NULL;
+}
+
+void
+framelink_server_free (struct framelink_server *server)
+{
+  int destroy;
+  int i;
+
+  if (!server)
+    return;
+
+  if (write (server->wake[1], "", 1) < 0)
+    perror ("framelink: wake");
+  pthread_join (server->thread, NULL);
+
+  close (server->listen_fd);
+  close (server->wake[0]);
+  close (server->wake[1]);
+  unlink (server->path);
+
+#ifdef FRAMELINK_CMEM
+  if (server->cmem)
+    CMEM_exit ();
+#endif
+
+  pthread_mutex_lock (&server->lock);
+  for (i = 0; i < FRAMELINK_MAX_CLIENTS; i++)
+    if (server->clients[i].fd >= 0)
+      client_drop (server, &server->clients[i]);
+
+  /* Any slot still referenced now belongs to the producer */
+  server->closed = 1;
+  destroy = server_idle (server);
+  pthread_mutex_unlock (&server->lock);
+
+  if (destroy)
+    server_destroy (server);
+}
+
+int
+framelink_server_set_caps (struct framelink_server *server, const char *caps)
+{
+  struct message message = { MESSAGE_CAPS };
+  int i;
+
+  if (strlen (caps) >= FRAMELINK_MAX_CAPS)
+    return -1;
+
+  pthread_mutex_lock (&server->lock);
+  strcpy (server->caps, caps);
+  for (i = 0; i < FRAMELINK_MAX_CLIENTS; i++)
+    if (server->clients[i].fd >= 0)
+      send_message (server->clients[i].fd, &message, caps, -1, MSG_DONTWAIT);
+  pthread_mutex_unlock (&server->lock);
+
+  return 0;
+}
+
+int
+framelink_server_acquire (struct framelink_server *server, size_t size)
+{
+  struct slot *slot = NULL;
+  long page = sysconf (_SC_PAGESIZE);
+  unsigned int i;
+  int index = -1;
+
+  pthread_mutex_lock (&server->lock);
+
+  /* Prefer memory that is already big enough */
+  for (i = 0; i < server->n_slots; i++) {
+    if (server->slots[i].refs)
+      continue;
+    if (index < 0 || server->slots[i].size >= size)
+      index = i;
+    if (server->slots[i].size >= size)
+      break;
+  }
+
+  if (index < 0)
+    goto done;
+
+  slot = &server->slots[index];
+  if (slot->size < size) {
+    if (slot->data)
+      munmap (slot->data, slot->size);
+    if (slot->fd >= 0)
+      close (slot->fd);
+    slot->data = NULL;
+    slot->size = (size + page - 1) & ~(page - 1);
+    slot->generation++;
+
+    slot->fd = shared_memory (slot->size);
+    if (slot->fd >= 0)
+      slot->data = mmap (NULL, slot->size, PROT_READ | PROT_WRITE,
+          MAP_SHARED, slot->fd, 0);
+    if (!slot->data || slot->data == MAP_FAILED) {
+      if (slot->fd >= 0)
+        close (slot->fd);
+      slot->fd = -1;
+      slot->data = NULL;
+      slot->size = 0;
+      index = -1;
+      goto done;
+    }
+  }
+
+  slot->refs = 1;
+  slot->phys = 0;
+
+done:
+  pthread_mutex_unlock (&server->lock);
+  return index;
+}
+
+int
+framelink_server_acquire_phys (struct framelink_server *server,
+    uint64_t phys, void (*release) (void *data), void *data)
+{
+  unsigned int i;
+  int index = -1;
+
+  pthread_mutex_lock (&server->lock);
+
+  /* The same memory in the same slot keeps the clients' mapping */
+  for (i = 0; i < server->n_slots; i++) {
+    if (server->slots[i].refs)
+      continue;
+    if (index < 0 || server->slots[i].phys == phys)
+      index = i;
+    if (server->slots[i].phys == phys)
+      break;
+  }
+
+  if (index >= 0) {
+    server->slots[index].refs = 1;
+    server->slots[index].phys = phys;
+    server->slots[index].release = release;
+    server->slots[index].release_data = data;
+  }
+
+  pthread_mutex_unlock (&server->lock);
+  return index;
+}
+
+uint64_t
+framelink_server_physical (struct framelink_server *server, const void *data)
+{
+#ifdef FRAMELINK_CMEM
+  if (server->cmem)
+    return CMEM_getPhys ((void *) data);
+#endif
+  return 0;
+}
+
+void *
+framelink_server_data (struct framelink_server *server, int slot)
+{
+  return server->slots[slot].data;
+}
+
+void
+framelink_server_unref (struct framelink_server *server, int slot)
+{
+  int destroy;
+
+  pthread_mutex_lock (&server->lock);
+  slot_unref (&server->slots[slot]);
+  destroy = server_idle (server);
+  pthread_mutex_unlock (&server->lock);
+
+  if (destroy)
+    server_destroy (server);
+}
+
+int
+framelink_server_send (struct framelink_server *server, int slot,
+    const struct framelink_frame *frame)
+{
+  struct message message;
+  struct client *client;
+  int sent = 0;
+  int i;
+
+  message.slot = slot;
+  message.phys = 0;
+  message.flags = frame->flags;
+  message.size = frame->size;
+  message.timestamp = frame->timestamp;
+  message.duration = frame->duration;
+
+  pthread_mutex_lock (&server->lock);
+  message.generation = server->slots[slot].generation;
+
+  /* Never wait on a slow client, it just misses the frame */
+  for (i = 0; i < FRAMELINK_MAX_CLIENTS; i++) {
+    client = &server->clients[i];
+    if (client->fd < 0 || (client->held & (1u << slot)))
+      continue;
+
+    if (server->slots[slot].phys) {
+      /* Lent memory, the client maps it itself */
+      message.type = MESSAGE_CMEM;
+      message.phys = server->slots[slot].phys;
+      if (send_message (client->fd, &message, NULL, -1, MSG_DONTWAIT) < 0)
+        continue;
+      client->held |= 1u << slot;
+      server->slots[slot].refs++;
+      sent++;
+      continue;
+    }
+
+    if (client->known[slot] != message.generation) {
+      message.type = MESSAGE_SLOT;
+      message.size = server->slots[slot].size;
+      if (send_message (client->fd, &message, NULL,
+              server->slots[slot].fd, MSG_DONTWAIT) < 0)
+        continue;
+      client->known[slot] = message.generation;
+      message.size = frame->size;
+    }
+
+    message.type = MESSAGE_FRAME;
+    if (send_message (client->fd, &message, NULL, -1, MSG_DONTWAIT) < 0)
+      continue;
+
+    client->held |= 1u << slot;
+    server->slots[slot].refs++;
+    sent++;
+  }
+
+  pthread_mutex_unlock (&server->lock);
+
+  return sent;
+}
+
+/*
+ * Client
+ */
+
+static void
+client_unref (struct framelink_client *client)
+{
+  int i;
+
+  pthread_mutex_lock (&client->lock);
+  if (--client->refs) {
+    pthread_mutex_unlock (&client->lock);
+    return;
+  }
+  pthread_mutex_unlock (&client->lock);
+
+  for (i = 0; i < FRAMELINK_MAX_SLOTS; i++) {
+    if (client->maps[i].data)
+      munmap (client->maps[i].data, client->maps[i].size);
+    if (client->maps[i].cmem)
+      munmap (client->maps[i].cmem, client->maps[i].cmem_size);
+  }
+  if (client->cmem_fd >= 0)
+    close (client->cmem_fd);
+
+  pthread_mutex_destroy (&client->lock);
+  free (client);
+}
+
+struct framelink_client *
+framelink_client_connect (const char *path)
+{
+  struct framelink_client *client;
+  struct sockaddr_un address;
+
+  if (strlen (path) >= sizeof (address.sun_path))
+    return NULL;
+
+  client = calloc (1, sizeof (struct framelink_client));
+  if (!client)
+    return NULL;
+
+  pthread_mutex_init (&client->lock, NULL);
+  client->refs = 1;
+  client->cmem_fd = -1;
+
+  memset (&address, 0, sizeof (address));
+  address.sun_family = AF_UNIX;
+  strcpy (address.sun_path, path);
+
+  client->fd = socket (AF_UNIX, SOCK_SEQPACKET, 0);
+  if (client->fd < 0 || connect (client->fd, (struct sockaddr *) &address,
+          sizeof (address)) < 0) {
+    if (client->fd >= 0)
+      close (client->fd);
+    pthread_mutex_destroy (&client->lock);
+    free (client);
+    return NULL;
+  }
+
+  return client;
+}
+
+/* Maps the memory of a slot, the server only replaces it when free */
+static void
+client_map (struct framelink_client *client, const struct message *message,
+    int fd)
+{
+  struct slot *map = &client->maps[message->slot];
+  void *data;
+
+  data = mmap (NULL, message->size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED)
+    return;
+
+  pthread_mutex_lock (&client->lock);
+  if (map->data)
+    munmap (map->data, map->size);
+  map->data = data;
+  map->size = message->size;
+  map->generation = message->generation;
+  pthread_mutex_unlock (&client->lock);
+}
+
+/* With the lock held, maps lent memory through the cmem device. The
+ * slot is not held by this client so its old mapping is unused. */
+static void *
+client_map_cmem (struct framelink_client *client,
+    const struct message *message)
+{
+  struct slot *map = &client->maps[message->slot];
+  long page = sysconf (_SC_PAGESIZE);
+  uint64_t base = message->phys & ~(uint64_t) (page - 1);
+  size_t size = message->phys - base + message->size;
+  void *data;
+
+  if (map->cmem && map->phys == message->phys && map->cmem_size >= size)
+    return (char *) map->cmem + (message->phys - base);
+
+  if (client->cmem_fd < 0)
+    client->cmem_fd = open (FRAMELINK_CMEM_DEVICE, O_RDWR | O_CLOEXEC);
+  if (client->cmem_fd < 0)
+    return NULL;
+
+  if (map->cmem)
+    munmap (map->cmem, map->cmem_size);
+  map->cmem = NULL;
+
+  size = (size + page - 1) & ~(page - 1);
+  data = mmap (NULL, size, PROT_READ, MAP_SHARED, client->cmem_fd, base);
+  if (data == MAP_FAILED)
+    return NULL;
+
+  map->cmem = data;
+  map->cmem_size = size;
+  map->phys = message->phys;
+
+  return (char *) data + (message->phys - base);
+}
+
+int
+framelink_client_receive (struct framelink_client *client,
+    struct framelink_frame *frame, int timeout_ms)
+{
+  struct packet packet;
+  struct iovec iov;
+  struct msghdr msg;
+  char control[CMSG_SPACE (sizeof (int))];
+  struct cmsghdr *cmsg;
+  struct message *message = &packet.message;
+  struct pollfd pfd;
+  ssize_t length;
+  int fd;
+  int ret;
+
+  for (;;) {
+    pfd.fd = client->fd;
+    pfd.events = POLLIN;
+    ret = poll (&pfd, 1, timeout_ms);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      return ret;
+
+    iov.iov_base = &packet;
+    iov.iov_len = sizeof (packet);
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof (control);
+
+    length = recvmsg (client->fd, &msg, MSG_CMSG_CLOEXEC);
+    if (length < (ssize_t) sizeof (struct message))
+      return -1;
+
+    fd = -1;
+    cmsg = CMSG_FIRSTHDR (&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS)
+      memcpy (&fd, CMSG_DATA (cmsg), sizeof (int));
+
+    if (message->slot >= FRAMELINK_MAX_SLOTS && message->type != MESSAGE_CAPS) {
+      if (fd >= 0)
+        close (fd);
+      continue;
+    }
+
+    switch (message->type) {
+      case MESSAGE_CAPS:
+        packet.caps[FRAMELINK_MAX_CAPS - 1] = '\0';
+        strcpy (client->caps, packet.caps);
+        break;
+      case MESSAGE_SLOT:
+        if (fd >= 0)
+          client_map (client, message, fd);
+        break;
+      case MESSAGE_FRAME:
+        pthread_mutex_lock (&client->lock);
+        client->refs++;
+        if (client->maps[message->slot].generation != message->generation ||
+            message->size > client->maps[message->slot].size) {
+          /* Memory never arrived, hand the frame straight back */
+          pthread_mutex_unlock (&client->lock);
+          framelink_client_release (client, message->slot);
+          break;
+        }
+        frame->slot = message->slot;
+        frame->data = client->maps[message->slot].data;
+        frame->size = message->size;
+        frame->timestamp = message->timestamp;
+        frame->duration = message->duration;
+        frame->flags = message->flags;
+        pthread_mutex_unlock (&client->lock);
+        return 1;
+      case MESSAGE_CMEM:
+        pthread_mutex_lock (&client->lock);
+        client->refs++;
+        frame->data = client_map_cmem (client, message);
+        if (!frame->data) {
+          pthread_mutex_unlock (&client->lock);
+          framelink_client_release (client, message->slot);
+          break;
+        }
+        frame->slot = message->slot;
+        frame->size = message->size;
+        frame->timestamp = message->timestamp;
+        frame->duration = message->duration;
+        frame->flags = message->flags;
+        pthread_mutex_unlock (&client->lock);
+        return 1;
+      default:
+        if (fd >= 0)
+          close (fd);
+        break;
+    }
+  }
+}
+
+const char *
+framelink_client_caps (struct framelink_client *client)
+{
+  return client->caps;
+}
+
+void
+framelink_client_release (struct framelink_client *client, int slot)
+{
+  struct message message = { MESSAGE_RELEASE, slot };
+
+  /* Waits for room in the socket, a lost release would keep the slot
+   * from the producer until this client disconnects */
+  pthread_mutex_lock (&client->lock);
+  if (client->fd >= 0)
+    send_message (client->fd, &message, NULL, -1, 0);
+  pthread_mutex_unlock (&client->lock);
+
+  client_unref (client);
+}
+
+void
+framelink_client_close (struct framelink_client *client)
+{
+  if (!client)
+    return;
+
+  pthread_mutex_lock (&client->lock);
+  close (client->fd);
+  client->fd = -1;
+  pthread_mutex_unlock (&client->lock);
+
+  client_unref (client);
+}
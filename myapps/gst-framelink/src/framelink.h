@@ -0,0 +1,144 @@
+/*
+ * Ridgerun
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __FRAMELINK_H__
+#define __FRAMELINK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Frame link transport
+ *
+ * A server owns a pool of frame slots, each backed by its own shared
+ * memory file. Clients connect to a UNIX seqpacket socket, receive the
+ * file descriptor of a slot the first time it is used (SCM_RIGHTS) and
+ * from then on only small frame messages naming the slot. A slot is
+ * only reused once the server and every client it was sent to have
+ * released it, clients return their reference with a release message
+ * or implicitly by disconnecting.
+ *
+ * Neither side copies frame data: producers write straight into a slot
+ * and consumers read from their mapping of the same pages. Frames that
+ * already are in contiguous memory (CMEM) go out as their physical
+ * address and size instead, clients map them through /dev/cmem and the
+ * producer gets the memory back once the last of them released it.
+ * The slot memory files are what the host test runs on.
+ */
+
+#define FRAMELINK_MAX_SLOTS 32
+#define FRAMELINK_MAX_CLIENTS 8
+#define FRAMELINK_MAX_CAPS 1024
+
+struct framelink_server;
+struct framelink_client;
+
+struct framelink_frame
+{
+  int slot;
+  void *data;
+  size_t size;
+  uint64_t timestamp;
+  uint64_t duration;
+  uint32_t flags;
+};
+
+/*
+ * Server
+ */
+
+/* Listens on path, replacing a stale socket there */
+struct framelink_server *framelink_server_new (const char *path,
+    unsigned int slots);
+
+/* Stops serving. Slots still referenced keep the pool alive until
+ * they are released. */
+void framelink_server_free (struct framelink_server *server);
+
+/* Format description handed to clients on connect and on change */
+int framelink_server_set_caps (struct framelink_server *server,
+    const char *caps);
+
+/* Takes a free slot of at least size bytes, or returns -1 when every
+ * slot is still held by someone. The caller owns one reference. */
+int framelink_server_acquire (struct framelink_server *server, size_t size);
+void *framelink_server_data (struct framelink_server *server, int slot);
+
+/* Takes a free slot for memory the caller lends at a physical address,
+ * or returns -1 when every slot is still held. release is called with
+ * data once the caller and every client are done with the frame. */
+int framelink_server_acquire_phys (struct framelink_server *server,
+    uint64_t phys, void (*release) (void *data), void *data);
+
+/* Physical address of CMEM memory, 0 for anything else or when the
+ * plugin was built without CMEM */
+uint64_t framelink_server_physical (struct framelink_server *server,
+    const void *data);
+
+void framelink_server_unref (struct framelink_server *server, int slot);
+
+/* Sends a slot to every client ready to take it, each of them holding
+ * a reference until it releases the frame. Returns the client count. */
+int framelink_server_send (struct framelink_server *server, int slot,
+    const struct framelink_frame *frame);
+
+/*
+ * Client
+ */
+
+struct framelink_client *framelink_client_connect (const char *path);
+
+/* Waits up to timeout_ms for a frame, -1 blocks. Returns 1 with frame
+ * filled, 0 on timeout, -1 once the server is gone. */
+int framelink_client_receive (struct framelink_client *client,
+    struct framelink_frame *frame, int timeout_ms);
+
+/* Current caps, valid until the next receive */
+const char *framelink_client_caps (struct framelink_client *client);
+
+/* Returns a received frame, from any thread, also after close */
+void framelink_client_release (struct framelink_client *client, int slot);
+
+/* Disconnects. Mappings stay until the last frame is released. */
+void framelink_client_close (struct framelink_client *client);
+
+#endif /* __FRAMELINK_H__ */
@@ -0,0 +1,363 @@
+/*
+ * Ridgerun
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/**
+ * SECTION:element-framelinksink
+ *
+ * Shares the frames it receives with framelinksrc elements in other
+ * processes. Upstream elements that allocate their buffers from the
+ * sink write straight into shared memory, buffers in CMEM (v4l2src,
+ * the dmai elements) are handed out by physical address and held until
+ * every consumer returned them, anything else is copied in once. A
+ * frame is only overwritten after every process it was handed to is
+ * done with it.
+ *
+ * gst-launch videotestsrc ! framelinksink socket-path=/tmp/camera
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+
+#include "gstframelinksink.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_framelink_sink_debug);
+#define GST_CAT_DEFAULT gst_framelink_sink_debug
+
+#define DEFAULT_SOCKET_PATH "/tmp/framelink"
+#define DEFAULT_SLOTS 8
+
+enum
+{
+  PROP_0,
+  PROP_SOCKET_PATH,
+  PROP_SLOTS,
+};
+
+/* Keeps a slot referenced for as long as the buffer lives */
+typedef struct
+{
+  struct framelink_server *server;
+  int slot;
+} GstFramelinkTicket;
+
+static GstStaticPadTemplate sink_factory = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+GST_BOILERPLATE (GstFramelinkSink, gst_framelink_sink, GstBaseSink,
+    GST_TYPE_BASE_SINK);
+
+static void gst_framelink_sink_finalize (GObject * object);
+static void gst_framelink_sink_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_framelink_sink_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
+
+static gboolean gst_framelink_sink_start (GstBaseSink * bsink);
+static gboolean gst_framelink_sink_stop (GstBaseSink * bsink);
+static gboolean gst_framelink_sink_set_caps (GstBaseSink * bsink,
+    GstCaps * caps);
+static GstFlowReturn gst_framelink_sink_buffer_alloc (GstBaseSink * bsink,
+    guint64 offset, guint size, GstCaps * caps, GstBuffer ** buf);
+static GstFlowReturn gst_framelink_sink_render (GstBaseSink * bsink,
+    GstBuffer * buffer);
+
+static void
+gst_framelink_sink_base_init (gpointer gclass)
+{
+  GstElementClass *element_class = GST_ELEMENT_CLASS (gclass);
+
+  gst_element_class_set_details_simple (element_class,
+      "Frame link sink",
+      "Sink/Video",
+      "Shares frames with other processes without copying them",
+      "RidgeRun Engineering");
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&sink_factory));
+}
+
+static void
+gst_framelink_sink_class_init (GstFramelinkSinkClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+  GstBaseSinkClass *gstbasesink_class = (GstBaseSinkClass *) klass;
+
+  gobject_class->finalize = gst_framelink_sink_finalize;
+  gobject_class->set_property = gst_framelink_sink_set_property;
+  gobject_class->get_property = gst_framelink_sink_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_SOCKET_PATH,
+      g_param_spec_string ("socket-path", "Socket path",
+          "UNIX socket the consumers connect to", DEFAULT_SOCKET_PATH,
+          G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_SLOTS,
+      g_param_spec_uint ("slots", "Slots",
+          "Frames that can be in flight at once", 1, FRAMELINK_MAX_SLOTS,
+          DEFAULT_SLOTS, G_PARAM_READWRITE));
+
+  gstbasesink_class->start = GST_DEBUG_FUNCPTR (gst_framelink_sink_start);
+  gstbasesink_class->stop = GST_DEBUG_FUNCPTR (gst_framelink_sink_stop);
+  gstbasesink_class->set_caps =
+      GST_DEBUG_FUNCPTR (gst_framelink_sink_set_caps);
+  gstbasesink_class->buffer_alloc =
+      GST_DEBUG_FUNCPTR (gst_framelink_sink_buffer_alloc);
+  gstbasesink_class->render = GST_DEBUG_FUNCPTR (gst_framelink_sink_render);
+
+  GST_DEBUG_CATEGORY_INIT (gst_framelink_sink_debug, "framelinksink", 0,
+      "Frame link sink");
+}
+
+static void
+gst_framelink_sink_init (GstFramelinkSink * sink,
+    GstFramelinkSinkClass * gclass)
+{
+  sink->socket_path = g_strdup (DEFAULT_SOCKET_PATH);
+  sink->slots = DEFAULT_SLOTS;
+}
+
+static void
+gst_framelink_sink_finalize (GObject * object)
+{
+  GstFramelinkSink *sink = GST_FRAMELINK_SINK (object);
+
+  g_free (sink->socket_path);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_framelink_sink_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstFramelinkSink *sink = GST_FRAMELINK_SINK (object);
+
+  switch (prop_id) {
+    case PROP_SOCKET_PATH:
+      g_free (sink->socket_path);
+      sink->socket_path = g_value_dup_string (value);
+      break;
+    case PROP_SLOTS:
+      sink->slots = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_framelink_sink_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstFramelinkSink *sink = GST_FRAMELINK_SINK (object);
+
+  switch (prop_id) {
+    case PROP_SOCKET_PATH:
+      g_value_set_string (value, sink->socket_path);
+      break;
+    case PROP_SLOTS:
+      g_value_set_uint (value, sink->slots);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static gboolean
+gst_framelink_sink_start (GstBaseSink * bsink)
+{
+  GstFramelinkSink *sink = GST_FRAMELINK_SINK (bsink);
+
+  sink->server = framelink_server_new (sink->socket_path, sink->slots);
+  if (!sink->server) {
+    GST_ELEMENT_ERROR (sink, RESOURCE, OPEN_WRITE,
+        ("Could not listen on %s", sink->socket_path), GST_ERROR_SYSTEM);
+    return FALSE;
+  }
+
+  sink->shared = sink->copied = sink->dropped = 0;
+  sink->cmem = TRUE;
+
+  return TRUE;
+}
+
+static gboolean
+gst_framelink_sink_stop (GstBaseSink * bsink)
+{
+  GstFramelinkSink *sink = GST_FRAMELINK_SINK (bsink);
+
+  GST_INFO_OBJECT (sink, "%" G_GUINT64_FORMAT " frames shared, %"
+      G_GUINT64_FORMAT " copied, %" G_GUINT64_FORMAT " dropped",
+      sink->shared, sink->copied, sink->dropped);
+
+  /* Buffers still out there keep their slots until they are freed */
+  framelink_server_free (sink->server);
+  sink->server = NULL;
+
+  return TRUE;
+}
+
+static gboolean
+gst_framelink_sink_set_caps (GstBaseSink * bsink, GstCaps * caps)
+{
+  GstFramelinkSink *sink = GST_FRAMELINK_SINK (bsink);
+  gchar *description;
+  gboolean ret;
+
+  description = gst_caps_to_string (caps);
+  ret = framelink_server_set_caps (sink->server, description) == 0;
+  if (!ret)
+    GST_ERROR_OBJECT (sink, "caps too long to share: %s", description);
+  g_free (description);
+
+  return ret;
+}
+
+static void
+gst_framelink_sink_ticket_free (gpointer data)
+{
+  GstFramelinkTicket *ticket = data;
+
+  framelink_server_unref (ticket->server, ticket->slot);
+  g_free (ticket);
+}
+
+static GstFlowReturn
+gst_framelink_sink_buffer_alloc (GstBaseSink * bsink, guint64 offset,
+    guint size, GstCaps * caps, GstBuffer ** buf)
+{
+  GstFramelinkSink *sink = GST_FRAMELINK_SINK (bsink);
+  GstFramelinkTicket *ticket;
+  int slot;
+
+  /* Leaving buf unset falls back to a normal allocation */
+  *buf = NULL;
+  if (!sink->server)
+    return GST_FLOW_OK;
+
+  slot = framelink_server_acquire (sink->server, size);
+  if (slot < 0)
+    return GST_FLOW_OK;
+
+  ticket = g_new (GstFramelinkTicket, 1);
+  ticket->server = sink->server;
+  ticket->slot = slot;
+
+  *buf = gst_buffer_new ();
+  GST_BUFFER_DATA (*buf) = framelink_server_data (sink->server, slot);
+  GST_BUFFER_SIZE (*buf) = size;
+  GST_BUFFER_MALLOCDATA (*buf) = (guint8 *) ticket;
+  GST_BUFFER_FREE_FUNC (*buf) = gst_framelink_sink_ticket_free;
+  GST_BUFFER_OFFSET (*buf) = offset;
+  gst_buffer_set_caps (*buf, caps);
+
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+gst_framelink_sink_render (GstBaseSink * bsink, GstBuffer * buffer)
+{
+  GstFramelinkSink *sink = GST_FRAMELINK_SINK (bsink);
+  GstFramelinkTicket *ticket = NULL;
+  struct framelink_frame frame;
+  guint64 phys;
+  int slot;
+
+  if (GST_BUFFER_FREE_FUNC (buffer) == gst_framelink_sink_ticket_free)
+    ticket = (GstFramelinkTicket *) GST_BUFFER_MALLOCDATA (buffer);
+
+  frame.size = GST_BUFFER_SIZE (buffer);
+  frame.timestamp = GST_BUFFER_TIMESTAMP (buffer);
+  frame.duration = GST_BUFFER_DURATION (buffer);
+  frame.flags = GST_BUFFER_FLAGS (buffer);
+
+  /* Written in place by upstream, only the slot number travels */
+  if (ticket && ticket->server == sink->server &&
+      GST_BUFFER_DATA (buffer) ==
+      framelink_server_data (sink->server, ticket->slot)) {
+    framelink_server_send (sink->server, ticket->slot, &frame);
+    sink->shared++;
+    return GST_FLOW_OK;
+  }
+
+  /* Lent where it is, the buffer lives until the last consumer is
+   * done. Upstream doesn't switch allocators, asking CMEM about every
+   * buffer would only fill the log once the answer is no. */
+  phys = sink->cmem ? framelink_server_physical (sink->server,
+      GST_BUFFER_DATA (buffer)) : 0;
+  if (phys) {
+    slot = framelink_server_acquire_phys (sink->server, phys,
+        (GDestroyNotify) gst_mini_object_unref, gst_buffer_ref (buffer));
+    if (slot < 0) {
+      GST_LOG_OBJECT (sink, "every slot is in use, dropping frame");
+      gst_buffer_unref (buffer);
+      sink->dropped++;
+      return GST_FLOW_OK;
+    }
+    framelink_server_send (sink->server, slot, &frame);
+    framelink_server_unref (sink->server, slot);
+    sink->shared++;
+    return GST_FLOW_OK;
+  }
+  sink->cmem = FALSE;
+
+  slot = framelink_server_acquire (sink->server, frame.size);
+  if (slot < 0) {
+    GST_LOG_OBJECT (sink, "every slot is in use, dropping frame");
+    sink->dropped++;
+    return GST_FLOW_OK;
+  }
+
+  memcpy (framelink_server_data (sink->server, slot),
+      GST_BUFFER_DATA (buffer), frame.size);
+  framelink_server_send (sink->server, slot, &frame);
+  framelink_server_unref (sink->server, slot);
+  sink->copied++;
+
+  return GST_FLOW_OK;
+}
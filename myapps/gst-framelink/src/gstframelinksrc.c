@@ -0,0 +1,330 @@
+/*
+ * Ridgerun
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/**
+ * SECTION:element-framelinksrc
+ *
+ * Receives the frames a framelinksink in another process shares. The
+ * buffers point at the producer's memory and are read only, elements
+ * that modify them in place get a private copy. Each frame is handed
+ * back to the producer when its buffer is freed.
+ *
+ * gst-launch framelinksrc socket-path=/tmp/camera ! fakesink
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+
+#include "gstframelinksrc.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_framelink_src_debug);
+#define GST_CAT_DEFAULT gst_framelink_src_debug
+
+#define DEFAULT_SOCKET_PATH "/tmp/framelink"
+#define POLL_MS 100
+
+enum
+{
+  PROP_0,
+  PROP_SOCKET_PATH,
+};
+
+typedef struct
+{
+  struct framelink_client *client;
+  int slot;
+} GstFramelinkTicket;
+
+static GstStaticPadTemplate src_factory = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+GST_BOILERPLATE (GstFramelinkSrc, gst_framelink_src, GstPushSrc,
+    GST_TYPE_PUSH_SRC);
+
+static void gst_framelink_src_finalize (GObject * object);
+static void gst_framelink_src_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_framelink_src_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
+
+static gboolean gst_framelink_src_start (GstBaseSrc * bsrc);
+static gboolean gst_framelink_src_stop (GstBaseSrc * bsrc);
+static GstCaps *gst_framelink_src_get_caps (GstBaseSrc * bsrc);
+static gboolean gst_framelink_src_unlock (GstBaseSrc * bsrc);
+static gboolean gst_framelink_src_unlock_stop (GstBaseSrc * bsrc);
+static GstFlowReturn gst_framelink_src_create (GstPushSrc * psrc,
+    GstBuffer ** buf);
+
+static void
+gst_framelink_src_base_init (gpointer gclass)
+{
+  GstElementClass *element_class = GST_ELEMENT_CLASS (gclass);
+
+  gst_element_class_set_details_simple (element_class,
+      "Frame link source",
+      "Source/Video",
+      "Receives frames shared by a framelinksink in another process",
+      "RidgeRun Engineering");
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&src_factory));
+}
+
+static void
+gst_framelink_src_class_init (GstFramelinkSrcClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+  GstBaseSrcClass *gstbasesrc_class = (GstBaseSrcClass *) klass;
+  GstPushSrcClass *gstpushsrc_class = (GstPushSrcClass *) klass;
+
+  gobject_class->finalize = gst_framelink_src_finalize;
+  gobject_class->set_property = gst_framelink_src_set_property;
+  gobject_class->get_property = gst_framelink_src_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_SOCKET_PATH,
+      g_param_spec_string ("socket-path", "Socket path",
+          "UNIX socket of the producing framelinksink", DEFAULT_SOCKET_PATH,
+          G_PARAM_READWRITE));
+
+  gstbasesrc_class->start = GST_DEBUG_FUNCPTR (gst_framelink_src_start);
+  gstbasesrc_class->stop = GST_DEBUG_FUNCPTR (gst_framelink_src_stop);
+  gstbasesrc_class->get_caps = GST_DEBUG_FUNCPTR (gst_framelink_src_get_caps);
+  gstbasesrc_class->unlock = GST_DEBUG_FUNCPTR (gst_framelink_src_unlock);
+  gstbasesrc_class->unlock_stop =
+      GST_DEBUG_FUNCPTR (gst_framelink_src_unlock_stop);
+  gstpushsrc_class->create = GST_DEBUG_FUNCPTR (gst_framelink_src_create);
+
+  GST_DEBUG_CATEGORY_INIT (gst_framelink_src_debug, "framelinksrc", 0,
+      "Frame link source");
+}
+
+static void
+gst_framelink_src_init (GstFramelinkSrc * src, GstFramelinkSrcClass * gclass)
+{
+  src->socket_path = g_strdup (DEFAULT_SOCKET_PATH);
+
+  /* Frames come at the producer's pace, timestamps are only
+   * meaningful in its clock so they are taken again on arrival */
+  gst_base_src_set_live (GST_BASE_SRC (src), TRUE);
+  gst_base_src_set_format (GST_BASE_SRC (src), GST_FORMAT_TIME);
+  gst_base_src_set_do_timestamp (GST_BASE_SRC (src), TRUE);
+}
+
+static void
+gst_framelink_src_finalize (GObject * object)
+{
+  GstFramelinkSrc *src = GST_FRAMELINK_SRC (object);
+
+  g_free (src->socket_path);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_framelink_src_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstFramelinkSrc *src = GST_FRAMELINK_SRC (object);
+
+  switch (prop_id) {
+    case PROP_SOCKET_PATH:
+      g_free (src->socket_path);
+      src->socket_path = g_value_dup_string (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_framelink_src_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstFramelinkSrc *src = GST_FRAMELINK_SRC (object);
+
+  switch (prop_id) {
+    case PROP_SOCKET_PATH:
+      g_value_set_string (value, src->socket_path);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static gboolean
+gst_framelink_src_start (GstBaseSrc * bsrc)
+{
+  GstFramelinkSrc *src = GST_FRAMELINK_SRC (bsrc);
+
+  src->client = framelink_client_connect (src->socket_path);
+  if (!src->client) {
+    GST_ELEMENT_ERROR (src, RESOURCE, OPEN_READ,
+        ("Could not connect to %s", src->socket_path), GST_ERROR_SYSTEM);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+gst_framelink_src_stop (GstBaseSrc * bsrc)
+{
+  GstFramelinkSrc *src = GST_FRAMELINK_SRC (bsrc);
+
+  /* Frames still downstream are returned when their buffers go */
+  framelink_client_close (src->client);
+  src->client = NULL;
+  g_free (src->caps);
+  src->caps = NULL;
+
+  return TRUE;
+}
+
+static GstCaps *
+gst_framelink_src_get_caps (GstBaseSrc * bsrc)
+{
+  GstFramelinkSrc *src = GST_FRAMELINK_SRC (bsrc);
+
+  if (src->caps)
+    return gst_caps_from_string (src->caps);
+
+  return gst_caps_copy (gst_pad_get_pad_template_caps (GST_BASE_SRC_PAD
+          (bsrc)));
+}
+
+static gboolean
+gst_framelink_src_unlock (GstBaseSrc * bsrc)
+{
+  GST_FRAMELINK_SRC (bsrc)->flushing = TRUE;
+
+  return TRUE;
+}
+
+static gboolean
+gst_framelink_src_unlock_stop (GstBaseSrc * bsrc)
+{
+  GST_FRAMELINK_SRC (bsrc)->flushing = FALSE;
+
+  return TRUE;
+}
+
+static void
+gst_framelink_src_ticket_free (gpointer data)
+{
+  GstFramelinkTicket *ticket = data;
+
+  framelink_client_release (ticket->client, ticket->slot);
+  g_free (ticket);
+}
+
+/* The producer's caps travel with the frames, follow them */
+static gboolean
+gst_framelink_src_update_caps (GstFramelinkSrc * src)
+{
+  const char *description = framelink_client_caps (src->client);
+  GstCaps *caps;
+  gboolean ret;
+
+  if (!description[0] || (src->caps && !strcmp (src->caps, description)))
+    return TRUE;
+
+  g_free (src->caps);
+  src->caps = g_strdup (description);
+
+  caps = gst_caps_from_string (description);
+  if (!caps) {
+    GST_ERROR_OBJECT (src, "invalid caps from producer: %s", description);
+    return FALSE;
+  }
+
+  ret = gst_pad_set_caps (GST_BASE_SRC_PAD (src), caps);
+  gst_caps_unref (caps);
+
+  return ret;
+}
+
+static GstFlowReturn
+gst_framelink_src_create (GstPushSrc * psrc, GstBuffer ** buf)
+{
+  GstFramelinkSrc *src = GST_FRAMELINK_SRC (psrc);
+  GstFramelinkTicket *ticket;
+  struct framelink_frame frame;
+  int ret;
+
+  do {
+    if (src->flushing)
+      return GST_FLOW_WRONG_STATE;
+    ret = framelink_client_receive (src->client, &frame, POLL_MS);
+  } while (!ret);
+
+  if (ret < 0) {
+    GST_INFO_OBJECT (src, "producer went away");
+    return GST_FLOW_UNEXPECTED;
+  }
+
+  if (!gst_framelink_src_update_caps (src)) {
+    framelink_client_release (src->client, frame.slot);
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+
+  ticket = g_new (GstFramelinkTicket, 1);
+  ticket->client = src->client;
+  ticket->slot = frame.slot;
+
+  *buf = gst_buffer_new ();
+  GST_BUFFER_DATA (*buf) = frame.data;
+  GST_BUFFER_SIZE (*buf) = frame.size;
+  GST_BUFFER_MALLOCDATA (*buf) = (guint8 *) ticket;
+  GST_BUFFER_FREE_FUNC (*buf) = gst_framelink_src_ticket_free;
+  GST_BUFFER_DURATION (*buf) = frame.duration;
+  GST_BUFFER_FLAGS (*buf) = frame.flags | GST_BUFFER_FLAG_READONLY;
+  gst_buffer_set_caps (*buf, GST_PAD_CAPS (GST_BASE_SRC_PAD (src)));
+
+  return GST_FLOW_OK;
+}
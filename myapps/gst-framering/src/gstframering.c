@@ -0,0 +1,615 @@
+/*
+ * Ridgerun
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/**
+ * SECTION:element-framering
+ *
+ * Keeps the last frames it receives and pushes nothing on its own.
+ * Clients ask over a UNIX socket for the frames around a wall clock
+ * time (see framering.h), the element then pushes the frame captured
+ * closest to it and the ones following it, so the encoder behind it
+ * works on the frame of an event instead of the one current when the
+ * request got through.
+ *
+ * The capture time of a frame is its running time translated to the
+ * wall clock through the pipeline clock when the frame arrives, so it
+ * is as good as the timestamps of the source. The buffers are held,
+ * not copied: the source has to be able to capture with frames of its
+ * buffers kept here, raise the number of buffers of v4l2src with its
+ * queue-size property accordingly. Sinks behind the element only get
+ * data on request, in a live pipeline they need async=false.
+ *
+ * gst-launch v4l2src queue-size=12 ! tee name=t ! queue ! xvimagesink
+ *     t. ! framering frames=8 ! queue ! jpegenc !
+ *     multifilesink async=false location=frame_%d.jpg
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "gstframering.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_frame_ring_debug);
+#define GST_CAT_DEFAULT gst_frame_ring_debug
+
+#define DEFAULT_SOCKET_PATH "/tmp/framering"
+#define DEFAULT_FRAMES 8
+
+/* Longest a request waits for a frame still to be captured */
+#define WAIT_US G_USEC_PER_SEC
+
+enum
+{
+  PROP_0,
+  PROP_SOCKET_PATH,
+  PROP_FRAMES,
+};
+
+static GstStaticPadTemplate sink_factory = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static GstStaticPadTemplate src_factory = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+GST_BOILERPLATE (GstFrameRing, gst_frame_ring, GstElement, GST_TYPE_ELEMENT);
+
+static void gst_frame_ring_finalize (GObject * object);
+static void gst_frame_ring_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_frame_ring_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
+
+static GstStateChangeReturn gst_frame_ring_change_state (GstElement *
+    element, GstStateChange transition);
+static gboolean gst_frame_ring_sink_event (GstPad * pad, GstEvent * event);
+static GstFlowReturn gst_frame_ring_chain (GstPad * pad, GstBuffer * buffer);
+
+static void
+gst_frame_ring_base_init (gpointer gclass)
+{
+  GstElementClass *element_class = GST_ELEMENT_CLASS (gclass);
+
+  gst_element_class_set_details_simple (element_class,
+      "Frame ring",
+      "Filter/Video",
+      "Keeps recent frames and pushes the ones closest to a requested time",
+      "RidgeRun Engineering");
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&sink_factory));
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&src_factory));
+}
+
+static void
+gst_frame_ring_class_init (GstFrameRingClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+  GstElementClass *gstelement_class = (GstElementClass *) klass;
+
+  gobject_class->finalize = gst_frame_ring_finalize;
+  gobject_class->set_property = gst_frame_ring_set_property;
+  gobject_class->get_property = gst_frame_ring_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_SOCKET_PATH,
+      g_param_spec_string ("socket-path", "Socket path",
+          "UNIX socket requests are taken on", DEFAULT_SOCKET_PATH,
+          G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_FRAMES,
+      g_param_spec_uint ("frames", "Frames",
+          "Frames kept, applied when the element starts", 1,
+          FRAMERING_MAX_FRAMES, DEFAULT_FRAMES, G_PARAM_READWRITE));
+
+  gstelement_class->change_state =
+      GST_DEBUG_FUNCPTR (gst_frame_ring_change_state);
+
+  GST_DEBUG_CATEGORY_INIT (gst_frame_ring_debug, "framering", 0,
+      "Frame ring");
+}
+
+static void
+gst_frame_ring_init (GstFrameRing * ring, GstFrameRingClass * gclass)
+{
+  ring->sinkpad = gst_pad_new_from_static_template (&sink_factory, "sink");
+  gst_pad_set_chain_function (ring->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_frame_ring_chain));
+  gst_pad_set_event_function (ring->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_frame_ring_sink_event));
+  gst_pad_set_setcaps_function (ring->sinkpad, gst_pad_proxy_setcaps);
+  gst_pad_set_getcaps_function (ring->sinkpad, gst_pad_proxy_getcaps);
+  gst_element_add_pad (GST_ELEMENT (ring), ring->sinkpad);
+
+  ring->srcpad = gst_pad_new_from_static_template (&src_factory, "src");
+  gst_pad_set_getcaps_function (ring->srcpad, gst_pad_proxy_getcaps);
+  gst_element_add_pad (GST_ELEMENT (ring), ring->srcpad);
+
+  ring->socket_path = g_strdup (DEFAULT_SOCKET_PATH);
+  ring->frames = DEFAULT_FRAMES;
+  ring->lock = g_mutex_new ();
+  ring->cond = g_cond_new ();
+  ring->listen_fd = -1;
+  ring->wake[0] = ring->wake[1] = -1;
+  gst_segment_init (&ring->segment, GST_FORMAT_TIME);
+}
+
+static void
+gst_frame_ring_finalize (GObject * object)
+{
+  GstFrameRing *ring = GST_FRAME_RING (object);
+
+  g_free (ring->socket_path);
+  g_mutex_free (ring->lock);
+  g_cond_free (ring->cond);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_frame_ring_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstFrameRing *ring = GST_FRAME_RING (object);
+
+  switch (prop_id) {
+    case PROP_SOCKET_PATH:
+      g_free (ring->socket_path);
+      ring->socket_path = g_value_dup_string (value);
+      break;
+    case PROP_FRAMES:
+      ring->frames = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_frame_ring_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstFrameRing *ring = GST_FRAME_RING (object);
+
+  switch (prop_id) {
+    case PROP_SOCKET_PATH:
+      g_value_set_string (value, ring->socket_path);
+      break;
+    case PROP_FRAMES:
+      g_value_set_uint (value, ring->frames);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+/* Drops every frame held, new frames start over from 0 */
+static void
+gst_frame_ring_clear (GstFrameRing * ring)
+{
+  GstBuffer *buffer;
+  guint i;
+
+  g_mutex_lock (ring->lock);
+  for (i = 0; i < ring->size; i++) {
+    buffer = ring->entries[i].buffer;
+    ring->entries[i].buffer = NULL;
+    if (buffer) {
+      g_mutex_unlock (ring->lock);
+      gst_buffer_unref (buffer);
+      g_mutex_lock (ring->lock);
+    }
+  }
+  ring->next = 0;
+  g_mutex_unlock (ring->lock);
+}
+
+/* Wall clock time the buffer was captured at. The running time of the
+ * buffer against the running time of the pipeline gives its age. */
+static gint64
+gst_frame_ring_capture_time (GstFrameRing * ring, GstBuffer * buffer)
+{
+  GstClock *clock;
+  GstClockTime running;
+  GstClockTimeDiff age = 0;
+  GTimeVal now;
+
+  g_get_current_time (&now);
+
+  running = gst_segment_to_running_time (&ring->segment, GST_FORMAT_TIME,
+      GST_BUFFER_TIMESTAMP (buffer));
+  clock = gst_element_get_clock (GST_ELEMENT_CAST (ring));
+  if (clock) {
+    if (GST_CLOCK_TIME_IS_VALID (running))
+      age = GST_CLOCK_DIFF (gst_element_get_base_time (GST_ELEMENT_CAST
+              (ring)) + running, gst_clock_get_time (clock));
+    gst_object_unref (clock);
+  }
+
+  return (gint64) now.tv_sec * G_USEC_PER_SEC + now.tv_usec -
+      age / GST_USECOND;
+}
+
+static GstFlowReturn
+gst_frame_ring_chain (GstPad * pad, GstBuffer * buffer)
+{
+  GstFrameRing *ring = GST_FRAME_RING (GST_PAD_PARENT (pad));
+  GstFrameRingEntry *entry;
+  GstBuffer *old;
+  gint64 capture;
+
+  capture = gst_frame_ring_capture_time (ring, buffer);
+
+  g_mutex_lock (ring->lock);
+  entry = &ring->entries[ring->next % ring->size];
+  old = entry->buffer;
+  entry->buffer = buffer;
+  entry->capture = capture;
+  ring->next++;
+  g_cond_broadcast (ring->cond);
+  g_mutex_unlock (ring->lock);
+
+  if (old)
+    gst_buffer_unref (old);
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+gst_frame_ring_sink_event (GstPad * pad, GstEvent * event)
+{
+  GstFrameRing *ring = GST_FRAME_RING (GST_PAD_PARENT (pad));
+  GstFormat format;
+  gboolean update;
+  gdouble rate;
+  gdouble applied_rate;
+  gint64 start;
+  gint64 stop;
+  gint64 position;
+  gboolean ret;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_NEWSEGMENT:
+      gst_event_parse_new_segment_full (event, &update, &rate, &applied_rate,
+          &format, &start, &stop, &position);
+      if (format == GST_FORMAT_TIME)
+        gst_segment_set_newsegment_full (&ring->segment, update, rate,
+            applied_rate, format, start, stop, position);
+      break;
+    case GST_EVENT_FLUSH_START:
+      g_mutex_lock (ring->lock);
+      ring->flushing = TRUE;
+      g_cond_broadcast (ring->cond);
+      g_mutex_unlock (ring->lock);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      gst_frame_ring_clear (ring);
+      gst_segment_init (&ring->segment, GST_FORMAT_TIME);
+      g_mutex_lock (ring->lock);
+      ring->flushing = FALSE;
+      g_mutex_unlock (ring->lock);
+      break;
+    default:
+      break;
+  }
+
+  if (!GST_EVENT_IS_SERIALIZED (event))
+    return gst_pad_push_event (ring->srcpad, event);
+
+  /* Kept in order with the frames the request thread pushes */
+  GST_PAD_STREAM_LOCK (ring->srcpad);
+  ret = gst_pad_push_event (ring->srcpad, event);
+  GST_PAD_STREAM_UNLOCK (ring->srcpad);
+
+  return ret;
+}
+
+/* With the lock held, the frame captured closest to time. A time past
+ * the newest frame waits for the next one, it may be closer. */
+static guint64
+gst_frame_ring_closest (GstFrameRing * ring, gint64 time)
+{
+  GstFrameRingEntry *entry;
+  GTimeVal deadline;
+  guint64 oldest;
+  guint64 best;
+  guint64 n;
+
+  entry = &ring->entries[(ring->next - 1) % ring->size];
+  if (entry->capture < time && !ring->flushing) {
+    g_get_current_time (&deadline);
+    g_time_val_add (&deadline, WAIT_US);
+    g_cond_timed_wait (ring->cond, ring->lock, &deadline);
+  }
+
+  oldest = ring->next > ring->size ? ring->next - ring->size : 0;
+  best = oldest;
+  for (n = oldest + 1; n < ring->next; n++)
+    if (ABS (ring->entries[n % ring->size].capture - time) <
+        ABS (ring->entries[best % ring->size].capture - time))
+      best = n;
+
+  return best;
+}
+
+/* Pushes up to count frames starting with the one closest to request,
+ * after telling the client which */
+static void
+gst_frame_ring_serve (GstFrameRing * ring, int fd,
+    const struct framering_message *request)
+{
+  struct framering_message reply;
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstBuffer *buffer;
+  GTimeVal deadline;
+  guint64 n;
+  guint count = MIN (request->count, FRAMERING_MAX_FRAMES);
+  guint pushed = 0;
+
+  memset (&reply, 0, sizeof (reply));
+
+  g_mutex_lock (ring->lock);
+  if (!ring->next || ring->flushing) {
+    g_mutex_unlock (ring->lock);
+    send (fd, &reply, sizeof (reply), MSG_NOSIGNAL);
+    return;
+  }
+
+  n = gst_frame_ring_closest (ring, request->sec * G_USEC_PER_SEC +
+      request->usec);
+  if (!ring->next) {
+    /* Flushed while waiting */
+    g_mutex_unlock (ring->lock);
+    send (fd, &reply, sizeof (reply), MSG_NOSIGNAL);
+    return;
+  }
+  reply.sec = ring->entries[n % ring->size].capture / G_USEC_PER_SEC;
+  reply.usec = ring->entries[n % ring->size].capture % G_USEC_PER_SEC;
+  reply.count = count;
+  g_mutex_unlock (ring->lock);
+
+  send (fd, &reply, sizeof (reply), MSG_NOSIGNAL);
+
+  g_mutex_lock (ring->lock);
+  while (pushed < count && ret == GST_FLOW_OK) {
+    /* The rest of a burst follows the live stream */
+    g_get_current_time (&deadline);
+    g_time_val_add (&deadline, WAIT_US);
+    while (n >= ring->next && !ring->flushing)
+      if (!g_cond_timed_wait (ring->cond, ring->lock, &deadline))
+        break;
+    if (ring->flushing || n >= ring->next)
+      break;
+
+    /* Overwritten while the encoder was catching up */
+    if (n + ring->size < ring->next)
+      n = ring->next - ring->size;
+
+    buffer = gst_buffer_ref (ring->entries[n % ring->size].buffer);
+    g_mutex_unlock (ring->lock);
+
+    GST_PAD_STREAM_LOCK (ring->srcpad);
+    ret = gst_pad_push (ring->srcpad, buffer);
+    GST_PAD_STREAM_UNLOCK (ring->srcpad);
+
+    g_mutex_lock (ring->lock);
+    pushed++;
+    n++;
+  }
+  ring->requests++;
+  ring->pushed += pushed;
+  g_mutex_unlock (ring->lock);
+
+  if (pushed < count)
+    GST_WARNING_OBJECT (ring, "pushed %u of %u frames: %s", pushed, count,
+        gst_flow_get_name (ret));
+}
+
+/* Request thread, one client at a time */
+static gpointer
+gst_frame_ring_run (gpointer data)
+{
+  GstFrameRing *ring = data;
+  struct framering_message request;
+  struct timeval timeout = { 1, 0 };
+  struct pollfd fds[2];
+  int fd;
+
+  for (;;) {
+    fds[0].fd = ring->wake[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = ring->listen_fd;
+    fds[1].events = POLLIN;
+
+    if (poll (fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (fds[0].revents)
+      break;
+
+    fd = accept (ring->listen_fd, NULL, NULL);
+    if (fd < 0)
+      continue;
+
+    /* A client that never sends doesn't hold up the others */
+    setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+    if (recv (fd, &request, sizeof (request), 0) == sizeof (request))
+      gst_frame_ring_serve (ring, fd, &request);
+    close (fd);
+  }
+
+  return NULL;
+}
+
+static gboolean
+gst_frame_ring_start (GstFrameRing * ring)
+{
+  struct sockaddr_un address;
+
+  if (strlen (ring->socket_path) >= sizeof (address.sun_path)) {
+    GST_ELEMENT_ERROR (ring, RESOURCE, SETTINGS,
+        ("Socket path too long: %s", ring->socket_path), (NULL));
+    return FALSE;
+  }
+
+  ring->size = ring->frames;
+  ring->entries = g_new0 (GstFrameRingEntry, ring->size);
+  ring->next = 0;
+  ring->flushing = FALSE;
+  ring->requests = ring->pushed = 0;
+  gst_segment_init (&ring->segment, GST_FORMAT_TIME);
+
+  memset (&address, 0, sizeof (address));
+  address.sun_family = AF_UNIX;
+  strcpy (address.sun_path, ring->socket_path);
+  unlink (ring->socket_path);
+
+  ring->listen_fd = socket (AF_UNIX, SOCK_SEQPACKET, 0);
+  if (ring->listen_fd < 0 || bind (ring->listen_fd,
+          (struct sockaddr *) &address, sizeof (address)) < 0 ||
+      listen (ring->listen_fd, 4) < 0 || pipe (ring->wake) < 0) {
+    GST_ELEMENT_ERROR (ring, RESOURCE, OPEN_READ,
+        ("Could not listen on %s", ring->socket_path), GST_ERROR_SYSTEM);
+    return FALSE;
+  }
+
+  ring->thread = g_thread_create (gst_frame_ring_run, ring, TRUE, NULL);
+  if (!ring->thread) {
+    GST_ELEMENT_ERROR (ring, RESOURCE, FAILED,
+        ("Could not start the request thread"), (NULL));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Also undoes a partial start */
+static void
+gst_frame_ring_stop (GstFrameRing * ring)
+{
+  if (ring->thread) {
+    g_mutex_lock (ring->lock);
+    ring->flushing = TRUE;
+    g_cond_broadcast (ring->cond);
+    g_mutex_unlock (ring->lock);
+
+    if (write (ring->wake[1], "", 1) < 0)
+      GST_WARNING_OBJECT (ring, "could not wake the request thread");
+    g_thread_join (ring->thread);
+    ring->thread = NULL;
+
+    GST_INFO_OBJECT (ring, "%" G_GUINT64_FORMAT " requests, %"
+        G_GUINT64_FORMAT " frames pushed", ring->requests, ring->pushed);
+  }
+
+  if (ring->listen_fd >= 0) {
+    close (ring->listen_fd);
+    unlink (ring->socket_path);
+    ring->listen_fd = -1;
+  }
+  if (ring->wake[0] >= 0) {
+    close (ring->wake[0]);
+    close (ring->wake[1]);
+    ring->wake[0] = ring->wake[1] = -1;
+  }
+
+  if (ring->entries) {
+    gst_frame_ring_clear (ring);
+    g_free (ring->entries);
+    ring->entries = NULL;
+    ring->size = 0;
+  }
+}
+
+static GstStateChangeReturn
+gst_frame_ring_change_state (GstElement * element, GstStateChange transition)
+{
+  GstFrameRing *ring = GST_FRAME_RING (element);
+  GstStateChangeReturn ret;
+
+  if (transition == GST_STATE_CHANGE_READY_TO_PAUSED &&
+      !gst_frame_ring_start (ring)) {
+    gst_frame_ring_stop (ring);
+    return GST_STATE_CHANGE_FAILURE;
+  }
+
+  ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+  if (transition == GST_STATE_CHANGE_PAUSED_TO_READY)
+    gst_frame_ring_stop (ring);
+
+  return ret;
+}
+
+static gboolean
+framering_init (GstPlugin * plugin)
+{
+  return gst_element_register (plugin, "framering", GST_RANK_NONE,
+      GST_TYPE_FRAME_RING);
+}
+
+GST_PLUGIN_DEFINE (
+    GST_VERSION_MAJOR,
+    GST_VERSION_MINOR,
+    "framering",
+    "Ring of recent frames pushed on request",
+    framering_init,
+    VERSION,
+    "LGPL",
+    "GStreamer",
+    "http://www.ridgerun.com/"
+)
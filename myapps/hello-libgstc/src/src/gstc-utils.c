@@ -0,0 +1,2096 @@
+/* libgstc client side helpers
+
+
+ * Copyright 2011 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "gstc-utils.h"
+
+/****************************************************************
+ * Constants
+ ****************************************************************/
+#define GSTC_BATCH_MAX_OPS 64
+#define GSTC_NAME_LEN 64
+#define GSTC_STRING_LEN 256
+#define GSTC_FILTER_MAX_PIPELINES 16
+#define GSTC_FILTER_MAX_ELEMENTS 8
+#define GSTC_FILTER_MAX_PENDING 8
+#define GSTC_POOL_SIZE 16
+#define GSTC_POOL_MAX_PROPERTIES 16
+#define GSTC_SHARED_MAX_SOURCES 8
+#define GSTC_SHARED_SOCKET "/tmp/gstd-shared-%s"
+#define GSTC_SHARED_REGISTRY GSTC_SHARED_SOCKET ".caps"
+/* Frames the shared memory area holds, so slow consumers don't make
+ * shmsink drop */
+#define GSTC_SHARED_FRAMES 6
+/* Used when the frame size can't be told from the caps */
+#define GSTC_SHARED_SHM_SIZE (8 * 1024 * 1024)
+
+/************************************************************************
+ * Pipeline batches
+ ************************************************************************/
+enum batch_op_type {
+	BATCH_BOOLEAN,
+	BATCH_INT32,
+	BATCH_INT64,
+	BATCH_STRING,
+	BATCH_STATE
+};
+
+union batch_value {
+	char boolean;
+	int int32;
+	int64_t int64;
+	char *string;
+	int state;
+};
+
+struct batch_op {
+	enum batch_op_type type;
+	pipelineHandle handle;
+	char element[GSTC_NAME_LEN];
+	char property[GSTC_NAME_LEN];
+	union batch_value value;
+	/* Value or state to go back to, filled in by the commit for
+	 * properties */
+	union batch_value undo;
+};
+
+struct _GstcBatch {
+	int n_ops;
+	struct batch_op op[GSTC_BATCH_MAX_OPS];
+};
+
+/****************************************************************
+ * gstc_batch_new
+ ****************************************************************/
+GstcBatch *gstc_batch_new(void)
+{
+	return calloc(1, sizeof(GstcBatch));
+}
+
+/****************************************************************
+ * gstc_batch_free
+ ****************************************************************/
+void gstc_batch_free(GstcBatch *batch)
+{
+	int i;
+
+	if (!batch)
+		return;
+	for (i = 0; i < batch->n_ops; i++) {
+		if (batch->op[i].type == BATCH_STRING) {
+			free(batch->op[i].value.string);
+			free(batch->op[i].undo.string);
+		}
+	}
+	free(batch);
+}
+
+/****************************************************************
+ * batch_add
+ *
+ * Queues a property operation. Names that don't fit are rejected
+ * rather than cut.
+ ****************************************************************/
+static struct batch_op *batch_add(GstcBatch *batch, enum batch_op_type type,
+				  pipelineHandle handle, const char *element,
+				  const char *property)
+{
+	struct batch_op *op;
+
+	if (batch->n_ops == GSTC_BATCH_MAX_OPS ||
+	    strlen(element) >= GSTC_NAME_LEN ||
+	    strlen(property) >= GSTC_NAME_LEN)
+		return NULL;
+
+	op = &batch->op[batch->n_ops++];
+	memset(op, 0, sizeof(*op));
+	op->type = type;
+	op->handle = handle;
+	strcpy(op->element, element);
+	strcpy(op->property, property);
+
+	return op;
+}
+
+/****************************************************************
+ * gstc_batch_set_boolean
+ ****************************************************************/
+int gstc_batch_set_boolean(GstcBatch *batch, pipelineHandle handle,
+			   const char *element, const char *property,
+			   char value)
+{
+	struct batch_op *op;
+
+	op = batch_add(batch, BATCH_BOOLEAN, handle, element, property);
+	if (!op)
+		return -1;
+	op->value.boolean = value;
+
+	return 0;
+}
+
+/****************************************************************
+ * gstc_batch_set_int32
+ ****************************************************************/
+int gstc_batch_set_int32(GstcBatch *batch, pipelineHandle handle,
+			 const char *element, const char *property,
+			 int value)
+{
+	struct batch_op *op;
+
+	op = batch_add(batch, BATCH_INT32, handle, element, property);
+	if (!op)
+		return -1;
+	op->value.int32 = value;
+
+	return 0;
+}
+
+/****************************************************************
+ * gstc_batch_set_int64
+ ****************************************************************/
+int gstc_batch_set_int64(GstcBatch *batch, pipelineHandle handle,
+			 const char *element, const char *property,
+			 int64_t value)
+{
+	struct batch_op *op;
+
+	op = batch_add(batch, BATCH_INT64, handle, element, property);
+	if (!op)
+		return -1;
+	op->value.int64 = value;
+
+	return 0;
+}
+
+/****************************************************************
+ * gstc_batch_set_string
+ ****************************************************************/
+int gstc_batch_set_string(GstcBatch *batch, pipelineHandle handle,
+			  const char *element, const char *property,
+			  const char *value)
+{
+	struct batch_op *op;
+	char *copy;
+
+	copy = strdup(value);
+	if (!copy)
+		return -1;
+	op = batch_add(batch, BATCH_STRING, handle, element, property);
+	if (!op) {
+		free(copy);
+		return -1;
+	}
+	op->value.string = copy;
+
+	return 0;
+}
+
+/****************************************************************
+ * gstc_batch_set_state
+ ****************************************************************/
+int gstc_batch_set_state(GstcBatch *batch, pipelineHandle handle,
+			 int from_state, int to_state)
+{
+	struct batch_op *op;
+
+	op = batch_add(batch, BATCH_STATE, handle, "", "");
+	if (!op)
+		return -1;
+	op->value.state = to_state;
+	op->undo.state = from_state;
+
+	return 0;
+}
+
+/****************************************************************
+ * batch_state
+ ****************************************************************/
+static int batch_state(pipelineHandle handle, int state)
+{
+	switch (state) {
+	case LIBGSTC_EVENT_NULL:
+		return libgstc_pipeline_null(handle);
+	case LIBGSTC_EVENT_READY:
+		return libgstc_pipeline_ready(handle);
+	case LIBGSTC_EVENT_PAUSED:
+		return libgstc_pipeline_pause(handle);
+	case LIBGSTC_EVENT_PLAYING:
+		return libgstc_pipeline_play(handle);
+	}
+	return -1;
+}
+
+/****************************************************************
+ * batch_set
+ *
+ * Sets a property to value, or to the saved undo value
+ ****************************************************************/
+static int batch_set(struct batch_op *op, const union batch_value *value)
+{
+	switch (op->type) {
+	case BATCH_BOOLEAN:
+		return libgstc_set_property_boolean(op->handle, op->element,
+						    op->property,
+						    value->boolean);
+	case BATCH_INT32:
+		return libgstc_set_property_int32(op->handle, op->element,
+						  op->property, value->int32);
+	case BATCH_INT64:
+		return libgstc_set_property_int64(op->handle, op->element,
+						  op->property, value->int64);
+	case BATCH_STRING:
+		return libgstc_set_property_string(op->handle, op->element,
+						   op->property,
+						   value->string);
+	case BATCH_STATE:
+		return batch_state(op->handle, value->state);
+	}
+	return -1;
+}
+
+/****************************************************************
+ * batch_save
+ *
+ * Reads the current value of a property so it can be undone
+ ****************************************************************/
+static int batch_save(struct batch_op *op)
+{
+	char *string;
+	int ret;
+
+	switch (op->type) {
+	case BATCH_BOOLEAN:
+		return libgstc_get_property_boolean(op->handle, op->element,
+						    op->property,
+						    &op->undo.boolean);
+	case BATCH_INT32:
+		return libgstc_get_property_int32(op->handle, op->element,
+						  op->property, &op->undo.int32);
+	case BATCH_INT64:
+		return libgstc_get_property_int64(op->handle, op->element,
+						  op->property, &op->undo.int64);
+	case BATCH_STRING:
+		free(op->undo.string);
+		op->undo.string = calloc(1, GSTC_STRING_LEN);
+		if (!op->undo.string)
+			return -1;
+		string = op->undo.string;
+		ret = libgstc_get_property_string(op->handle, op->element,
+						  op->property, &string,
+						  GSTC_STRING_LEN);
+		/* A value that filled the buffer may have been cut */
+		if (!ret && strlen(op->undo.string) == GSTC_STRING_LEN - 1)
+			return -1;
+		return ret;
+	case BATCH_STATE:
+		/* Given by the caller */
+		return 0;
+	}
+	return -1;
+}
+
+/****************************************************************
+ * gstc_batch_commit
+ *
+ * Applies the operations in the order they were queued. Before a
+ * property is set its current value is read back, and if any
+ * operation fails the ones already applied are undone in reverse
+ * order.
+ ****************************************************************/
+int gstc_batch_commit(GstcBatch *batch)
+{
+	struct batch_op *op;
+	int i;
+
+	for (i = 0; i < batch->n_ops; i++) {
+		op = &batch->op[i];
+		if (batch_save(op) || batch_set(op, &op->value))
+			break;
+	}
+	if (i == batch->n_ops)
+		return 0;
+
+	/* The failed operation may have been applied in part too */
+	if (batch->op[i].type == BATCH_STATE)
+		batch_set(&batch->op[i], &batch->op[i].undo);
+	while (i-- > 0)
+		batch_set(&batch->op[i], &batch->op[i].undo);
+
+	return -1;
+}
+
+/************************************************************************
+ * Position and duration cache
+ ************************************************************************/
+struct _GstcPositionCache {
+	pipelineHandle handle;
+	pthread_mutex_t mutex;
+	int64_t resync_ns;
+
+	int state;
+	double rate;
+
+	int position_valid;
+	int64_t position;
+	int64_t position_time;		/* monotonic time of the position sample */
+	/* The last re-sync found the position standing still */
+	int stalled;
+
+	int duration_valid;
+	int64_t duration;
+
+	unsigned int served;
+	unsigned int fetched;
+};
+
+/****************************************************************
+ * cache_now
+ *
+ * Monotonic time in nanoseconds
+ ****************************************************************/
+static int64_t cache_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/****************************************************************
+ * gstc_position_cache_new
+ ****************************************************************/
+GstcPositionCache *gstc_position_cache_new(pipelineHandle handle, int resync_ms)
+{
+	GstcPositionCache *cache;
+
+	cache = calloc(1, sizeof(GstcPositionCache));
+	if (!cache)
+		return NULL;
+
+	cache->handle = handle;
+	cache->resync_ns = (int64_t)resync_ms * 1000000LL;
+	cache->state = LIBGSTC_EVENT_NULL;
+	cache->rate = 1.0;
+	pthread_mutex_init(&cache->mutex, NULL);
+
+	return cache;
+}
+
+/****************************************************************
+ * gstc_position_cache_free
+ ****************************************************************/
+void gstc_position_cache_free(GstcPositionCache *cache)
+{
+	if (!cache)
+		return;
+	pthread_mutex_destroy(&cache->mutex);
+	free(cache);
+}
+
+/****************************************************************
+ * gstc_position_cache_position
+ ****************************************************************/
+int gstc_position_cache_position(GstcPositionCache *cache, int64_t *position)
+{
+	int64_t now = cache_now();
+	int64_t age;
+	int64_t sample;
+	int ret = 0;
+
+	pthread_mutex_lock(&cache->mutex);
+
+	age = now - cache->position_time;
+	if (!cache->position_valid || age >= cache->resync_ns) {
+		ret = libgstc_get_pipeline_position(cache->handle, &sample);
+		/* Buffering or a stopped live source: the position moved
+		 * less than half of what the clock says since the last
+		 * sample */
+		if (!ret && cache->position_valid &&
+		    cache->state == LIBGSTC_EVENT_PLAYING)
+			cache->stalled = llabs(sample - cache->position) * 2 <
+					 llabs((int64_t)(age * cache->rate));
+		else
+			cache->stalled = 0;
+		if (!ret)
+			cache->position = sample;
+		cache->position_valid = !ret;
+		cache->position_time = now;
+		cache->fetched++;
+		age = 0;
+	} else {
+		cache->served++;
+	}
+
+	*position = cache->position;
+	if (cache->state == LIBGSTC_EVENT_PLAYING && !cache->stalled)
+		*position += (int64_t)(age * cache->rate);
+
+	/* Never report past the end of the media */
+	if (cache->duration_valid && cache->duration > 0 &&
+	    *position > cache->duration)
+		*position = cache->duration;
+
+	pthread_mutex_unlock(&cache->mutex);
+
+	return ret;
+}
+
+/****************************************************************
+ * gstc_position_cache_duration
+ ****************************************************************/
+int gstc_position_cache_duration(GstcPositionCache *cache, int64_t *duration)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&cache->mutex);
+
+	if (!cache->duration_valid) {
+		ret = libgstc_get_media_duration(cache->handle,
+						 &cache->duration);
+		cache->duration_valid = !ret;
+		cache->fetched++;
+	} else {
+		cache->served++;
+	}
+	*duration = cache->duration;
+
+	pthread_mutex_unlock(&cache->mutex);
+
+	return ret;
+}
+
+/****************************************************************
+ * cache_rebase
+ *
+ * Folds the extrapolated time into the position sample, must be
+ * called before the state or the rate change
+ ****************************************************************/
+static void cache_rebase(GstcPositionCache *cache)
+{
+	int64_t now = cache_now();
+
+	if (cache->position_valid && !cache->stalled &&
+	    cache->state == LIBGSTC_EVENT_PLAYING)
+		cache->position += (int64_t)((now - cache->position_time) *
+						 cache->rate);
+	cache->position_time = now;
+}
+
+/****************************************************************
+ * gstc_position_cache_set_state
+ ****************************************************************/
+void gstc_position_cache_set_state(GstcPositionCache *cache, int state)
+{
+	pthread_mutex_lock(&cache->mutex);
+	cache_rebase(cache);
+	cache->state = state;
+	cache->stalled = 0;
+	/* Going to NULL or READY rewinds the pipeline */
+	if (state == LIBGSTC_EVENT_NULL || state == LIBGSTC_EVENT_READY) {
+		cache->position_valid = 0;
+		cache->duration_valid = 0;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/****************************************************************
+ * gstc_position_cache_set_rate
+ ****************************************************************/
+void gstc_position_cache_set_rate(GstcPositionCache *cache, double rate)
+{
+	pthread_mutex_lock(&cache->mutex);
+	cache_rebase(cache);
+	cache->rate = rate;
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/****************************************************************
+ * gstc_position_cache_invalidate
+ *
+ * Forces the next position query to go to gstd, e.g. after a seek
+ ****************************************************************/
+void gstc_position_cache_invalidate(GstcPositionCache *cache)
+{
+	pthread_mutex_lock(&cache->mutex);
+	cache->position_valid = 0;
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/****************************************************************
+ * gstc_position_cache_stats
+ ****************************************************************/
+void gstc_position_cache_stats(GstcPositionCache *cache, unsigned int *served,
+			  unsigned int *fetched)
+{
+	pthread_mutex_lock(&cache->mutex);
+	*served = cache->served;
+	*fetched = cache->fetched;
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/************************************************************************
+ * State event filtering and coalescing
+ ************************************************************************/
+struct filter_pending {
+	int used;
+	int old_state;
+	int new_state;
+	int64_t deadline;
+	char src[GSTC_NAME_LEN];
+};
+
+struct filter_entry {
+	pipelineHandle handle;
+	GstcStateCallback callback;
+	int top_level_only;
+	char pipeline[GSTC_NAME_LEN];	/* empty for pipeline<n> */
+	int n_elements;			/* -1 for every element */
+	char elements[GSTC_FILTER_MAX_ELEMENTS][GSTC_NAME_LEN];
+	unsigned int transitions;
+	int64_t coalesce_ns;
+	struct filter_pending pending[GSTC_FILTER_MAX_PENDING];
+	unsigned int received;
+	unsigned int delivered;
+};
+
+static struct filter_entry filters[GSTC_FILTER_MAX_PIPELINES];
+static pthread_mutex_t filter_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t filter_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t filter_thread;
+static int filter_thread_running = 0;
+
+/****************************************************************
+ * filter_find
+ ****************************************************************/
+static struct filter_entry *filter_find(pipelineHandle handle)
+{
+	int i;
+
+	for (i = 0; i < GSTC_FILTER_MAX_PIPELINES; i++) {
+		if (filters[i].callback && filters[i].handle == handle)
+			return &filters[i];
+	}
+	return NULL;
+}
+
+/****************************************************************
+ * filter_is_pipeline
+ *
+ * Unless told otherwise, the top level bin has the name
+ * gst_parse_launch() gives it: "pipeline" followed by a number
+ ****************************************************************/
+static int filter_is_pipeline(struct filter_entry *entry, const char *src)
+{
+	if (entry->pipeline[0])
+		return !strcmp(entry->pipeline, src);
+
+	if (strncmp(src, "pipeline", 8) || !src[8])
+		return 0;
+	for (src += 8; *src; src++) {
+		if (*src < '0' || *src > '9')
+			return 0;
+	}
+	return 1;
+}
+
+/****************************************************************
+ * filter_accepts
+ ****************************************************************/
+static int filter_accepts(struct filter_entry *entry, int old_state,
+			  int new_state, const char *src)
+{
+	int i;
+
+	if (entry->top_level_only && !filter_is_pipeline(entry, src))
+		return 0;
+
+	if (entry->transitions &&
+	    !(entry->transitions & GSTC_TRANSITION(old_state, new_state)))
+		return 0;
+
+	if (entry->n_elements < 0)
+		return 1;
+	for (i = 0; i < entry->n_elements; i++) {
+		if (!strcmp(entry->elements[i], src))
+			return 1;
+	}
+	return 0;
+}
+
+/****************************************************************
+ * filter_dispatch
+ *
+ * State callback registered with libgstc for filtered pipelines,
+ * runs on the libgstc main loop thread
+ ****************************************************************/
+static void filter_dispatch(pipelineHandle handle, int old_state,
+			    int new_state, char *src)
+{
+	struct filter_entry *entry;
+	struct filter_pending *slot = NULL;
+	GstcStateCallback callback;
+	int i;
+
+	pthread_mutex_lock(&filter_mutex);
+
+	entry = filter_find(handle);
+	if (!entry) {
+		pthread_mutex_unlock(&filter_mutex);
+		return;
+	}
+	entry->received++;
+
+	if (!filter_accepts(entry, old_state, new_state, src)) {
+		pthread_mutex_unlock(&filter_mutex);
+		return;
+	}
+
+	if (!entry->coalesce_ns) {
+		callback = entry->callback;
+		entry->delivered++;
+		pthread_mutex_unlock(&filter_mutex);
+		callback(handle, old_state, new_state, src);
+		return;
+	}
+
+	/* Merge with a pending event from the same source */
+	for (i = 0; i < GSTC_FILTER_MAX_PENDING; i++) {
+		if (entry->pending[i].used && !strcmp(entry->pending[i].src, src)) {
+			entry->pending[i].new_state = new_state;
+			pthread_mutex_unlock(&filter_mutex);
+			return;
+		}
+		if (!entry->pending[i].used && !slot)
+			slot = &entry->pending[i];
+	}
+
+	if (!slot) {
+		/* Out of slots, deliver right away */
+		callback = entry->callback;
+		entry->delivered++;
+		pthread_mutex_unlock(&filter_mutex);
+		callback(handle, old_state, new_state, src);
+		return;
+	}
+
+	slot->used = 1;
+	slot->old_state = old_state;
+	slot->new_state = new_state;
+	slot->deadline = cache_now() + entry->coalesce_ns;
+	strncpy(slot->src, src, GSTC_NAME_LEN - 1);
+	slot->src[GSTC_NAME_LEN - 1] = '\0';
+
+	pthread_cond_signal(&filter_cond);
+	pthread_mutex_unlock(&filter_mutex);
+}
+
+/****************************************************************
+ * filter_deliver
+ *
+ * Delivers the coalesced events once their window expires
+ ****************************************************************/
+static void *filter_deliver(void *data)
+{
+	struct filter_pending event;
+	struct filter_entry *entry;
+	struct timespec ts;
+	GstcStateCallback callback;
+	pipelineHandle handle;
+	int64_t next;
+	int64_t now;
+	int found;
+	int i;
+	int j;
+
+	pthread_mutex_lock(&filter_mutex);
+	while (1) {
+		now = cache_now();
+		next = 0;
+		found = 0;
+
+		for (i = 0; i < GSTC_FILTER_MAX_PIPELINES && !found; i++) {
+			entry = &filters[i];
+			if (!entry->callback)
+				continue;
+			for (j = 0; j < GSTC_FILTER_MAX_PENDING; j++) {
+				if (!entry->pending[j].used)
+					continue;
+				if (entry->pending[j].deadline <= now) {
+					event = entry->pending[j];
+					entry->pending[j].used = 0;
+					entry->delivered++;
+					callback = entry->callback;
+					handle = entry->handle;
+					found = 1;
+					break;
+				}
+				if (!next || entry->pending[j].deadline < next)
+					next = entry->pending[j].deadline;
+			}
+		}
+
+		if (found) {
+			pthread_mutex_unlock(&filter_mutex);
+			callback(handle, event.old_state, event.new_state, event.src);
+			pthread_mutex_lock(&filter_mutex);
+			continue;
+		}
+
+		if (!next) {
+			pthread_cond_wait(&filter_cond, &filter_mutex);
+			continue;
+		}
+
+		/* The condition uses the realtime clock */
+		clock_gettime(CLOCK_REALTIME, &ts);
+		next -= now;
+		ts.tv_sec += next / 1000000000LL;
+		ts.tv_nsec += next % 1000000000LL;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&filter_cond, &filter_mutex, &ts);
+	}
+
+	return NULL;
+}
+
+/****************************************************************
+ * gstc_event_filter_set
+ ****************************************************************/
+int gstc_event_filter_set(pipelineHandle handle, const GstcEventFilter *filter,
+			  GstcStateCallback callback)
+{
+	struct filter_entry *entry;
+	int i;
+
+	/* Names that don't fit would match the wrong source */
+	if (filter->pipeline && strlen(filter->pipeline) >= GSTC_NAME_LEN)
+		return -1;
+	for (i = 0; filter->elements && filter->elements[i]; i++) {
+		if (i == GSTC_FILTER_MAX_ELEMENTS ||
+		    strlen(filter->elements[i]) >= GSTC_NAME_LEN)
+			return -1;
+	}
+
+	pthread_mutex_lock(&filter_mutex);
+
+	entry = filter_find(handle);
+	for (i = 0; !entry && i < GSTC_FILTER_MAX_PIPELINES; i++) {
+		if (!filters[i].callback)
+			entry = &filters[i];
+	}
+	if (!entry) {
+		pthread_mutex_unlock(&filter_mutex);
+		return -1;
+	}
+
+	memset(entry, 0, sizeof(*entry));
+	entry->handle = handle;
+	entry->top_level_only = filter->top_level_only;
+	if (filter->pipeline)
+		strcpy(entry->pipeline, filter->pipeline);
+	entry->transitions = filter->transitions;
+	entry->coalesce_ns = (int64_t)filter->coalesce_ms * 1000000LL;
+	entry->n_elements = -1;
+	if (filter->elements) {
+		for (i = 0; filter->elements[i]; i++)
+			strcpy(entry->elements[i], filter->elements[i]);
+		entry->n_elements = i;
+	}
+	entry->callback = callback;
+
+	if (entry->coalesce_ns && !filter_thread_running) {
+		if (pthread_create(&filter_thread, NULL, filter_deliver, NULL)) {
+			entry->callback = NULL;
+			pthread_mutex_unlock(&filter_mutex);
+			return -1;
+		}
+		filter_thread_running = 1;
+	}
+
+	pthread_mutex_unlock(&filter_mutex);
+
+	return libgstc_pipeline_set_state_event_callback(handle, filter_dispatch);
+}
+
+/****************************************************************
+ * gstc_event_filter_remove
+ *
+ * Pending coalesced events of the pipeline are discarded
+ ****************************************************************/
+void gstc_event_filter_remove(pipelineHandle handle)
+{
+	struct filter_entry *entry;
+
+	pthread_mutex_lock(&filter_mutex);
+	entry = filter_find(handle);
+	if (entry)
+		memset(entry, 0, sizeof(*entry));
+	pthread_mutex_unlock(&filter_mutex);
+}
+
+/****************************************************************
+ * gstc_event_filter_stats
+ ****************************************************************/
+void gstc_event_filter_stats(pipelineHandle handle, unsigned int *received,
+			     unsigned int *delivered)
+{
+	struct filter_entry *entry;
+
+	pthread_mutex_lock(&filter_mutex);
+	entry = filter_find(handle);
+	*received = entry ? entry->received : 0;
+	*delivered = entry ? entry->delivered : 0;
+	pthread_mutex_unlock(&filter_mutex);
+}
+
+/************************************************************************
+ * Pipeline pool
+ ************************************************************************/
+struct pool_entry {
+	pipelineHandle handle;
+	char *description;
+	int parked;
+	/* Properties set through the pool, with the value they had when
+	 * the pipeline was created */
+	int n_properties;
+	struct batch_op properties[GSTC_POOL_MAX_PROPERTIES];
+};
+
+static struct pool_entry pool[GSTC_POOL_SIZE];
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int pool_reused = 0;
+static unsigned int pool_created = 0;
+
+/****************************************************************
+ * gstc_pool_create
+ ****************************************************************/
+int gstc_pool_create(const char *description, pipelineHandle *handle)
+{
+	struct pool_entry *free_entry = NULL;
+	int ret;
+	int i;
+
+	pthread_mutex_lock(&pool_mutex);
+
+	for (i = 0; i < GSTC_POOL_SIZE; i++) {
+		if (pool[i].description && pool[i].parked &&
+		    !strcmp(pool[i].description, description)) {
+			pool[i].parked = 0;
+			pool_reused++;
+			*handle = pool[i].handle;
+			pthread_mutex_unlock(&pool_mutex);
+			return 0;
+		}
+		if (!pool[i].description && !free_entry)
+			free_entry = &pool[i];
+	}
+
+	pool_created++;
+	pthread_mutex_unlock(&pool_mutex);
+
+	ret = libgstc_pipeline_create(description, handle);
+	if (ret || !free_entry)
+		return ret;
+
+	/* Track it so it can be parked on release */
+	pthread_mutex_lock(&pool_mutex);
+	if (!free_entry->description) {
+		free_entry->description = strdup(description);
+		free_entry->handle = *handle;
+		free_entry->parked = 0;
+	}
+	pthread_mutex_unlock(&pool_mutex);
+
+	return 0;
+}
+
+/****************************************************************
+ * pool_find
+ *
+ * Must be called with the pool mutex held
+ ****************************************************************/
+static struct pool_entry *pool_find(pipelineHandle handle)
+{
+	int i;
+
+	for (i = 0; i < GSTC_POOL_SIZE; i++) {
+		if (pool[i].description && pool[i].handle == handle)
+			return &pool[i];
+	}
+	return NULL;
+}
+
+/****************************************************************
+ * pool_set
+ *
+ * Records the value the property had before its first change, then
+ * sets it. Pipelines not tracked by the pool are just set.
+ ****************************************************************/
+static int pool_set(struct batch_op *op)
+{
+	struct pool_entry *entry;
+	struct batch_op *saved = NULL;
+	int i;
+
+	pthread_mutex_lock(&pool_mutex);
+	entry = pool_find(op->handle);
+	for (i = 0; entry && i < entry->n_properties; i++) {
+		if (entry->properties[i].type == op->type &&
+		    !strcmp(entry->properties[i].element, op->element) &&
+		    !strcmp(entry->properties[i].property, op->property))
+			break;
+	}
+	if (entry && i == entry->n_properties) {
+		/* Without room the change couldn't be undone */
+		if (i == GSTC_POOL_MAX_PROPERTIES) {
+			pthread_mutex_unlock(&pool_mutex);
+			return -1;
+		}
+		saved = &entry->properties[i];
+		*saved = *op;
+		saved->value.string = NULL;
+		saved->undo.string = NULL;
+	}
+	pthread_mutex_unlock(&pool_mutex);
+
+	/* The pipeline belongs to the caller until released, nobody
+	 * else touches its entry */
+	if (saved) {
+		if (batch_save(saved))
+			return -1;
+		entry->n_properties++;
+	}
+
+	return batch_set(op, &op->value);
+}
+
+/****************************************************************
+ * gstc_pool_set_boolean
+ ****************************************************************/
+int gstc_pool_set_boolean(pipelineHandle handle, const char *element,
+			  const char *property, char value)
+{
+	struct batch_op op;
+
+	memset(&op, 0, sizeof(op));
+	if (strlen(element) >= GSTC_NAME_LEN ||
+	    strlen(property) >= GSTC_NAME_LEN)
+		return -1;
+	op.type = BATCH_BOOLEAN;
+	op.handle = handle;
+	strcpy(op.element, element);
+	strcpy(op.property, property);
+	op.value.boolean = value;
+
+	return pool_set(&op);
+}
+
+/****************************************************************
+ * gstc_pool_set_int32
+ ****************************************************************/
+int gstc_pool_set_int32(pipelineHandle handle, const char *element,
+			const char *property, int value)
+{
+	struct batch_op op;
+
+	memset(&op, 0, sizeof(op));
+	if (strlen(element) >= GSTC_NAME_LEN ||
+	    strlen(property) >= GSTC_NAME_LEN)
+		return -1;
+	op.type = BATCH_INT32;
+	op.handle = handle;
+	strcpy(op.element, element);
+	strcpy(op.property, property);
+	op.value.int32 = value;
+
+	return pool_set(&op);
+}
+
+/****************************************************************
+ * gstc_pool_set_int64
+ ****************************************************************/
+int gstc_pool_set_int64(pipelineHandle handle, const char *element,
+			const char *property, int64_t value)
+{
+	struct batch_op op;
+
+	memset(&op, 0, sizeof(op));
+	if (strlen(element) >= GSTC_NAME_LEN ||
+	    strlen(property) >= GSTC_NAME_LEN)
+		return -1;
+	op.type = BATCH_INT64;
+	op.handle = handle;
+	strcpy(op.element, element);
+	strcpy(op.property, property);
+	op.value.int64 = value;
+
+	return pool_set(&op);
+}
+
+/****************************************************************
+ * gstc_pool_set_string
+ ****************************************************************/
+int gstc_pool_set_string(pipelineHandle handle, const char *element,
+			 const char *property, const char *value)
+{
+	struct batch_op op;
+
+	memset(&op, 0, sizeof(op));
+	if (strlen(element) >= GSTC_NAME_LEN ||
+	    strlen(property) >= GSTC_NAME_LEN)
+		return -1;
+	op.type = BATCH_STRING;
+	op.handle = handle;
+	strcpy(op.element, element);
+	strcpy(op.property, property);
+	op.value.string = (char *)value;
+
+	return pool_set(&op);
+}
+
+/****************************************************************
+ * pool_forget
+ *
+ * Frees the recorded property values of an entry
+ ****************************************************************/
+static void pool_forget(struct pool_entry *entry)
+{
+	int i;
+
+	for (i = 0; i < entry->n_properties; i++) {
+		if (entry->properties[i].type == BATCH_STRING)
+			free(entry->properties[i].undo.string);
+	}
+	entry->n_properties = 0;
+}
+
+/****************************************************************
+ * gstc_pool_release
+ *
+ * Sets the pipeline to NULL, which rewinds it and clears its error
+ * state, and restores the properties changed through the pool.
+ * Pipelines that couldn't be tracked or reset are destroyed.
+ ****************************************************************/
+int gstc_pool_release(pipelineHandle handle)
+{
+	struct pool_entry *entry;
+	int ret;
+	int i;
+
+	pthread_mutex_lock(&pool_mutex);
+	entry = pool_find(handle);
+	pthread_mutex_unlock(&pool_mutex);
+
+	if (!entry)
+		return libgstc_pipeline_destroy(handle);
+
+	ret = libgstc_pipeline_null(handle);
+	for (i = entry->n_properties - 1; !ret && i >= 0; i--) {
+		ret = batch_set(&entry->properties[i],
+				&entry->properties[i].undo);
+	}
+
+	pthread_mutex_lock(&pool_mutex);
+	pool_forget(entry);
+	if (ret) {
+		/* Never hand out a pipeline in an unknown state */
+		free(entry->description);
+		memset(entry, 0, sizeof(*entry));
+	} else {
+		entry->parked = 1;
+	}
+	pthread_mutex_unlock(&pool_mutex);
+
+	if (ret)
+		return libgstc_pipeline_destroy(handle);
+
+	return 0;
+}
+
+/****************************************************************
+ * gstc_pool_flush
+ *
+ * Destroys every parked pipeline
+ ****************************************************************/
+int gstc_pool_flush(void)
+{
+	pipelineHandle handle;
+	int ret = 0;
+	int i;
+
+	for (i = 0; i < GSTC_POOL_SIZE; i++) {
+		pthread_mutex_lock(&pool_mutex);
+		if (!pool[i].description || !pool[i].parked) {
+			pthread_mutex_unlock(&pool_mutex);
+			continue;
+		}
+		handle = pool[i].handle;
+		free(pool[i].description);
+		pool_forget(&pool[i]);
+		memset(&pool[i], 0, sizeof(pool[i]));
+		pthread_mutex_unlock(&pool_mutex);
+
+		if (libgstc_pipeline_destroy(handle))
+			ret = -1;
+	}
+
+	return ret;
+}
+
+/****************************************************************
+ * gstc_pool_stats
+ ****************************************************************/
+void gstc_pool_stats(unsigned int *reused, unsigned int *created)
+{
+	pthread_mutex_lock(&pool_mutex);
+	*reused = pool_reused;
+	*created = pool_created;
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+/************************************************************************
+ * Seek coalescing and trick play
+ ************************************************************************/
+struct _GstcSeeker {
+	pipelineHandle handle;
+	int fps_num;
+	int fps_den;
+	int gop_frames;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int running;
+
+	int pending;			/* a target is waiting to be issued */
+	int busy;			/* a seek is in flight */
+	int error;			/* result of the last issued seek */
+	long target_ms;			/* last requested target */
+	int has_target;
+	int64_t frame;			/* frame of the last step */
+	int has_frame;
+
+	unsigned int requested;
+	unsigned int issued;
+};
+
+/****************************************************************
+ * seeker_frame_ms
+ *
+ * Start of a frame rounded up to the millisecond, so an accurate seek
+ * lands inside the frame. Computed from the frame index so stepping
+ * doesn't accumulate rounding errors.
+ ****************************************************************/
+static long seeker_frame_ms(GstcSeeker *seeker, int64_t frame)
+{
+	return (long)((frame * seeker->fps_den * 1000LL + seeker->fps_num - 1) /
+		      seeker->fps_num);
+}
+
+/****************************************************************
+ * seeker_frame_ms_before
+ *
+ * Start of a frame rounded down to the millisecond, so a seek
+ * snapping to the keyframe at or before it can't land on the frame
+ * after the keyframe
+ ****************************************************************/
+static long seeker_frame_ms_before(GstcSeeker *seeker, int64_t frame)
+{
+	return (long)(frame * seeker->fps_den * 1000LL / seeker->fps_num);
+}
+
+/****************************************************************
+ * seeker_snap
+ ****************************************************************/
+static long seeker_snap(GstcSeeker *seeker, long position_ms, GstcSeekMode mode)
+{
+	int64_t gop = seeker->gop_frames;
+	int64_t keyframe;
+	long before;
+	long after;
+	long on;
+
+	if (seeker->fps_num <= 0 || gop <= 0 || mode == GSTC_SEEK_ACCURATE)
+		return position_ms;
+
+	keyframe = (int64_t)position_ms * seeker->fps_num /
+		(gop * seeker->fps_den * 1000LL);
+	before = seeker_frame_ms_before(seeker, keyframe * gop);
+	after = seeker_frame_ms(seeker, (keyframe + 1) * gop);
+	switch (mode) {
+	case GSTC_SEEK_SNAP_BEFORE:
+		return before;
+	case GSTC_SEEK_SNAP_AFTER:
+		/* Already on the keyframe, to the millisecond */
+		on = seeker_frame_ms(seeker, keyframe * gop);
+		return (position_ms <= on) ? on : after;
+	default:
+		return (position_ms - before < after - position_ms) ? before : after;
+	}
+}
+
+/****************************************************************
+ * seeker_request
+ *
+ * Must be called with the seeker mutex held
+ ****************************************************************/
+static void seeker_request(GstcSeeker *seeker, long target_ms)
+{
+	seeker->target_ms = target_ms;
+	seeker->has_target = 1;
+	seeker->pending = 1;
+	seeker->requested++;
+	pthread_cond_broadcast(&seeker->cond);
+}
+
+/****************************************************************
+ * seeker_thread
+ ****************************************************************/
+static void *seeker_thread(void *data)
+{
+	GstcSeeker *seeker = data;
+	long target;
+	int ret;
+
+	pthread_mutex_lock(&seeker->mutex);
+	while (1) {
+		while (seeker->running && !seeker->pending)
+			pthread_cond_wait(&seeker->cond, &seeker->mutex);
+		if (!seeker->running)
+			break;
+
+		target = seeker->target_ms;
+		seeker->pending = 0;
+		seeker->busy = 1;
+		pthread_mutex_unlock(&seeker->mutex);
+
+		ret = libgstc_media_seek(seeker->handle, target);
+
+		pthread_mutex_lock(&seeker->mutex);
+		seeker->busy = 0;
+		seeker->error = ret;
+		seeker->issued++;
+		pthread_cond_broadcast(&seeker->cond);
+	}
+	pthread_mutex_unlock(&seeker->mutex);
+
+	return NULL;
+}
+
+/****************************************************************
+ * gstc_seeker_new
+ *
+ * fps_num/fps_den is the framerate of the stream and gop_frames the
+ * frames between keyframes. Use a framerate of 0 when unknown to
+ * disable stepping and snapping, and a GOP of 0 to disable snapping.
+ ****************************************************************/
+GstcSeeker *gstc_seeker_new(pipelineHandle handle, int fps_num, int fps_den,
+			    int gop_frames)
+{
+	GstcSeeker *seeker;
+
+	seeker = calloc(1, sizeof(GstcSeeker));
+	if (!seeker)
+		return NULL;
+
+	seeker->handle = handle;
+	seeker->fps_num = fps_num;
+	seeker->fps_den = (fps_den > 0) ? fps_den : 1;
+	seeker->gop_frames = gop_frames;
+	seeker->running = 1;
+	pthread_mutex_init(&seeker->mutex, NULL);
+	pthread_cond_init(&seeker->cond, NULL);
+
+	if (pthread_create(&seeker->thread, NULL, seeker_thread, seeker)) {
+		pthread_cond_destroy(&seeker->cond);
+		pthread_mutex_destroy(&seeker->mutex);
+		free(seeker);
+		return NULL;
+	}
+
+	return seeker;
+}
+
+/****************************************************************
+ * gstc_seeker_free
+ *
+ * Waits for the seek in flight, pending targets are dropped
+ ****************************************************************/
+void gstc_seeker_free(GstcSeeker *seeker)
+{
+	if (!seeker)
+		return;
+
+	pthread_mutex_lock(&seeker->mutex);
+	seeker->running = 0;
+	pthread_cond_broadcast(&seeker->cond);
+	pthread_mutex_unlock(&seeker->mutex);
+	pthread_join(seeker->thread, NULL);
+
+	pthread_cond_destroy(&seeker->cond);
+	pthread_mutex_destroy(&seeker->mutex);
+	free(seeker);
+}
+
+/****************************************************************
+ * gstc_seeker_seek
+ *
+ * Returns right away, the seek is issued asynchronously and replaces
+ * any target still waiting to be issued
+ ****************************************************************/
+int gstc_seeker_seek(GstcSeeker *seeker, long position_ms, GstcSeekMode mode)
+{
+	if (position_ms < 0)
+		position_ms = 0;
+
+	pthread_mutex_lock(&seeker->mutex);
+	seeker->has_frame = 0;
+	seeker_request(seeker, seeker_snap(seeker, position_ms, mode));
+	pthread_mutex_unlock(&seeker->mutex);
+
+	return 0;
+}
+
+/****************************************************************
+ * gstc_seeker_step
+ *
+ * Moves by whole frames from the last step, the last requested target
+ * or the current position if nothing was requested yet. Negative
+ * values step backwards. The pipeline should be paused.
+ ****************************************************************/
+int gstc_seeker_step(GstcSeeker *seeker, int frames)
+{
+	int64_t position;
+	int64_t frame;
+	int ret;
+
+	if (seeker->fps_num <= 0)
+		return -1;
+
+	pthread_mutex_lock(&seeker->mutex);
+	if (seeker->has_frame) {
+		frame = seeker->frame;
+	} else if (seeker->has_target) {
+		frame = (int64_t)seeker->target_ms * seeker->fps_num /
+			(seeker->fps_den * 1000LL);
+	} else {
+		pthread_mutex_unlock(&seeker->mutex);
+		ret = libgstc_get_pipeline_position(seeker->handle, &position);
+		if (ret)
+			return ret;
+		pthread_mutex_lock(&seeker->mutex);
+		frame = position * seeker->fps_num /
+			(seeker->fps_den * 1000000000LL);
+	}
+
+	frame += frames;
+	if (frame < 0)
+		frame = 0;
+	seeker->frame = frame;
+	seeker->has_frame = 1;
+	seeker_request(seeker, seeker_frame_ms(seeker, frame));
+	pthread_mutex_unlock(&seeker->mutex);
+
+	return 0;
+}
+
+/****************************************************************
+ * gstc_seeker_sync
+ *
+ * Blocks until every requested seek was issued, returns the result
+ * of the last one
+ ****************************************************************/
+int gstc_seeker_sync(GstcSeeker *seeker)
+{
+	int ret;
+
+	pthread_mutex_lock(&seeker->mutex);
+	while (seeker->pending || seeker->busy)
+		pthread_cond_wait(&seeker->cond, &seeker->mutex);
+	ret = seeker->error;
+	pthread_mutex_unlock(&seeker->mutex);
+
+	return ret;
+}
+
+/****************************************************************
+ * gstc_seeker_stats
+ ****************************************************************/
+void gstc_seeker_stats(GstcSeeker *seeker, unsigned int *requested,
+		       unsigned int *issued)
+{
+	pthread_mutex_lock(&seeker->mutex);
+	*requested = seeker->requested;
+	*issued = seeker->issued;
+	pthread_mutex_unlock(&seeker->mutex);
+}
+
+/************************************************************************
+ * Shared sources
+ ************************************************************************/
+struct shared_source {
+	char name[GSTC_NAME_LEN];
+	pipelineHandle handle;
+};
+
+/* Sources published by this process, the registry files tell the
+ * others about them */
+static struct shared_source shared_sources[GSTC_SHARED_MAX_SOURCES];
+static pthread_mutex_t shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/****************************************************************
+ * shared_find
+ ****************************************************************/
+static struct shared_source *shared_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < GSTC_SHARED_MAX_SOURCES; i++) {
+		if (shared_sources[i].name[0] && !strcmp(shared_sources[i].name, name))
+			return &shared_sources[i];
+	}
+	return NULL;
+}
+
+/****************************************************************
+ * shared_caps_int
+ *
+ * Reads an integer field such as "width=(int)640" from the caps
+ ****************************************************************/
+static int shared_caps_int(const char *caps, const char *field)
+{
+	const char *pos;
+	int value;
+
+	pos = strstr(caps, field);
+	if (!pos)
+		return -1;
+	pos += strlen(field);
+	if (*pos++ != '=')
+		return -1;
+	if (!strncmp(pos, "(int)", 5))
+		pos += 5;
+	if (sscanf(pos, "%d", &value) != 1)
+		return -1;
+
+	return value;
+}
+
+/****************************************************************
+ * shared_shm_size
+ *
+ * Room for GSTC_SHARED_FRAMES frames of the raw video described by
+ * the caps, the default size for anything else
+ ****************************************************************/
+static int shared_shm_size(const char *caps)
+{
+	int width = shared_caps_int(caps, "width");
+	int height = shared_caps_int(caps, "height");
+	int bpp = shared_caps_int(caps, "bpp");
+	int64_t frame;
+
+	if (width <= 0 || height <= 0)
+		return GSTC_SHARED_SHM_SIZE;
+
+	if (strstr(caps, "I420") || strstr(caps, "YV12") ||
+	    strstr(caps, "NV12"))
+		frame = (int64_t)width * height * 3 / 2;
+	else if (strstr(caps, "YUY2") || strstr(caps, "UYVY"))
+		frame = (int64_t)width * height * 2;
+	else if (strstr(caps, "video/x-raw-rgb") && bpp > 0)
+		frame = (int64_t)width * height * ((bpp + 7) / 8);
+	else
+		return GSTC_SHARED_SHM_SIZE;
+
+	/* shmsink needs some room for its own bookkeeping */
+	frame = frame * GSTC_SHARED_FRAMES + 4096;
+	if (frame > 0x7fffffff)
+		return -1;
+
+	return (int)frame;
+}
+
+/****************************************************************
+ * shared_is_alive
+ *
+ * A registry file left by a publisher that died has no shmsink
+ * listening on its socket
+ ****************************************************************/
+static int shared_is_alive(const char *name)
+{
+	struct sockaddr_un addr;
+	int alive;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), GSTC_SHARED_SOCKET, name);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return 1;
+	alive = !connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+	close(fd);
+
+	return alive;
+}
+
+/****************************************************************
+ * shared_register
+ *
+ * Creates the registry file of a source, fails if another process
+ * published the same name
+ ****************************************************************/
+static int shared_register(const char *name, const char *caps)
+{
+	char path[GSTC_NAME_LEN + 32];
+	ssize_t len = strlen(caps);
+	int fd;
+
+	sprintf(path, GSTC_SHARED_REGISTRY, name);
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd < 0 && errno == EEXIST && !shared_is_alive(name)) {
+		unlink(path);
+		fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	}
+	if (fd < 0)
+		return -1;
+
+	if (write(fd, caps, len) != len) {
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+	close(fd);
+
+	return 0;
+}
+
+/****************************************************************
+ * shared_lookup
+ *
+ * Returns the caps of a published source, to be freed by the caller
+ ****************************************************************/
+static char *shared_lookup(const char *name)
+{
+	char path[GSTC_NAME_LEN + 32];
+	char *caps;
+	ssize_t len;
+	int fd;
+
+	sprintf(path, GSTC_SHARED_REGISTRY, name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	caps = calloc(1, GSTC_STRING_LEN * 4);
+	if (!caps) {
+		close(fd);
+		return NULL;
+	}
+	len = read(fd, caps, GSTC_STRING_LEN * 4 - 1);
+	close(fd);
+	if (len <= 0) {
+		free(caps);
+		return NULL;
+	}
+
+	return caps;
+}
+
+/****************************************************************
+ * shared_unregister
+ ****************************************************************/
+static void shared_unregister(const char *name)
+{
+	char path[GSTC_NAME_LEN + 32];
+
+	sprintf(path, GSTC_SHARED_REGISTRY, name);
+	unlink(path);
+}
+
+/****************************************************************
+ * gstc_shared_source_publish
+ *
+ * Creates and plays the source pipeline, the returned handle can be
+ * used to control the source itself
+ ****************************************************************/
+int gstc_shared_source_publish(const char *name, const char *source,
+			       const char *caps, pipelineHandle *handle)
+{
+	struct shared_source *shared = NULL;
+	char *description;
+	int shm_size;
+	int ret;
+	int i;
+
+	/* The name ends up in a path */
+	if (!name[0] || strlen(name) >= GSTC_NAME_LEN || strchr(name, '/') ||
+	    strlen(caps) >= GSTC_STRING_LEN * 4)
+		return -1;
+
+	shm_size = shared_shm_size(caps);
+	if (shm_size < 0)
+		return -1;
+
+	pthread_mutex_lock(&shared_mutex);
+	if (shared_find(name)) {
+		pthread_mutex_unlock(&shared_mutex);
+		return -1;
+	}
+	for (i = 0; i < GSTC_SHARED_MAX_SOURCES && !shared; i++) {
+		if (!shared_sources[i].name[0])
+			shared = &shared_sources[i];
+	}
+	if (!shared) {
+		pthread_mutex_unlock(&shared_mutex);
+		return -1;
+	}
+	strcpy(shared->name, name);
+	pthread_mutex_unlock(&shared_mutex);
+
+	if (shared_register(name, caps))
+		goto error;
+
+	description = malloc(strlen(source) + strlen(caps) + strlen(name) + 256);
+	if (!description)
+		goto error_registered;
+
+	/* Never block the source waiting for consumers */
+	sprintf(description, "%s ! %s ! shmsink socket-path=" GSTC_SHARED_SOCKET
+		" shm-size=%d wait-for-connection=false sync=false",
+		source, caps, name, shm_size);
+
+	ret = libgstc_pipeline_create(description, &shared->handle);
+	free(description);
+	if (ret)
+		goto error_registered;
+
+	ret = libgstc_pipeline_play(shared->handle);
+	if (ret) {
+		libgstc_pipeline_destroy(shared->handle);
+		goto error_registered;
+	}
+
+	if (handle)
+		*handle = shared->handle;
+	return 0;
+
+error_registered:
+	shared_unregister(name);
+error:
+	pthread_mutex_lock(&shared_mutex);
+	memset(shared, 0, sizeof(*shared));
+	pthread_mutex_unlock(&shared_mutex);
+	return -1;
+}
+
+/****************************************************************
+ * gstc_shared_source_attach
+ *
+ * Creates a pipeline fed by the published source, consumer is the
+ * rest of the pipeline (e.g. "queue ! dmaienc_h264 ! ..."). The
+ * source may have been published by another process.
+ ****************************************************************/
+int gstc_shared_source_attach(const char *name, const char *consumer,
+			      pipelineHandle *handle)
+{
+	char *description;
+	char *caps;
+	int ret;
+
+	if (strlen(name) >= GSTC_NAME_LEN || strchr(name, '/'))
+		return -1;
+
+	caps = shared_lookup(name);
+	if (!caps)
+		return -1;
+
+	description = malloc(strlen(consumer) + strlen(caps) +
+			     strlen(name) + 128);
+	if (!description) {
+		free(caps);
+		return -1;
+	}
+	sprintf(description, "shmsrc socket-path=" GSTC_SHARED_SOCKET
+		" is-live=true do-timestamp=true ! %s ! %s",
+		name, caps, consumer);
+	free(caps);
+
+	ret = libgstc_pipeline_create(description, handle);
+	free(description);
+
+	return ret;
+}
+
+/****************************************************************
+ * gstc_shared_source_unpublish
+ *
+ * Only the publishing process can unpublish a source. Attached
+ * pipelines stop receiving buffers, they should be set to NULL or
+ * destroyed first.
+ ****************************************************************/
+int gstc_shared_source_unpublish(const char *name)
+{
+	struct shared_source *shared;
+	pipelineHandle handle;
+
+	pthread_mutex_lock(&shared_mutex);
+	shared = shared_find(name);
+	if (!shared) {
+		pthread_mutex_unlock(&shared_mutex);
+		return -1;
+	}
+	handle = shared->handle;
+	memset(shared, 0, sizeof(*shared));
+	pthread_mutex_unlock(&shared_mutex);
+
+	shared_unregister(name);
+
+	return libgstc_pipeline_destroy(handle);
+}
+
+/************************************************************************
+ * Pipeline watchdog
+ ************************************************************************/
+struct watchdog_probe {
+	char name[GSTC_NAME_LEN];
+	GstcProbeStats stats;
+	int64_t changed;		/* monotonic time of the last new buffer */
+	int alarmed;
+	int unreadable;			/* the last read failed */
+};
+
+struct _GstcWatchdog {
+	pipelineHandle handle;
+	GstcWatchdogCallback alarm;
+	int64_t interval_ns;
+	int gap_ms;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int running;
+	int armed;
+
+	int n_probes;
+	struct watchdog_probe probes[GSTC_WATCHDOG_MAX_PROBES];
+};
+
+/****************************************************************
+ * watchdog_parse_timestamp
+ *
+ * Extracts the timestamp from identity's last-message, formatted as
+ * "... timestamp: 0:00:01.000000000, ..."
+ ****************************************************************/
+static int64_t watchdog_parse_timestamp(const char *message)
+{
+	unsigned int h, m, s, ns;
+	const char *pos;
+
+	pos = strstr(message, "timestamp: ");
+	if (!pos || sscanf(pos + 11, "%u:%u:%u.%u", &h, &m, &s, &ns) != 4)
+		return -1;
+
+	return ((int64_t)(h * 3600 + m * 60 + s)) * 1000000000LL + ns;
+}
+
+/****************************************************************
+ * watchdog_sample
+ *
+ * Fails when the probe can't be read, e.g. it isn't in the pipeline.
+ * The timestamp is -1 when the last buffer had none.
+ ****************************************************************/
+static int watchdog_sample(GstcWatchdog *watchdog,
+			   struct watchdog_probe *probe, int64_t *timestamp)
+{
+	char message[256];
+	char *value = &message[0];
+
+	if (!probe->name[0])
+		return libgstc_get_pipeline_position(watchdog->handle, timestamp);
+
+	message[0] = '\0';
+	if (libgstc_get_property_string(watchdog->handle, probe->name,
+					"last-message", &value, sizeof(message)))
+		return -1;
+	message[sizeof(message) - 1] = '\0';
+
+	*timestamp = watchdog_parse_timestamp(message);
+	return 0;
+}
+
+/****************************************************************
+ * watchdog_thread
+ ****************************************************************/
+static void *watchdog_thread(void *data)
+{
+	GstcWatchdog *watchdog = data;
+	struct watchdog_probe *probe;
+	struct timespec ts;
+	int64_t timestamps[GSTC_WATCHDOG_MAX_PROBES];
+	int failed[GSTC_WATCHDOG_MAX_PROBES];
+	int64_t timestamp;
+	int64_t now;
+	int64_t wait;
+	char name[GSTC_NAME_LEN];
+	int gap_ms;
+	int alarm;
+	int i;
+
+	pthread_mutex_lock(&watchdog->mutex);
+	while (watchdog->running) {
+		/* Read the probes back to back so the latencies compare
+		 * timestamps as close in time as possible, and don't hold
+		 * the lock across the D-Bus calls */
+		pthread_mutex_unlock(&watchdog->mutex);
+		for (i = 0; i < watchdog->n_probes; i++) {
+			timestamps[i] = -1;
+			failed[i] = watchdog_sample(watchdog, &watchdog->probes[i],
+						    &timestamps[i]);
+		}
+		now = cache_now();
+		pthread_mutex_lock(&watchdog->mutex);
+
+		for (i = 0; i < watchdog->n_probes; i++) {
+			probe = &watchdog->probes[i];
+			timestamp = timestamps[i];
+
+			/* A probe that can't be read is reported once, with
+			 * a gap of -1, as it can't show a stall any more */
+			if (failed[i]) {
+				probe->unreadable = 1;
+				if (watchdog->armed && !probe->alarmed) {
+					probe->alarmed = 1;
+					strcpy(name, probe->name);
+					pthread_mutex_unlock(&watchdog->mutex);
+					watchdog->alarm(watchdog->handle,
+							name[0] ? name : NULL, -1);
+					pthread_mutex_lock(&watchdog->mutex);
+				}
+				continue;
+			}
+			if (probe->unreadable) {
+				probe->unreadable = 0;
+				probe->alarmed = 0;
+				probe->changed = now;
+			}
+
+			/* No timestamp says nothing about the data flow */
+			if (timestamp < 0)
+				continue;
+
+			if (timestamp != probe->stats.timestamp) {
+				probe->stats.timestamp = timestamp;
+				probe->stats.updates++;
+				probe->changed = now;
+				probe->alarmed = 0;
+			}
+			if (i > 0 && timestamps[0] >= 0)
+				probe->stats.latency = timestamps[0] - timestamp;
+
+			if (!watchdog->armed) {
+				probe->changed = now;
+				probe->stats.gap_ms = 0;
+				continue;
+			}
+
+			gap_ms = (now - probe->changed) / 1000000;
+			probe->stats.gap_ms = gap_ms;
+			if (gap_ms > probe->stats.max_gap_ms)
+				probe->stats.max_gap_ms = gap_ms;
+
+			alarm = (gap_ms > watchdog->gap_ms && !probe->alarmed);
+			if (alarm) {
+				probe->alarmed = 1;
+				strcpy(name, probe->name);
+				pthread_mutex_unlock(&watchdog->mutex);
+				watchdog->alarm(watchdog->handle,
+						name[0] ? name : NULL, gap_ms);
+				pthread_mutex_lock(&watchdog->mutex);
+			}
+		}
+
+		/* The condition uses the realtime clock */
+		clock_gettime(CLOCK_REALTIME, &ts);
+		wait = watchdog->interval_ns;
+		ts.tv_sec += wait / 1000000000LL;
+		ts.tv_nsec += wait % 1000000000LL;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		if (watchdog->running)
+			pthread_cond_timedwait(&watchdog->cond, &watchdog->mutex, &ts);
+	}
+	pthread_mutex_unlock(&watchdog->mutex);
+
+	return NULL;
+}
+
+/****************************************************************
+ * gstc_watchdog_new
+ *
+ * probes is a NULL terminated list of identity element names, or
+ * NULL to watch the pipeline position. The watchdog starts disarmed.
+ * Fails if a probe can't be read, or its name doesn't fit.
+ ****************************************************************/
+GstcWatchdog *gstc_watchdog_new(pipelineHandle handle, const char **probes,
+				int interval_ms, int gap_ms,
+				GstcWatchdogCallback alarm)
+{
+	GstcWatchdog *watchdog;
+	int64_t timestamp;
+	int i;
+
+	for (i = 0; probes && probes[i]; i++) {
+		if (i == GSTC_WATCHDOG_MAX_PROBES ||
+		    strlen(probes[i]) >= GSTC_NAME_LEN)
+			return NULL;
+	}
+
+	watchdog = calloc(1, sizeof(GstcWatchdog));
+	if (!watchdog)
+		return NULL;
+
+	watchdog->handle = handle;
+	watchdog->alarm = alarm;
+	watchdog->interval_ns = (int64_t)interval_ms * 1000000LL;
+	watchdog->gap_ms = gap_ms;
+	watchdog->running = 1;
+
+	if (probes) {
+		for (i = 0; probes[i]; i++)
+			strcpy(watchdog->probes[i].name, probes[i]);
+		watchdog->n_probes = i;
+	}
+	if (!watchdog->n_probes)
+		watchdog->n_probes = 1;
+	for (i = 0; i < watchdog->n_probes; i++) {
+		watchdog->probes[i].stats.timestamp = -1;
+		if (watchdog_sample(watchdog, &watchdog->probes[i], &timestamp)) {
+			free(watchdog);
+			return NULL;
+		}
+	}
+
+	pthread_mutex_init(&watchdog->mutex, NULL);
+	pthread_cond_init(&watchdog->cond, NULL);
+	if (pthread_create(&watchdog->thread, NULL, watchdog_thread, watchdog)) {
+		pthread_cond_destroy(&watchdog->cond);
+		pthread_mutex_destroy(&watchdog->mutex);
+		free(watchdog);
+		return NULL;
+	}
+
+	return watchdog;
+}
+
+/****************************************************************
+ * gstc_watchdog_free
+ ****************************************************************/
+void gstc_watchdog_free(GstcWatchdog *watchdog)
+{
+	if (!watchdog)
+		return;
+
+	pthread_mutex_lock(&watchdog->mutex);
+	watchdog->running = 0;
+	pthread_cond_signal(&watchdog->cond);
+	pthread_mutex_unlock(&watchdog->mutex);
+	pthread_join(watchdog->thread, NULL);
+
+	pthread_cond_destroy(&watchdog->cond);
+	pthread_mutex_destroy(&watchdog->mutex);
+	free(watchdog);
+}
+
+/****************************************************************
+ * gstc_watchdog_arm
+ *
+ * Arming fails if a probe couldn't be read in the last sample, the
+ * watchdog is armed anyway and alarms on it
+ ****************************************************************/
+int gstc_watchdog_arm(GstcWatchdog *watchdog, int armed)
+{
+	int ret = 0;
+	int i;
+
+	pthread_mutex_lock(&watchdog->mutex);
+	watchdog->armed = armed;
+	for (i = 0; i < watchdog->n_probes; i++) {
+		watchdog->probes[i].changed = cache_now();
+		watchdog->probes[i].alarmed = 0;
+		if (armed && watchdog->probes[i].unreadable)
+			ret = -1;
+	}
+	pthread_mutex_unlock(&watchdog->mutex);
+
+	return ret;
+}
+
+/****************************************************************
+ * gstc_watchdog_query
+ *
+ * probe is one of the names given at creation, or NULL for the
+ * first one. Fails for other names and for a probe that couldn't be
+ * read in the last sample, the stats are filled in anyway.
+ ****************************************************************/
+int gstc_watchdog_query(GstcWatchdog *watchdog, const char *probe,
+			GstcProbeStats *stats)
+{
+	int ret = -1;
+	int i;
+
+	pthread_mutex_lock(&watchdog->mutex);
+	for (i = 0; i < watchdog->n_probes; i++) {
+		if (!probe || !strcmp(watchdog->probes[i].name, probe)) {
+			*stats = watchdog->probes[i].stats;
+			ret = watchdog->probes[i].unreadable ? -1 : 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&watchdog->mutex);
+
+	return ret;
+}
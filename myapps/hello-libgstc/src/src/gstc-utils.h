@@ -0,0 +1,315 @@
+/* libgstc client side helpers
+
+
+ * Copyright 2011 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#ifndef GSTC_UTILS_H
+#define GSTC_UTILS_H
+
+#include <stdint.h>
+#include "libgstc.h"
+
+/****************************************************************
+ * Pipeline batches
+ *
+ * A batch collects property values and state changes for several
+ * existing pipelines and applies them as one transaction: either all
+ * of them take effect or, once one fails, the ones already applied are
+ * undone in reverse order and the commit fails. Each pipeline keeps
+ * its own state, bus, EOS and errors.
+ *
+ * Properties are read back before they are set so they can be
+ * restored, a state change goes back to the from_state the caller
+ * gives. Other clients may see the intermediate values while the
+ * commit runs, and an undo that fails itself is not reported apart.
+ *
+ * Every operation is still its own D-Bus call to gstd, plus one to
+ * read each property back: the gstd revision built in fs/apps has no
+ * method taking several operations, so the batch saves no round
+ * trips. Element and property names of GSTC_NAME_LEN (64) characters
+ * or more are rejected.
+ ****************************************************************/
+typedef struct _GstcBatch GstcBatch;
+
+GstcBatch *gstc_batch_new(void);
+void gstc_batch_free(GstcBatch *batch);
+
+int gstc_batch_set_boolean(GstcBatch *batch, pipelineHandle handle,
+			   const char *element, const char *property,
+			   char value);
+int gstc_batch_set_int32(GstcBatch *batch, pipelineHandle handle,
+			 const char *element, const char *property,
+			 int value);
+int gstc_batch_set_int64(GstcBatch *batch, pipelineHandle handle,
+			 const char *element, const char *property,
+			 int64_t value);
+int gstc_batch_set_string(GstcBatch *batch, pipelineHandle handle,
+			  const char *element, const char *property,
+			  const char *value);
+int gstc_batch_set_state(GstcBatch *batch, pipelineHandle handle,
+			 int from_state, int to_state);
+int gstc_batch_commit(GstcBatch *batch);
+
+/****************************************************************
+ * Position and duration cache
+ *
+ * A client side cache in front of libgstc_get_pipeline_position() and
+ * libgstc_get_media_duration(), nothing is published by gstd and every
+ * miss is still a D-Bus call. While playing, the position is
+ * extrapolated from the requested rate and the monotonic clock, and
+ * re-synchronized with gstd once it is older than resync_ms. The
+ * caller reports the states delivered by the pipeline's state
+ * callback, not the ones it requests, EOS as PAUSED, and its rate and
+ * seek requests.
+ *
+ * The cache can't see buffering or a live source that stops feeding
+ * the pipeline while it stays PLAYING, so within one resync_ms window
+ * the position may run ahead of the real one. Once a re-sync shows the
+ * position didn't advance, extrapolation stops until a later re-sync
+ * shows it moving again.
+ ****************************************************************/
+typedef struct _GstcPositionCache GstcPositionCache;
+
+GstcPositionCache *gstc_position_cache_new(pipelineHandle handle, int resync_ms);
+void gstc_position_cache_free(GstcPositionCache *cache);
+
+int gstc_position_cache_position(GstcPositionCache *cache, int64_t *position);
+int gstc_position_cache_duration(GstcPositionCache *cache, int64_t *duration);
+void gstc_position_cache_set_state(GstcPositionCache *cache, int state);
+void gstc_position_cache_set_rate(GstcPositionCache *cache, double rate);
+void gstc_position_cache_invalidate(GstcPositionCache *cache);
+void gstc_position_cache_stats(GstcPositionCache *cache, unsigned int *served,
+			  unsigned int *fetched);
+
+/****************************************************************
+ * State event filtering and coalescing
+ *
+ * Replaces the state callback of a pipeline with one that only
+ * forwards the events the application asked for. Events can be
+ * restricted to the top level pipeline, to a list of elements and to
+ * a set of transitions. With coalesce_ms set, transitions of the same
+ * source arriving within that window are merged into one event going
+ * from the first old state to the last new state, and delivered from
+ * a helper thread once the window expires.
+ *
+ * The filtering happens in the client: gstd still sends every state
+ * message over D-Bus, this only spares the application callback.
+ * Without coalescing the callback runs on the libgstc thread and no
+ * helper thread is started. Names of GSTC_NAME_LEN characters or more
+ * are rejected.
+ ****************************************************************/
+#define GSTC_TRANSITION(old_state, new_state) \
+	(1u << ((old_state) * 5 + (new_state)))
+
+typedef void (*GstcStateCallback) (pipelineHandle handle, int old_state,
+				   int new_state, const char *src);
+
+typedef struct {
+	/* Only events from the pipeline itself */
+	int top_level_only;
+	/* Name of the top level bin, NULL for the pipeline<n> name
+	 * gst_parse_launch() gives unnamed pipelines */
+	const char *pipeline;
+	/* NULL terminated list of element names, NULL for every element */
+	const char **elements;
+	/* Mask of GSTC_TRANSITION() values, 0 for every transition */
+	unsigned int transitions;
+	/* Merge window in milliseconds, 0 delivers right away */
+	int coalesce_ms;
+} GstcEventFilter;
+
+int gstc_event_filter_set(pipelineHandle handle, const GstcEventFilter *filter,
+			  GstcStateCallback callback);
+void gstc_event_filter_remove(pipelineHandle handle);
+void gstc_event_filter_stats(pipelineHandle handle, unsigned int *received,
+			     unsigned int *delivered);
+
+/****************************************************************
+ * Pipeline pool
+ *
+ * Released pipelines are set to NULL and parked keyed by their
+ * description instead of being destroyed. Creating a pipeline with
+ * the same description reuses a parked one, skipping the parsing,
+ * the factory lookups and the element instantiation in gstd.
+ *
+ * A reused pipeline starts from NULL, rewound and with any error
+ * cleared. Properties changed with the gstc_pool_set_*() functions are
+ * put back to the values they had when the pipeline was created, but
+ * the pool can't see changes made with libgstc_set_property_*() and
+ * those carry over to the next user. The state and EOS callbacks
+ * registered on the handle stay in place, the next user has to set
+ * its own. A pipeline that fails to reset is destroyed.
+ ****************************************************************/
+int gstc_pool_create(const char *description, pipelineHandle *handle);
+int gstc_pool_release(pipelineHandle handle);
+int gstc_pool_set_boolean(pipelineHandle handle, const char *element,
+			  const char *property, char value);
+int gstc_pool_set_int32(pipelineHandle handle, const char *element,
+			const char *property, int value);
+int gstc_pool_set_int64(pipelineHandle handle, const char *element,
+			const char *property, int64_t value);
+int gstc_pool_set_string(pipelineHandle handle, const char *element,
+			 const char *property, const char *value);
+int gstc_pool_flush(void);
+void gstc_pool_stats(unsigned int *reused, unsigned int *created);
+
+/****************************************************************
+ * Seek coalescing and trick play
+ *
+ * Seeks requested through a seeker are issued from a helper thread
+ * with at most one seek in flight. Requests arriving while a seek is
+ * in progress replace each other, so only the latest target is sent
+ * to gstd when the previous seek completes. Scrubbing a slider then
+ * costs one seek per completed decode instead of a flood of flushing
+ * seeks.
+ *
+ * Targets can be snapped to the keyframe grid of the stream (given as
+ * the framerate and the GOP length in frames) so the decoder doesn't
+ * have to decode from the previous keyframe, and stepping moves by
+ * whole frames from the last requested target.
+ *
+ * Every seek goes through libgstc_media_seek(), which takes a
+ * millisecond position and no seek flags; gstd chooses the flags and
+ * has no frame step method. How exact a seek lands, accurate or not,
+ * depends on gstd and the demuxer, and a step is a seek to the start
+ * of the next frame, not a GStreamer step event. The keyframe grid is
+ * assumed fixed; streams with variable GOPs snap to the wrong frame.
+ * Snapping before rounds down to the millisecond, accurate seeks,
+ * steps and snapping after round up, so each stays on its side of the
+ * frame boundary.
+ ****************************************************************/
+typedef enum {
+	GSTC_SEEK_ACCURATE,		/* seek to the exact position */
+	GSTC_SEEK_SNAP_BEFORE,		/* keyframe at or before the position */
+	GSTC_SEEK_SNAP_AFTER,		/* keyframe at or after the position */
+	GSTC_SEEK_SNAP_NEAREST		/* closest keyframe */
+} GstcSeekMode;
+
+typedef struct _GstcSeeker GstcSeeker;
+
+GstcSeeker *gstc_seeker_new(pipelineHandle handle, int fps_num, int fps_den,
+			    int gop_frames);
+void gstc_seeker_free(GstcSeeker *seeker);
+
+int gstc_seeker_seek(GstcSeeker *seeker, long position_ms, GstcSeekMode mode);
+int gstc_seeker_step(GstcSeeker *seeker, int frames);
+int gstc_seeker_sync(GstcSeeker *seeker);
+void gstc_seeker_stats(GstcSeeker *seeker, unsigned int *requested,
+		       unsigned int *issued);
+
+/****************************************************************
+ * Shared sources
+ *
+ * A published source runs in its own gstd pipeline feeding a shmsink,
+ * and every pipeline attached to it starts with a shmsrc reading from
+ * the same shared memory area. The capture device is opened once,
+ * while each consumer (viewfinder, recorder, streamer) keeps its own
+ * state, so starting or stopping one never disturbs the others.
+ *
+ * The source description must not include a sink, and caps must fully
+ * describe the published buffers since shmsrc doesn't negotiate them.
+ * For raw video caps the shared memory area is sized to hold a few
+ * frames, other caps get a fixed 8 MB area. Buffers are still copied
+ * into it by shmsink.
+ *
+ * Published sources are registered in a file next to the shmsink
+ * socket (/tmp/gstd-shared-<name>.caps), so any process talking to
+ * the same gstd can attach to them. Only the publishing process can
+ * unpublish; a registration left behind by a process that died is
+ * taken over on the next publish. shmsink and shmsrc come from
+ * gst-plugins-bad.
+ ****************************************************************/
+int gstc_shared_source_publish(const char *name, const char *source,
+			       const char *caps, pipelineHandle *handle);
+int gstc_shared_source_attach(const char *name, const char *consumer,
+			      pipelineHandle *handle);
+int gstc_shared_source_unpublish(const char *name);
+
+/****************************************************************
+ * Pipeline watchdog
+ *
+ * Samples a pipeline every interval_ms from a helper thread and calls
+ * the alarm callback once per stall when data stops flowing for more
+ * than gap_ms while armed. The caller arms it when the pipeline goes
+ * to PLAYING and disarms it on pause, NULL or EOS.
+ *
+ * Probes are identity elements placed in the pipeline with
+ * silent=false, e.g. "... ! identity name=enc_out silent=false ! ...".
+ * The watchdog reads the timestamp of the last buffer that went
+ * through each one, which gives the inter-buffer gap at that point
+ * and, between two probes, the stream time held by the elements in
+ * between. Without probes the pipeline position is watched instead,
+ * and reported as probe NULL.
+ *
+ * identity only exposes its last buffer, so the figures are estimates.
+ * silent=false makes identity format and notify last-message for every
+ * buffer in the streaming thread, so probes belong where the buffer
+ * rate is low and are meant for debugging. Buffers passing between two
+ * samples are seen as one update, and the probes are read one D-Bus
+ * call apart, so the latency is off by up to that time. A probe whose
+ * last buffer has no timestamp gives no information and never raises
+ * a stall. Each probe costs one D-Bus call per interval on top of the
+ * string formatting in identity, keep interval_ms in the hundreds of
+ * milliseconds.
+ *
+ * Every probe is read once at creation, which fails if one can't be
+ * read. A probe that can't be read later raises the alarm once with a
+ * gap of -1, and makes gstc_watchdog_arm() and gstc_watchdog_query()
+ * fail until it can be read again.
+ ****************************************************************/
+#define GSTC_WATCHDOG_MAX_PROBES 8
+
+typedef void (*GstcWatchdogCallback) (pipelineHandle handle, const char *probe,
+				      int gap_ms);
+
+typedef struct {
+	/* Timestamp of the last buffer seen, -1 if none */
+	int64_t timestamp;
+	/* Number of samples in which a new buffer was seen, not a
+	 * buffer count */
+	unsigned int updates;
+	/* Time without a new buffer, current and worst while armed */
+	int gap_ms;
+	int max_gap_ms;
+	/* Stream time between the first probe and this one, from
+	 * timestamps read in the same sample */
+	int64_t latency;
+} GstcProbeStats;
+
+typedef struct _GstcWatchdog GstcWatchdog;
+
+GstcWatchdog *gstc_watchdog_new(pipelineHandle handle, const char **probes,
+				int interval_ms, int gap_ms,
+				GstcWatchdogCallback alarm);
+void gstc_watchdog_free(GstcWatchdog *watchdog);
+
+int gstc_watchdog_arm(GstcWatchdog *watchdog, int armed);
+int gstc_watchdog_query(GstcWatchdog *watchdog, const char *probe,
+			GstcProbeStats *stats);
+
+#endif /* GSTC_UTILS_H */
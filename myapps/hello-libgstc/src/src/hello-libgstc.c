@@ -37,6 +37,7 @@
 #include <errno.h>
 #include <sys/time.h>
 #include "libgstc.h"
+#include "gstc-utils.h"
 
 /****************************************************************
  * Constants
@@ -45,13 +46,26 @@
 
 #define MAX_STR 1024
 
+/* Stream layout assumed by the trick play controls unless given with
+ * -F and -K: 30 fps with a keyframe every second */
+#define DEFAULT_FPS_NUM 30
+#define DEFAULT_FPS_DEN 1
+#define DEFAULT_GOP_FRAMES 30
+
+/* Scrubbing: slider positions and time between them, one per UI frame */
+#define SCRUB_STEPS 100
+#define SCRUB_REQUEST_MS 33
+
+/* Watchdog sampling period */
+#define WATCHDOG_INTERVAL_MS 250
+
 #ifdef __arm__
 #define TEST_PIPELINE "filesrc name=src ! qtdemux ! queue ! dmaidec_aac ! alsasink"
 #else
 #define TEST_PIPELINE "filesrc name=src ! aacparse ! ffdec_aac ! autoaudiosink"
 #endif
 
-const char *INSTRUCTIONS = "Controls:\n  0 = destroy all pipelines\n  1 = play\n  2 = pause \n  3 = increase speed\n  4 = decrease speed\n  5 = normal speed\n  6 = get duration\n  7 = get position\n  8 = inject eos\n  9 = set pipeline state to null\n  q = quit\n\n";
+const char *INSTRUCTIONS = "Controls:\n  0 = destroy all pipelines\n  1 = play\n  2 = pause \n  3 = increase speed\n  4 = decrease speed\n  5 = normal speed\n  6 = get duration\n  7 = get position\n  8 = inject eos\n  9 = set pipeline state to null\n  p = show progress for 5 seconds\n  f = step one frame forward\n  b = step one frame backwards\n  s = scrub through the whole media\n  w = show watchdog probes\n  q = quit\n\n";
 
 /***************************************************************************
  * Debug Macros
@@ -88,10 +102,25 @@ static int debug_level = 0;
 static int bus = 0; /* 0: system, 1: session */
 static int run_test_suite = 0;
 static int run_video_record = 0;
+static int watchdog_gap_ms = 0;	/* stall threshold, 0 disables the watchdog */
+static const char *watchdog_probes[GSTC_WATCHDOG_MAX_PROBES + 1];
+static int n_watchdog_probes = 0;
+static int fps_num = DEFAULT_FPS_NUM;
+static int fps_den = DEFAULT_FPS_DEN;
+static int gop_frames = DEFAULT_GOP_FRAMES;
 static char pipeline[MAX_STR];
 static pthread_cond_t eos_cond  = PTHREAD_COND_INITIALIZER;
 static pthread_mutex_t eos_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/* Position and duration cache of the user supplied pipeline */
+static GstcPositionCache *cache = NULL;
+
+/* Coalesced seeks on the user supplied pipeline */
+static GstcSeeker *seeker = NULL;
+
+/* Stall detection on the user supplied pipeline */
+static GstcWatchdog *watchdog = NULL;
+
 /****************************************************************
  * process_error
  ****************************************************************/
@@ -169,6 +198,14 @@ void onEoS(pipelineHandle handle)
 	int ret;
 	dbg("Sink element reached end of stream");
 
+	/* The position stops at the end, the state stays PLAYING */
+	if (cache) {
+		gstc_position_cache_set_state(cache, LIBGSTC_EVENT_PAUSED);
+		gstc_position_cache_invalidate(cache);
+	}
+	if (watchdog)
+		gstc_watchdog_arm(watchdog, 0);
+
 	ret = pthread_mutex_lock(&eos_mutex);
 	process_error(ret, "ERROR - can't lock EOS mutex");
 
@@ -203,6 +240,41 @@ void onStateChanged(pipelineHandle handle, int old_state, int new_state, char* s
 	}
 }
 
+/****************************************************************
+ * onPipelineStateChanged
+ *
+ * Filtered state callback of the user supplied pipeline, only the
+ * top level transitions get here
+ ****************************************************************/
+void onPipelineStateChanged(pipelineHandle handle, int old_state, int new_state, const char *src)
+{
+	/* Play and pause complete asynchronously, the cache only
+	 * extrapolates once the pipeline really is playing */
+	if (cache)
+		gstc_position_cache_set_state(cache, new_state);
+	if (watchdog && gstc_watchdog_arm(watchdog, new_state == LIBGSTC_EVENT_PLAYING))
+		prt("Some watchdog probes can't be read");
+
+	onStateChanged(handle, old_state, new_state, (char *)src);
+}
+
+/****************************************************************
+ * onStall
+ *
+ * Called from the watchdog thread once per stall, and once with a gap
+ * of -1 when a probe can't be read
+ ****************************************************************/
+void onStall(pipelineHandle handle, const char *probe, int gap_ms)
+{
+	if (gap_ms < 0) {
+		prt("Can't read watchdog probe %s", probe ? probe : "position");
+	} else if (probe) {
+		prt("No data through %s for %d ms", probe, gap_ms);
+	} else {
+		prt("Pipeline position stuck for %d ms", gap_ms);
+	}
+}
+
 /****************************************************************
  * test_sleep
  ****************************************************************/
@@ -268,6 +340,21 @@ void test_glibc(pipelineHandle huser)
 	int64_t val64;
 	char str128[128];
 	char *valstr128 = &str128[0];
+	GstcBatch *batch;
+	pipelineHandle hp;
+	unsigned int reused;
+	unsigned int created;
+	int pooled32;
+	const char *shared_caps = "video/x-raw-yuv,format=(fourcc)I420,width=320,height=240,framerate=(fraction)30/1";
+	pipelineHandle hs;
+	pipelineHandle hc1;
+	pipelineHandle hc2;
+	const char *p4="videotestsrc is-live=true ! identity name=probe silent=false ! fakesink name=sink";
+	const char *probes[] = {"probe", NULL};
+	const char *missing_probes[] = {"nosuchprobe", NULL};
+	pipelineHandle h4;
+	GstcWatchdog *wd;
+	GstcProbeStats probe_stats;
 
 	ret = libgstc_pipeline_create(p1, &h1);
 	process_error(ret, "T01: ERROR - can't create p1 pipeline");
@@ -401,6 +488,141 @@ void test_glibc(pipelineHandle huser)
 	process_error(ret, "T39: ERROR - can't destroy all pipelines");
 	test_sleep(1);
 
+	/* Start p1 and p2 with their initial properties as one transaction */
+	batch = gstc_batch_new();
+	process_error(!batch, "T40: ERROR - can't allocate pipeline batch");
+
+	ret = libgstc_pipeline_create(p1, &h1);
+	process_error(ret, "T41: ERROR - can't create p1 pipeline");
+
+	ret = libgstc_pipeline_create(p2, &h2);
+	process_error(ret, "T42: ERROR - can't create p2 pipeline");
+
+	ret = gstc_batch_set_int32(batch, h1, "src", "num-buffers", 500);
+	process_error(ret, "T43: ERROR - can't batch int32 property value on p1 audiotestsrc");
+
+	ret = gstc_batch_set_state(batch, h1, LIBGSTC_EVENT_NULL, LIBGSTC_EVENT_PLAYING);
+	process_error(ret, "T44: ERROR - can't batch p1 state change to play");
+
+	ret = gstc_batch_set_state(batch, h2, LIBGSTC_EVENT_NULL, LIBGSTC_EVENT_PLAYING);
+	process_error(ret, "T45: ERROR - can't batch p2 state change to play");
+
+	ret = gstc_batch_commit(batch);
+	process_error(ret, "T46: ERROR - can't commit pipeline batch");
+	gstc_batch_free(batch);
+	test_sleep(1);
+
+	ret = libgstc_get_property_int32(h1, "src", "num-buffers", &val32);
+	process_error(ret, "T47: ERROR - can't get int32 property value from p1 audiotestsrc");
+	process_error(val32 != 500, "T47: ERROR - int32 value set in the batch wasn't returned when fetched p1 audiotestsrc");
+
+	/* A batch failing half way leaves the pipelines as they were */
+	batch = gstc_batch_new();
+	process_error(!batch, "T48: ERROR - can't allocate pipeline batch");
+	gstc_batch_set_int32(batch, h1, "src", "num-buffers", 1000);
+	gstc_batch_set_int32(batch, h1, "nosuchelement", "num-buffers", 1000);
+	ret = gstc_batch_commit(batch);
+	process_error(!ret, "T48: ERROR - batch with a missing element was committed");
+	gstc_batch_free(batch);
+
+	ret = libgstc_get_property_int32(h1, "src", "num-buffers", &val32);
+	process_error(ret, "T48: ERROR - can't get int32 property value from p1 audiotestsrc");
+	process_error(val32 != 500, "T48: ERROR - int32 value of a failed batch wasn't undone on p1 audiotestsrc");
+
+	ret = libgstc_pipeline_destroy_all();
+	process_error(ret, "T49: ERROR - can't destroy batched pipelines");
+
+	/* Create, release and create again p1 through the pipeline pool */
+	ret = gstc_pool_create(p1, &hp);
+	process_error(ret, "T50: ERROR - can't create p1 pipeline from the pool");
+
+	ret = libgstc_pipeline_play(hp);
+	process_error(ret, "T51: ERROR - can't set pooled p1 state to play");
+	test_sleep(1);
+
+	ret = libgstc_get_property_int32(hp, "src", "num-buffers", &val32);
+	process_error(ret, "T51: ERROR - can't get int32 property value from pooled p1 audiotestsrc");
+	ret = gstc_pool_set_int32(hp, "src", "num-buffers", val32 + 100);
+	process_error(ret, "T51: ERROR - can't set int32 property value on pooled p1 audiotestsrc");
+
+	ret = gstc_pool_release(hp);
+	process_error(ret, "T52: ERROR - can't release p1 pipeline to the pool");
+
+	ret = gstc_pool_create(p1, &hp);
+	process_error(ret, "T53: ERROR - can't create p1 pipeline from the pool");
+
+	gstc_pool_stats(&reused, &created);
+	process_error(reused != 1 || created != 1, "T54: ERROR - released p1 pipeline wasn't reused");
+
+	ret = libgstc_get_property_int32(hp, "src", "num-buffers", &pooled32);
+	process_error(ret, "T54: ERROR - can't get int32 property value from reused p1 audiotestsrc");
+	process_error(pooled32 != val32, "T54: ERROR - property set on the released p1 pipeline wasn't reset");
+
+	ret = libgstc_pipeline_play(hp);
+	process_error(ret, "T55: ERROR - can't set reused p1 state to play");
+	test_sleep(1);
+
+	ret = gstc_pool_release(hp);
+	process_error(ret, "T56: ERROR - can't release p1 pipeline to the pool");
+
+	ret = gstc_pool_flush();
+	process_error(ret, "T57: ERROR - can't destroy pooled pipelines");
+
+	/* One source feeding two independently controlled pipelines */
+	ret = gstc_shared_source_publish("test", "videotestsrc is-live=true", shared_caps, &hs);
+	process_error(ret, "T58: ERROR - can't publish shared videotestsrc");
+
+	ret = gstc_shared_source_attach("test", "fakesink name=sink", &hc1);
+	process_error(ret, "T59: ERROR - can't attach first consumer to shared source");
+
+	ret = gstc_shared_source_attach("test", "fakesink name=sink", &hc2);
+	process_error(ret, "T60: ERROR - can't attach second consumer to shared source");
+
+	ret = libgstc_pipeline_play(hc1);
+	process_error(ret, "T61: ERROR - can't set first consumer state to play");
+
+	ret = libgstc_pipeline_play(hc2);
+	process_error(ret, "T62: ERROR - can't set second consumer state to play");
+	test_sleep(1);
+
+	ret = libgstc_pipeline_null(hc2);
+	process_error(ret, "T63: ERROR - can't set second consumer state to null while first keeps playing");
+	test_sleep(1);
+
+	ret = libgstc_pipeline_destroy(hc1);
+	process_error(ret, "T64: ERROR - can't destroy first consumer");
+
+	ret = libgstc_pipeline_destroy(hc2);
+	process_error(ret, "T65: ERROR - can't destroy second consumer");
+
+	ret = gstc_shared_source_unpublish("test");
+	process_error(ret, "T66: ERROR - can't unpublish shared source");
+
+	/* Data flow through an identity probe */
+	ret = libgstc_pipeline_create(p4, &h4);
+	process_error(ret, "T67: ERROR - can't create p4 pipeline");
+
+	wd = gstc_watchdog_new(h4, missing_probes, WATCHDOG_INTERVAL_MS, 1000, onStall);
+	process_error(wd != NULL, "T68: ERROR - watchdog started on a probe missing from p4");
+
+	wd = gstc_watchdog_new(h4, probes, WATCHDOG_INTERVAL_MS, 1000, onStall);
+	process_error(!wd, "T68: ERROR - can't start watchdog on p4");
+
+	ret = libgstc_pipeline_play(h4);
+	process_error(ret, "T69: ERROR - can't set p4 state to play");
+	ret = gstc_watchdog_arm(wd, 1);
+	process_error(ret, "T69: ERROR - can't arm watchdog on p4");
+	test_sleep(2);
+
+	ret = gstc_watchdog_query(wd, "probe", &probe_stats);
+	process_error(ret || probe_stats.updates == 0, "T70: ERROR - no buffers seen through p4 probe");
+	process_error(probe_stats.max_gap_ms > 1000, "T71: ERROR - p4 probe stalled while playing");
+
+	gstc_watchdog_arm(wd, 0);
+	gstc_watchdog_free(wd);
+	ret = libgstc_pipeline_destroy(h4);
+	process_error(ret, "T72: ERROR - can't destroy p4 pipeline");
+
 	printf("Test suite passed\n");
 
 	exit(0);
@@ -417,6 +639,14 @@ void process_user_input(pipelineHandle handle)
 	int ret;
 	int64_t duration;
 	int64_t position;
+	unsigned int served;
+	unsigned int fetched;
+	unsigned int received;
+	unsigned int delivered;
+	unsigned int requested;
+	unsigned int issued;
+	GstcProbeStats probe_stats;
+	int i;
 
 	printf("%s", INSTRUCTIONS);
 
@@ -457,6 +687,7 @@ void process_user_input(pipelineHandle handle)
 			}
 			ret = libgstc_set_pipeline_speed(handle, speed);
 			process_error(ret, "Can't increase speed");
+			gstc_position_cache_set_rate(cache, speed);
 			break;
 		case '4':
 			vdbg("Decrease speed");
@@ -466,17 +697,19 @@ void process_user_input(pipelineHandle handle)
 			}
 			ret = libgstc_set_pipeline_speed(handle, speed);
 			process_error(ret, "Can't decrease speed");
+			gstc_position_cache_set_rate(cache, speed);
 			break;
 		case '5':
 			vdbg("Normal speed");
 			speed = 1.0;
 			ret = libgstc_set_pipeline_speed(handle, speed);
 			process_error(ret, "Can't set speed to normal");
+			gstc_position_cache_set_rate(cache, speed);
 			break;
 		case '6':
 			vdbg("Get duration");
 			
-			ret = libgstc_get_media_duration(handle, &duration);
+			ret = gstc_position_cache_duration(cache, &duration);
 			process_error(ret, "Can't get media duration");
 			duration /= 1000000;
 			printf ("The duration on the pipeline is %u:%02u:%02u.%03u (%lld milliseconds)\n",
@@ -489,7 +722,7 @@ void process_user_input(pipelineHandle handle)
 		case '7':
 			vdbg("Get Position");
 			
-			ret = libgstc_get_pipeline_position(handle, &position);
+			ret = gstc_position_cache_position(cache, &position);
 			process_error(ret, "Can't get media position");
 			position /= 1000000;
 			printf ("The position on the pipeline is %u:%02u:%02u.%03u (%lld milliseconds)\n",
@@ -508,8 +741,67 @@ void process_user_input(pipelineHandle handle)
 			ret = libgstc_pipeline_null(handle);
 			process_error(ret, "can't change state to null");
 			break;
+		case 'p':
+			vdbg("Progress");
+			/* Polls at 10 Hz like a progress bar would */
+			for (i = 0; i < 50; i++) {
+				ret = gstc_position_cache_position(cache, &position);
+				process_error(ret, "Can't get media position");
+				ret = gstc_position_cache_duration(cache, &duration);
+				process_error(ret, "Can't get media duration");
+				printf("\r%lld / %lld ms ", position / 1000000,
+				       duration / 1000000);
+				fflush(stdout);
+				usleep(100000);
+			}
+			gstc_position_cache_stats(cache, &served, &fetched);
+			printf("\n%u queries served locally, %u sent to gstd\n",
+			       served, fetched);
+			break;
+		case 'f':
+		case 'b':
+			vdbg("Step");
+			ret = gstc_seeker_step(seeker, (comm == 'f') ? 1 : -1);
+			process_error(ret, "Can't step frame");
+			ret = gstc_seeker_sync(seeker);
+			process_error(ret, "Can't step frame");
+			gstc_position_cache_invalidate(cache);
+			break;
+		case 's':
+			vdbg("Scrub");
+			ret = gstc_position_cache_duration(cache, &duration);
+			process_error(ret, "Can't get media duration");
+			/* A slider dragged end to end, one request per UI frame */
+			for (i = 0; i <= SCRUB_STEPS; i++) {
+				gstc_seeker_seek(seeker, (long)(duration / 1000000 * i / SCRUB_STEPS),
+						 GSTC_SEEK_SNAP_NEAREST);
+				usleep(SCRUB_REQUEST_MS * 1000);
+			}
+			ret = gstc_seeker_sync(seeker);
+			process_error(ret, "Can't seek");
+			gstc_position_cache_invalidate(cache);
+			gstc_seeker_stats(seeker, &requested, &issued);
+			printf("%u seeks requested, %u sent to gstd\n", requested, issued);
+			break;
+		case 'w':
+			vdbg("Watchdog");
+			if (!watchdog) {
+				printf("Watchdog disabled, use -w\n");
+				break;
+			}
+			for (i = 0; i < (n_watchdog_probes ? n_watchdog_probes : 1); i++) {
+				if (gstc_watchdog_query(watchdog, watchdog_probes[i], &probe_stats))
+					continue;
+				printf("%s: %u updates, gap %d ms (max %d ms), ~%lld ms behind first probe\n",
+				       watchdog_probes[i] ? watchdog_probes[i] : "position",
+				       probe_stats.updates, probe_stats.gap_ms,
+				       probe_stats.max_gap_ms, probe_stats.latency / 1000000);
+			}
+			break;
 		case 'q':
 			vdbg("Quit");
+			gstc_event_filter_stats(handle, &received, &delivered);
+			dbg("%u state events received, %u delivered", received, delivered);
 			running = 0;
 			break;
 		default:
@@ -522,13 +814,20 @@ void process_user_input(pipelineHandle handle)
  ****************************************************************/
 static void show_usage(char *progname)
 {
-        fprintf(stderr, "\n%s [-h] [-d <debug lvl>] [-r] [-s] [-t] <GStreamer pipeline>\n", progname);
+        fprintf(stderr, "\n%s [-h] [-d <debug lvl>] [-F <num>[/<den>]] [-K <frames>] [-w <ms> [-p <probe>]...] [-r] [-s] [-t] <GStreamer pipeline>\n", progname);
         fprintf(stderr, "   -h                     print usage information\n");
         fprintf(stderr, "   -d <debug level>       set debug level 0-2\n");
+        fprintf(stderr, "   -F <num>[/<den>]       framerate of the stream, used to step frames (default %d/%d)\n",
+		DEFAULT_FPS_NUM, DEFAULT_FPS_DEN);
+        fprintf(stderr, "   -K <frames>            frames between keyframes, used to snap scrubbing (default %d, 0 disables)\n",
+		DEFAULT_GOP_FRAMES);
+        fprintf(stderr, "   -p <probe>             name of an identity element with silent=false to watch, up to %d\n",
+		GSTC_WATCHDOG_MAX_PROBES);
         fprintf(stderr, "   -r                     run the libgstc video record test forever. <GStreamer pipeline> must support\n");
         fprintf(stderr, "                          filesink element named sink.  Each recording is 10 seconds long.\n");
         fprintf(stderr, "   -s                     use session bus instead of system bus\n");
         fprintf(stderr, "   -t                     run the libgstc test suite and exit. <GStreamer pipeline> must support trick play\n");
+        fprintf(stderr, "   -w <ms>                report when no data flows for <ms> while playing\n");
         fprintf(stderr, "   <GStreamer pipeline>   pipeline to control\n");
         fprintf(stderr, " \n");
         fprintf(stderr, "Desktop examples: \n");
@@ -544,6 +843,9 @@ static void show_usage(char *progname)
 	fprintf(stderr, "   d) Run video record test suite for up to 100 loops\n");
 	fprintf(stderr, "      %s -d 2 -s -r \"v4l2src ! ffenc_mpeg2video ! mpegpsmux ! filesink name=sink\"\n",
 		progname);
+	fprintf(stderr, "   e) Report stalls longer than half a second before and after the encoder\n");
+	fprintf(stderr, "      %s -s -w 500 -p raw -p enc \"v4l2src ! identity name=raw silent=false ! ffenc_mpeg4 ! identity name=enc silent=false ! fakesink\"\n",
+		progname);
 	fprintf(stderr, "\nEmbedded examples: \n");
 	fprintf(stderr, "   a) Verbose debug using the session bus to play an MP3 file using FFMPEG\n");
 	fprintf(stderr, "      %s -d 2 -s \"filesrc location=/opt/media/davincieffect.aac ! qtdemux ! queue ! dmaidec_aac ! alsasink\"\n",
@@ -565,7 +867,7 @@ static void parse_options(int argc, char *argv[])
         /* for show_usage */
         progname = argv[0];
 
-        while ((opt = getopt(argc, argv, "hd:rst")) != -1) {
+        while ((opt = getopt(argc, argv, "hd:F:K:p:rstw:")) != -1) {
                 switch (opt) {
                 case 'h' :
                         show_usage(progname);
@@ -579,6 +881,32 @@ static void parse_options(int argc, char *argv[])
 			process_error(ret, "can't set GStreamer daemon client library debug level");
                         break;
 
+		case 'F' :
+			fps_den = 1;
+			if (sscanf(optarg, "%d/%d", &fps_num, &fps_den) < 1 ||
+			    fps_num <= 0 || fps_den <= 0) {
+				show_usage(progname);
+				printf("ERROR: invalid framerate '%s'\n", optarg);
+				exit(-1);
+			}
+                        vdbg("Framerate set to %d/%d", fps_num, fps_den);
+                        break;
+
+		case 'K' :
+			gop_frames = atoi(optarg);
+                        vdbg("Keyframe every %d frames", gop_frames);
+                        break;
+
+		case 'p' :
+			if (n_watchdog_probes == GSTC_WATCHDOG_MAX_PROBES) {
+				show_usage(progname);
+				printf("ERROR: too many probes\n");
+				exit(-1);
+			}
+			watchdog_probes[n_watchdog_probes++] = optarg;
+                        vdbg("Watch probe %s", optarg);
+                        break;
+
 		case 'r' :
                         run_video_record = 1;
                         vdbg("Run video record test for up to 100 loops");
@@ -594,6 +922,11 @@ static void parse_options(int argc, char *argv[])
                         vdbg("Run test suite and exit");
                         break;
 
+		case 'w' :
+                        watchdog_gap_ms = atoi(optarg);
+                        vdbg("Watchdog threshold set to %d ms", watchdog_gap_ms);
+                        break;
+
                 default: /* '?' */
                         show_usage(progname);
                         printf("ERROR: Unknown option '%c'\n", opt);
@@ -624,6 +957,7 @@ static void parse_options(int argc, char *argv[])
 int main(int argc, char** argv)
 {
 	pipelineHandle handle;
+	GstcEventFilter filter;
 	int ret;
 
 	parse_options(argc, argv);
@@ -642,17 +976,37 @@ int main(int argc, char** argv)
 		}
 		exit(255);
 	}
+
 		
 	dbg("Creating pipeline: %s", pipeline);
 	ret = libgstc_pipeline_create(pipeline, &handle);
 	process_error(ret, "can't create pipeline");
 	
-	ret = libgstc_pipeline_set_state_event_callback(handle, onStateChanged);
+	/* Re-synchronize the cached position with gstd every second */
+	cache = gstc_position_cache_new(handle, 1000);
+	process_error(!cache, "can't allocate position cache");
+
+	/* Only wake up for the pipeline's own transitions, merging the
+	 * NULL->READY->PAUSED->PLAYING bursts */
+	memset(&filter, 0, sizeof(filter));
+	filter.top_level_only = 1;
+	filter.coalesce_ms = 50;
+	ret = gstc_event_filter_set(handle, &filter, onPipelineStateChanged);
 	process_error(ret, "can't register callback handle");
 
 	ret = libgstc_pipeline_set_eos_event_callback(handle, onEoS);
 	process_error(ret, "can't register eos handle");
 
+	seeker = gstc_seeker_new(handle, fps_num, fps_den, gop_frames);
+	process_error(!seeker, "can't allocate pipeline seeker");
+
+	/* Armed by the state callback while the pipeline is playing */
+	if (watchdog_gap_ms) {
+		watchdog = gstc_watchdog_new(handle, n_watchdog_probes ? watchdog_probes : NULL,
+					     WATCHDOG_INTERVAL_MS, watchdog_gap_ms, onStall);
+		process_error(!watchdog, "can't start pipeline watchdog");
+	}
+
 	if (run_video_record) {
 		vdbg("Video record sequentially");
 		video_recording_glibc(handle);
@@ -666,6 +1020,9 @@ int main(int argc, char** argv)
 	process_user_input(handle);
 
 	dbg("Closing all pipelines");
+	gstc_watchdog_free(watchdog);
+	gstc_seeker_free(seeker);
+	gstc_position_cache_free(cache);
 	libgstc_fini();
 	
 	return 0;
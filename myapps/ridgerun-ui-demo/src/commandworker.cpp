@@ -0,0 +1,153 @@
+#include "commandworker.h"
+
+#include <QDebug>
+#include <QHash>
+#include <QMutexLocker>
+
+/* Commands QML can request and the arguments each of them needs. Commands
+ * taking a fixed first argument are listed with it. */
+static const struct {
+    const char *name;
+    CommandType type;
+    int args;
+} commandTable[] = {
+    { "config",          CommandConfig,        0 },
+    { "snapshot",        CommandSnapshot,      0 },
+    { "live_view start", CommandLiveViewStart, 0 },
+    { "live_view stop",  CommandLiveViewStop,  0 },
+    { "save_config",     CommandSaveConfig,    0 },
+    { "changeVolume",    CommandChangeVolume,  1 },
+};
+
+Command::Command() :
+    type(CommandUnknown)
+{
+}
+
+Command Command::parse(const QString &text){
+    static QHash<QString, int> registry;
+    QStringList parts = text.split(" ", QString::SkipEmptyParts);
+    Command command;
+    int entry = -1;
+
+    if (registry.isEmpty()){
+        for (unsigned int i = 0; i < sizeof(commandTable) / sizeof(commandTable[0]); i++)
+            registry.insert(commandTable[i].name, i);
+    }
+
+    if (parts.isEmpty())
+        return command;
+
+    //Longest match first, "live_view start" before "live_view"
+    if (parts.size() > 1)
+        entry = registry.value(parts.at(0) + " " + parts.at(1), -1);
+    if (entry >= 0)
+        parts.removeFirst();
+    else
+        entry = registry.value(parts.at(0), -1);
+
+    command.name = parts.takeFirst();
+    if (entry < 0 || parts.size() < commandTable[entry].args)
+        return command;
+
+    command.type = commandTable[entry].type;
+    command.name = commandTable[entry].name;
+    command.args = parts;
+
+    return command;
+}
+
+CommandWorker::CommandWorker(QObject *parent) :
+    QThread(parent),
+    stopping(false)
+{
+    qRegisterMetaType<Command>("Command");
+}
+
+void CommandWorker::enqueue(const Command &command){
+    QMutexLocker locker(&lock);
+
+    //A slider sends a burst of volume changes, only the last one matters
+    if (command.type == CommandChangeVolume){
+        for (int i = 0; i < queue.size(); i++){
+            if (queue[i].type == CommandChangeVolume){
+                queue[i] = command;
+                return;
+            }
+        }
+    }
+
+    queue.enqueue(command);
+    wake.wakeOne();
+}
+
+void CommandWorker::stop(){
+    QMutexLocker locker(&lock);
+
+    stopping = true;
+    wake.wakeOne();
+}
+
+void CommandWorker::run(){
+    Command command;
+    QString error;
+    bool ok;
+
+    forever {
+        {
+            QMutexLocker locker(&lock);
+            while (queue.isEmpty() && !stopping)
+                wake.wait(&lock);
+            if (stopping)
+                return;
+            command = queue.dequeue();
+        }
+
+        error.clear();
+        ok = execute(command, error);
+        emit finished(command, ok, error);
+    }
+}
+
+bool CommandWorker::execute(const Command &command, QString &error){
+
+    switch (command.type){
+    case CommandConfig:
+
+        //@TODO: Load settings here
+
+        return true;
+
+    case CommandSnapshot:
+
+        //@TODO: Screenshot-taking logic here
+
+        return true;
+
+    case CommandLiveViewStart:
+
+        //@TODO: Live view start logic here
+
+        return true;
+
+    case CommandLiveViewStop:
+
+        //@TODO: Live view stop logic here
+
+        return true;
+
+    case CommandSaveConfig:
+
+        //@TODO: Settings-saving logic here (I guess)
+
+        return true;
+
+    case CommandChangeVolume:
+        qDebug() << "Volume should now be: " + command.args.at(0);
+        return true;
+
+    default:
+        error = "Command not recognized: " + command.name;
+        return false;
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef COMMANDWORKER_H
+#define COMMANDWORKER_H
+
+#include <QMetaType>
+#include <QMutex>
+#include <QQueue>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+#include <QWaitCondition>
+
+enum CommandType {
+    CommandUnknown,
+    CommandConfig,
+    CommandSnapshot,
+    CommandLiveViewStart,
+    CommandLiveViewStop,
+    CommandSaveConfig,
+    CommandChangeVolume
+};
+
+/* A request from the UI, parsed once from the string QML sends */
+struct Command
+{
+    Command();
+
+    static Command parse(const QString &text);
+
+    CommandType type;
+    QString name;
+    QStringList args;
+};
+
+Q_DECLARE_METATYPE(Command)
+
+/*
+ * Runs camera and pipeline actions in order on its own thread so the GUI
+ * thread never waits on them. Each command is answered with finished(),
+ * connect to it queued to get the result back on the GUI thread.
+ */
+class CommandWorker : public QThread
+{
+    Q_OBJECT
+public:
+    explicit CommandWorker(QObject *parent = 0);
+
+    void enqueue(const Command &command);
+    void stop();
+
+signals:
+    void finished(Command command, bool ok, QString error);
+
+protected:
+    void run();
+
+private:
+    bool execute(const Command &command, QString &error);
+
+    QMutex lock;
+    QWaitCondition wake;
+    QQueue<Command> queue;
+    bool stopping;
+};
+
+#endif //COMMANDWORKER_H
@@ -2,6 +2,7 @@
 #include <QVariant>
 #include <QtDeclarative>
 #include "uihandler.h"
+#include "videosurface.h"
 
 #ifdef __ARMEL__
 #include <stdlib.h>
@@ -55,10 +56,18 @@ int main(int argc, char *argv[])
 {
     QApplication app(argc, argv);
 
+    //Native items used from QML:
+    qmlRegisterType<VideoSurface>("RidgeRun", 1, 0, "VideoSurface");
+
     //Bind QML file:
     QDeclarativeView view;
     view.setSource(QUrl("qrc:/main"));
 
+    //Repaint each changed item on its own instead of the rectangle
+    //bounding all of them, so live view frames and status bar updates
+    //don't drag each other into a full repaint
+    view.setViewportUpdateMode(QGraphicsView::MinimalViewportUpdate);
+
     //Obtain root element and logic-making things
     QObject *rootElement = (QObject*) view.rootObject();
 
@@ -1,6 +1,8 @@
 import QtQuick 1.0
+import RidgeRun 1.0
 
 Rectangle {
+    id: mainPane
     width: 488
     height: 438
     color: "#bbbbbb"
@@ -19,7 +21,13 @@ Rectangle {
         width: 488
         border.width: 1
         height: 438
-        color:"#ff00ff"
+
+        VideoSurface{
+            id: videoSurface
+            anchors.fill: parent
+            anchors.margins: 1
+            running: mainPane.state == "viewer"
+        }
 
         Loader{
             anchors.verticalCenter : parent.verticalCenter;
@@ -6,10 +6,14 @@ CONFIG += qdbus link_pkconfig debug
 
 # The .cpp file which was generated for your project. Feel free to hack it.
 SOURCES += main.cpp \
-    uihandler.cpp
+    uihandler.cpp \
+    videosurface.cpp \
+    commandworker.cpp
 
 HEADERS += \
-    uihandler.h
+    uihandler.h \
+    videosurface.h \
+    commandworker.h
 
 RESOURCES += \
     qmlresources.qrc
@@ -9,6 +9,12 @@
 
 using namespace std;
 
+//Commands that move the UI to another main state once they are done
+static bool changesState(CommandType type){
+    return type == CommandConfig || type == CommandLiveViewStart ||
+        type == CommandLiveViewStop;
+}
+
 UIHandler::UIHandler(QObject *rootElement)
 {
     this->rootElement = rootElement;
@@ -16,82 +22,113 @@ UIHandler::UIHandler(QObject *rootElement)
     QObject::connect((QObject*) rootElement, SIGNAL(actionRequested(QString)),(QObject*) this, SLOT(handle_actionRequested(QString)), Qt::DirectConnection);
     QObject::connect((QObject*) rootElement, SIGNAL(mainStateChanged(QString)),(QObject*) this, SLOT(handle_mainStateChanged(QString)), Qt::DirectConnection);
 
+    //Camera and pipeline actions run on the worker, results come back
+    //through the GUI thread event loop
+    worker = new CommandWorker(this);
+    QObject::connect(worker, SIGNAL(finished(Command,bool,QString)), this, SLOT(handle_commandFinished(Command,bool,QString)), Qt::QueuedConnection);
+    worker->start();
+
     state = "splash";
+    nextState = state;
+    pendingTransitions = 0;
 }
 
-void UIHandler::handle_actionRequested(QString command){
-
-    QStringList commParts = command.split(" ");
+UIHandler::~UIHandler()
+{
+    worker->stop();
+    worker->wait();
+}
 
-    //Handle enter setup request
-    if(commParts.at(0) == "config"){
-        if (state == "splash"){
+void UIHandler::handle_actionRequested(QString text){
 
-            //@TODO: Load settings here
+    Command command = Command::parse(text);
 
-            setMainState("config");
-        }
-        else if(state != "config"){
+    //Requests are checked against the state the UI will be in once the
+    //commands already queued are done
+    switch (command.type){
+    case CommandConfig:
+        if (nextState == "config")
+            return;
+        if (nextState != "splash"){
             showInfoMessage("Error: Can't enter setup when live view is active.");
+            return;
         }
-    }
-
+        nextState = "config";
+        break;
+
+    case CommandLiveViewStart:
+        if (nextState == "viewer")
+            return;
+        if (nextState != "splash"){
+            showInfoMessage("Error: Can't enter live view when setup is active.");
+            cancelViewerToggle();
+            return;
+        }
+        nextState = "viewer";
+        break;
 
-    //Handle snapshot request
-    else if(commParts.at(0) == "snapshot"){
+    case CommandLiveViewStop:
+        nextState = "splash";
+        break;
 
-        //@TODO: Screenshot-taking logic here
+    case CommandUnknown:
+        qDebug() << "Command not recognized:" << text;
+        return;
 
-        showInfoMessage("Snapshot Taken");
+    default:
+        break;
     }
 
-    //Handle live view request
-    else if(commParts.at(0) == "live_view"){
-
-        //@TODO: Live view start logic here
-
-        if(commParts.at(1) == "start"){
-            if (state == "splash"){
-                //Load settings
-                setMainState("viewer");
-            }
-            else if (state != "viewer"){
-                showInfoMessage("Error: Can't enter live view when setup is active.");
-                cancelViewerToggle();
-            }
-        }
-        else{
-
-            //@TODO: Live view stop logic here
-
-            setMainState("splash");
-        }
-    }
+    if (changesState(command.type))
+        pendingTransitions++;
+    worker->enqueue(command);
+}
 
-    //Handle save setup request
-    else if(commParts.at(0) == "save_config"){
+void UIHandler::handle_commandFinished(Command command, bool ok, QString error){
 
-        //@TODO: Settings-saving logic here (I guess)
+    if (changesState(command.type))
+        pendingTransitions--;
 
+    if (!ok){
+        showInfoMessage("Error: " + error);
+        if (command.type == CommandLiveViewStart)
+            cancelViewerToggle();
+        //Transitions still queued keep their target, the last one of them
+        //is what nextState already holds
+        if (!pendingTransitions)
+            nextState = state;
+        return;
     }
 
-    else if(commParts.at(0) == "changeVolume"){
-
-        QString msg = "Volume should now be: "+commParts.at(1);
-        qDebug()<< msg;
+    switch (command.type){
+    case CommandConfig:
+        setMainState("config");
+        break;
 
-    }
+    case CommandSnapshot:
+        showInfoMessage("Snapshot Taken");
+        break;
 
-    else{
+    case CommandLiveViewStart:
+        setMainState("viewer");
+        break;
 
-        qDebug("Command not recognized");
+    case CommandLiveViewStop:
+        setMainState("splash");
+        break;
 
+    default:
+        break;
     }
 }
 
 
 void UIHandler::handle_mainStateChanged(QString text){
     state = text;
+
+    //QML also changes state on its own, e.g. leaving setup
+    if (!pendingTransitions)
+        nextState = text;
 }
 
 void UIHandler::updateStatusBar(){
@@ -9,15 +9,21 @@
 #include <iostream>
 #include <fstream>
 
+#include "commandworker.h"
+
 class UIHandler : public QDeclarativeItem
 {
     Q_OBJECT
 public:
     explicit UIHandler(QObject *rootElement = 0);
+    ~UIHandler();
 
 private:
     QObject* rootElement;
     QString state;
+    QString nextState;
+    int pendingTransitions;
+    CommandWorker *worker;
 
 signals:
 
@@ -25,6 +31,7 @@ signals:
 public slots:
     void handle_actionRequested(QString command);
     void handle_mainStateChanged(QString text);
+    void handle_commandFinished(Command command, bool ok, QString error);
 
     void setMainState(QString text);
     void showInfoMessage(QString text);
@@ -0,0 +1,199 @@
+#include "videosurface.h"
+
+#include <QPainter>
+#include <QMutexLocker>
+
+#define TEST_PATTERN_INTERVAL 33
+
+VideoSurface::VideoSurface(QDeclarativeItem *parent) :
+    QDeclarativeItem(parent),
+    key(255, 0, 255),
+    active(false),
+    externalFrames(false),
+    testPatternEnabled(false),
+    testFrame(0),
+    fpsFrames(0),
+    fpsValue(0)
+{
+#ifdef __ARMEL__
+    //The color key set up by fb_init()
+    overlayEnabled = true;
+#else
+    overlayEnabled = false;
+#endif
+
+    setFlag(QGraphicsItem::ItemHasNoContents, false);
+
+    //Frames may come from a capture thread, paint them from the UI one
+    QObject::connect(this, SIGNAL(frameReady()), this, SLOT(showFrame()), Qt::QueuedConnection);
+    QObject::connect(&testPatternTimer, SIGNAL(timeout()), this, SLOT(generateTestFrame()));
+}
+
+void VideoSurface::paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
+                         QWidget *widget){
+    QRectF target = boundingRect();
+
+    Q_UNUSED(option);
+    Q_UNUSED(widget);
+
+    if (overlayEnabled || frame.isNull()){
+        painter->fillRect(target, key);
+        return;
+    }
+
+    if (frame.size() == target.size().toSize())
+        painter->drawImage(target.topLeft(), frame);
+    else
+        painter->drawImage(target, frame);
+}
+
+QPainterPath VideoSurface::opaqueArea() const{
+    QPainterPath path;
+
+    //Lets the view skip whatever is under the surface
+    path.addRect(boundingRect());
+    return path;
+}
+
+bool VideoSurface::overlay() const{
+    return overlayEnabled;
+}
+
+void VideoSurface::setOverlay(bool overlay){
+    if (overlay == overlayEnabled)
+        return;
+
+    overlayEnabled = overlay;
+    updateTestPattern();
+    update();
+    emit overlayChanged();
+}
+
+QColor VideoSurface::colorKey() const{
+    return key;
+}
+
+void VideoSurface::setColorKey(const QColor &color){
+    key = color;
+    update();
+}
+
+bool VideoSurface::running() const{
+    return active;
+}
+
+void VideoSurface::setRunning(bool running){
+    if (running == active)
+        return;
+
+    active = running;
+    fpsFrames = 0;
+    fpsClock.start();
+
+    if (!active){
+        //Don't leave the last frame of this run on screen, and let the
+        //next run fall back to the pattern if nothing feeds it
+        QMutexLocker locker(&frameLock);
+        frame = QImage();
+        pending = QImage();
+        externalFrames = false;
+    }
+
+    updateTestPattern();
+    update();
+    emit runningChanged();
+}
+
+bool VideoSurface::testPattern() const{
+    return testPatternEnabled;
+}
+
+void VideoSurface::setTestPattern(bool enabled){
+    if (enabled == testPatternEnabled)
+        return;
+
+    testPatternEnabled = enabled;
+    if (!enabled && !externalFrames){
+        QMutexLocker locker(&frameLock);
+        frame = QImage();
+        pending = QImage();
+    }
+
+    updateTestPattern();
+    update();
+}
+
+int VideoSurface::fps() const{
+    return fpsValue;
+}
+
+void VideoSurface::presentFrame(const QImage &image){
+    externalFrames = true;
+    queueFrame(image);
+}
+
+void VideoSurface::queueFrame(const QImage &image){
+    bool queued;
+
+    {
+        QMutexLocker locker(&frameLock);
+        queued = !pending.isNull();
+        pending = image;
+    }
+
+    //One notification per painted frame is enough
+    if (!queued)
+        emit frameReady();
+}
+
+void VideoSurface::showFrame(){
+    {
+        QMutexLocker locker(&frameLock);
+        frame = pending;
+        pending = QImage();
+    }
+
+    if (!active || overlayEnabled)
+        return;
+
+    //A real source took over
+    if (externalFrames && testPatternTimer.isActive())
+        testPatternTimer.stop();
+
+    update();
+
+    fpsFrames++;
+    if (fpsClock.elapsed() >= 1000){
+        fpsValue = fpsFrames * 1000 / fpsClock.restart();
+        fpsFrames = 0;
+        emit fpsChanged();
+    }
+}
+
+void VideoSurface::updateTestPattern(){
+    if (testPatternEnabled && active && !overlayEnabled && !externalFrames)
+        testPatternTimer.start(TEST_PATTERN_INTERVAL);
+    else
+        testPatternTimer.stop();
+}
+
+void VideoSurface::generateTestFrame(){
+    QSize size = boundingRect().size().toSize();
+    int bar;
+
+    if (size.isEmpty())
+        return;
+
+    //RGB16 like the OSD, so painting is a plain copy
+    QImage image(size, QImage::Format_RGB16);
+    image.fill(0);
+
+    QPainter painter(&image);
+    bar = size.width() / 8;
+    painter.fillRect((testFrame * 4) % (size.width() + bar) - bar, 0, bar,
+                     size.height(), Qt::white);
+    painter.end();
+
+    testFrame++;
+    queueFrame(image);
+}
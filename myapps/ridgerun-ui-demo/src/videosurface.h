@@ -0,0 +1,85 @@
+#ifndef VIDEOSURFACE_H
+#define VIDEOSURFACE_H
+
+#include <QDeclarativeItem>
+#include <QColor>
+#include <QImage>
+#include <QMutex>
+#include <QTime>
+#include <QTimer>
+
+/*
+ * Live view surface. With an overlay the video plane under the OSD shows
+ * the frames and the item only paints the color key, once; that is the
+ * board, where the camera keeps drawing into the plane as before.
+ * Without one the item paints the frames handed to presentFrame(), or a
+ * moving test pattern when testPattern is set and nothing else feeds
+ * it. Either way a new frame repaints the item alone, never the rest of
+ * the scene.
+ */
+class VideoSurface : public QDeclarativeItem
+{
+    Q_OBJECT
+    Q_PROPERTY(bool overlay READ overlay WRITE setOverlay NOTIFY overlayChanged)
+    Q_PROPERTY(QColor colorKey READ colorKey WRITE setColorKey)
+    Q_PROPERTY(bool running READ running WRITE setRunning NOTIFY runningChanged)
+    Q_PROPERTY(bool testPattern READ testPattern WRITE setTestPattern)
+    Q_PROPERTY(int fps READ fps NOTIFY fpsChanged)
+
+public:
+    explicit VideoSurface(QDeclarativeItem *parent = 0);
+
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
+               QWidget *widget);
+    QPainterPath opaqueArea() const;
+
+    bool overlay() const;
+    void setOverlay(bool overlay);
+    QColor colorKey() const;
+    void setColorKey(const QColor &color);
+    bool running() const;
+    void setRunning(bool running);
+    bool testPattern() const;
+    void setTestPattern(bool enabled);
+    int fps() const;
+
+signals:
+    void overlayChanged();
+    void runningChanged();
+    void fpsChanged();
+    void frameReady();
+
+public slots:
+    //Can be called from any thread, frames arriving faster than they are
+    //painted replace each other. Turns the test pattern off.
+    void presentFrame(const QImage &frame);
+
+private slots:
+    void showFrame();
+    void generateTestFrame();
+
+private:
+    void queueFrame(const QImage &image);
+    void updateTestPattern();
+
+    bool overlayEnabled;
+    QColor key;
+    bool active;
+    //Set by the first presentFrame(), stops the test pattern
+    volatile bool externalFrames;
+
+    QMutex frameLock;
+    QImage pending;
+    QImage frame;
+
+    //Stands in for the camera without an overlay, when asked to
+    bool testPatternEnabled;
+    QTimer testPatternTimer;
+    int testFrame;
+
+    QTime fpsClock;
+    int fpsFrames;
+    int fpsValue;
+};
+
+#endif //VIDEOSURFACE_H
@@ -0,0 +1,3 @@
+/* rraew.h includes the config.h of the application built against it.
+ * This application is not built with autotools and the library headers
+ * don't need any of its definitions. */
@@ -0,0 +1,348 @@
+/* librraew event driven AEW loop
+
+ * Copyright 2012 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <rraew.h>
+#include "rraew-stream.h"
+#include "rraew-sensor.h"
+
+/****************************************************************
+ * Constants
+ ****************************************************************/
+#define PROGNAME "rraew-stream"
+
+#define DEFAULT_WIDTH 1280
+#define DEFAULT_HEIGHT 720
+#define DEFAULT_SEGMENTATION 50
+
+#define TRACE_PATH "/tmp/rraew-stream-trace.txt"
+
+/***************************************************************************
+ * Debug Macros
+ ***************************************************************************/
+# define  prt(format, arg...) do { printf(PROGNAME " %s: " format "\n", __FUNCTION__, ##arg); } while (0);
+
+# define  dbg(format, arg...) if (debug_level > 0) \
+                do { printf(PROGNAME " %s: " format "\n", __FUNCTION__, ##arg); } while (0);
+
+/************************************************************************
+ * Private Data
+ ************************************************************************/
+
+static char *progname = NULL;
+
+/* values that can be set from the command line */
+static int debug_level = 0;
+static int run_seconds = 0;	/* 0 runs until interrupted */
+static char *record_path = NULL;
+static struct rraew_converge_config converge_config = RRAEW_CONVERGE_DEFAULTS;
+static struct rraew_awb_configuration awb_config = {AWB_GRAY_WORLD, GAIN_DIGITAL};
+static struct rraew_ae_configuration ae_config = {AE_EC, METER_AVERAGE, {0, 0, 1}, 50};
+static int histogram = 0;
+static struct rraew_meter_config meter_config = RRAEW_METER_DEFAULTS;
+static struct rraew_roi rois[RRAEW_METER_MAX_ROIS];
+static int n_rois = 0;
+static struct rraew_configuration aew_config = {DEFAULT_WIDTH, DEFAULT_HEIGHT, DEFAULT_SEGMENTATION};
+
+static volatile sig_atomic_t running = 1;
+static volatile sig_atomic_t dump_trace = 0;
+
+/****************************************************************
+ * interrupt
+ ****************************************************************/
+static void interrupt(int sig)
+{
+    running = 0;
+}
+
+/****************************************************************
+ * request_trace
+ ****************************************************************/
+static void request_trace(int sig)
+{
+    dump_trace = 1;
+}
+
+/****************************************************************
+ * write_trace
+ ****************************************************************/
+static void write_trace(struct rraew_stream *stream)
+{
+    FILE *file;
+    int ret;
+
+    file = fopen(TRACE_PATH, "w");
+    if (!file) {
+        printf("ERROR: can't open %s\n", TRACE_PATH);
+        return;
+    }
+    ret = rraew_stream_trace_dump(stream, file);
+    fclose(file);
+
+    if (ret)
+        printf("WARNING: no trace, build with USER_APPS_RRAEW_STREAM_TRACE\n");
+    else
+        prt("Trace written to %s", TRACE_PATH);
+}
+
+/****************************************************************
+ * Usage
+ ****************************************************************/
+static void show_usage(char *progname)
+{
+    fprintf(stderr, "\n%s [-h] [-d <debug lvl>] [-W <width>] [-H <height>] [-f <percent>] [-a <awb>] [-m <metering>] [-R <x,y,w,h[,weight]>] [-i <frames>] [-t <seconds>] [-r <file>]\n", progname);
+    fprintf(stderr, "   -h                     print usage information\n");
+    fprintf(stderr, "   -d <debug level>       set debug level 0-1, 1 prints the loop timing every second\n");
+    fprintf(stderr, "   -W <width>             captured image width, default %d\n", DEFAULT_WIDTH);
+    fprintf(stderr, "   -H <height>            captured image height, default %d\n", DEFAULT_HEIGHT);
+    fprintf(stderr, "   -f <percent>           statistics segmentation factor 10-100, default %d\n", DEFAULT_SEGMENTATION);
+    fprintf(stderr, "   -a <awb>               white balance: none, grayworld, whitepatch or whitepatch2\n");
+    fprintf(stderr, "   -m <metering>          exposure metering: none, partial, rect, average, segment or histogram\n");
+    fprintf(stderr, "   -R <x,y,w,h[,weight]>  region of interest for the histogram metering, in\n");
+    fprintf(stderr, "                          image pixels, default weight 4, up to %d\n", RRAEW_METER_MAX_ROIS);
+    fprintf(stderr, "   -i <frames>            once the scene is stable run the algorithms every <frames>,\n");
+    fprintf(stderr, "                          0 runs them on every frame, default %d\n", converge_config.idle_interval);
+    fprintf(stderr, "   -t <seconds>           stop after <seconds>, default runs until interrupted\n");
+    fprintf(stderr, "   -r <file>              record the statistics to <file> for rraew-sim\n");
+    fprintf(stderr, " \n");
+    fprintf(stderr, "The capture device must be streaming, for example with a GStreamer pipeline.\n");
+    fprintf(stderr, "SIGUSR1 writes the trace of the last iterations to %s.\n\n", TRACE_PATH);
+}
+
+/***************************************************************************
+ * parse_options
+ ***************************************************************************/
+static void parse_options(int argc, char *argv[])
+{
+    int opt;
+
+    /* for show_usage */
+    progname = argv[0];
+
+    while ((opt = getopt(argc, argv, "hd:W:H:f:a:i:m:t:r:R:")) != -1) {
+        switch (opt) {
+        case 'h':
+            show_usage(progname);
+            exit(0);
+            break;
+
+        case 'd':
+            debug_level = atoi(optarg);
+            break;
+
+        case 'W':
+            aew_config.width = atoi(optarg);
+            break;
+
+        case 'H':
+            aew_config.height = atoi(optarg);
+            break;
+
+        case 'f':
+            aew_config.segmentation_factor = atoi(optarg);
+            break;
+
+        case 'a':
+            if (!strcmp(optarg, "none"))
+                awb_config.algorithm = AWB_NONE;
+            else if (!strcmp(optarg, "grayworld"))
+                awb_config.algorithm = AWB_GRAY_WORLD;
+            else if (!strcmp(optarg, "whitepatch"))
+                awb_config.algorithm = AWB_WHITE_PATCH;
+            else if (!strcmp(optarg, "whitepatch2"))
+                awb_config.algorithm = AWB_WHITE_PATCH_2;
+            else {
+                show_usage(progname);
+                printf("ERROR: Unknown white balance algorithm '%s'\n", optarg);
+                exit(-1);
+            }
+            break;
+
+        case 'm':
+            if (!strcmp(optarg, "none"))
+                ae_config.algorithm = AE_NONE;
+            else if (!strcmp(optarg, "partial"))
+                ae_config.meter_type = METER_PARTIAL_AREA;
+            else if (!strcmp(optarg, "rect"))
+                ae_config.meter_type = METER_RECT_WEIGHTED;
+            else if (!strcmp(optarg, "average"))
+                ae_config.meter_type = METER_AVERAGE;
+            else if (!strcmp(optarg, "segment"))
+                ae_config.meter_type = METER_SEGMENT;
+            else if (!strcmp(optarg, "histogram"))
+                histogram = 1;
+            else {
+                show_usage(progname);
+                printf("ERROR: Unknown metering '%s'\n", optarg);
+                exit(-1);
+            }
+            break;
+
+        case 'i':
+            converge_config.idle_interval = atoi(optarg);
+            break;
+
+        case 't':
+            run_seconds = atoi(optarg);
+            break;
+
+        case 'r':
+            record_path = optarg;
+            break;
+
+        case 'R':
+            if (n_rois == RRAEW_METER_MAX_ROIS) {
+                printf("ERROR: at most %d regions of interest\n", RRAEW_METER_MAX_ROIS);
+                exit(-1);
+            }
+            rois[n_rois].weight = 4;
+            if (sscanf(optarg, "%d,%d,%d,%d,%d", &rois[n_rois].x, &rois[n_rois].y,
+                    &rois[n_rois].width, &rois[n_rois].height,
+                    &rois[n_rois].weight) < 4) {
+                show_usage(progname);
+                printf("ERROR: Bad region of interest '%s'\n", optarg);
+                exit(-1);
+            }
+            n_rois++;
+            break;
+
+        default: /* '?' */
+            show_usage(progname);
+            printf("ERROR: Unknown option '%c'\n", opt);
+            exit(-1);
+        }
+    }
+
+    if (optind < argc) {
+        show_usage(progname);
+        printf("ERROR: unexpected command line parameter: %s\n", argv[optind]);
+        exit(-1);
+    }
+}
+
+/****************************************************************
+ * main
+ ****************************************************************/
+int main(int argc, char **argv)
+{
+    struct rraew_sensor sensor;
+    struct rraew_interface interface = dm365_vpfe_interface;
+    struct rraew_file_descriptors fds;
+    struct rraew_stream_timing timing;
+    struct rraew_stream *stream;
+    struct rraew *aew;
+    FILE *record = NULL;
+    int elapsed = 0;
+
+    parse_options(argc, argv);
+
+    rraew_sensor_mt9p031(&sensor);
+
+    /* librraew opens the previewer, AEW and capture devices */
+    memset(&fds, 0, sizeof(fds));
+    fds.previewer_fd = fds.aew_fd = fds.capture_fd = -1;
+    fds.owner_previewer_fd = fds.owner_aew_fd = fds.owner_capture_fd = 1;
+
+    aew = rraew_create(&awb_config, &ae_config, &aew_config, &sensor,
+        &interface, &fds);
+    if (!aew) {
+        printf("ERROR: can't create the AEW handler\n");
+        exit(255);
+    }
+
+    if (record_path) {
+        record = fopen(record_path, "wb");
+        if (!record) {
+            printf("ERROR: can't open %s\n", record_path);
+            rraew_destroy(aew);
+            exit(255);
+        }
+    }
+
+    stream = rraew_stream_new(aew);
+    if (stream) {
+        rraew_stream_set_convergence(stream,
+            converge_config.idle_interval > 0 ? &converge_config : NULL);
+        if (record && rraew_stream_record(stream, record))
+            printf("WARNING: can't record to %s\n", record_path);
+        if (histogram) {
+            rraew_stream_set_histogram(stream, &meter_config);
+            rraew_stream_set_rois(stream, rois, n_rois);
+        }
+    }
+    if (!stream || rraew_stream_start(stream)) {
+        printf("ERROR: can't start the statistics stream\n");
+        rraew_stream_free(stream);
+        rraew_destroy(aew);
+        if (record)
+            fclose(record);
+        exit(255);
+    }
+
+    signal(SIGINT, interrupt);
+    signal(SIGTERM, interrupt);
+    signal(SIGUSR1, request_trace);
+
+    while (running && (!run_seconds || elapsed < run_seconds)) {
+        /* A signal cuts the sleep short, only count whole seconds */
+        if (!sleep(1))
+            elapsed++;
+
+        if (dump_trace) {
+            dump_trace = 0;
+            write_trace(stream);
+        }
+
+        rraew_stream_timing(stream, &timing);
+        dbg("%u frames, %u runs, %u dropped, %u skipped%s, reduce %u us, run %u us (avg %u, max %u), latency %u us (max %u), %u writes (%u avoided)",
+            timing.frames, timing.runs, timing.dropped, timing.skipped,
+            timing.converged ? " (converged)" : "", timing.reduce_us,
+            timing.run_us, timing.run_avg_us, timing.run_max_us,
+            timing.latency_us, timing.latency_max_us, timing.writes,
+            timing.writes_skipped);
+    }
+
+    rraew_stream_timing(stream, &timing);
+    prt("%u frames in %d s, %u dropped, %u skipped while converged, average run %u us, worst latency %u us, %u of %u writes avoided",
+        timing.frames, elapsed, timing.dropped, timing.skipped,
+        timing.run_avg_us, timing.latency_max_us, timing.writes_skipped,
+        timing.writes + timing.writes_skipped);
+
+    rraew_stream_free(stream);
+    rraew_destroy(aew);
+    if (record)
+        fclose(record);
+
+    return 0;
+}
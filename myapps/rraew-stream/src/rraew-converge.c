@@ -0,0 +1,175 @@
+/* librraew event driven AEW loop
+
+ * Copyright 2012 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#include <string.h>
+#include "rraew-converge.h"
+
+/****************************************************************
+ * converge_moved
+ *
+ * True when any channel moved more than permille from the reference
+ ****************************************************************/
+static int converge_moved(const __u32 *now, const __u32 *reference,
+    int permille)
+{
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        unsigned long long diff = now[i] > reference[i] ?
+            now[i] - reference[i] : reference[i] - now[i];
+
+        if (diff * 1000 > (unsigned long long)reference[i] * permille)
+            return 1;
+    }
+
+    return 0;
+}
+
+/****************************************************************
+ * converge_subsample
+ ****************************************************************/
+static void converge_subsample(const struct rraew_converge *converge,
+    const struct rraew_stat *stats, int windows, __u32 *sums)
+{
+    int i;
+
+    sums[0] = sums[1] = sums[2] = 0;
+    for (i = 0; i < windows; i += converge->config.subsample) {
+        sums[0] += stats[i].r_avg;
+        sums[1] += stats[i].g_avg;
+        sums[2] += stats[i].b_avg;
+    }
+}
+
+/****************************************************************
+ * rraew_converge_init
+ ****************************************************************/
+void rraew_converge_init(struct rraew_converge *converge,
+    const struct rraew_converge_config *config)
+{
+    struct rraew_converge_config defaults = RRAEW_CONVERGE_DEFAULTS;
+
+    memset(converge, 0, sizeof(struct rraew_converge));
+    converge->config = config ? *config : defaults;
+    if (converge->config.subsample < 1)
+        converge->config.subsample = 1;
+}
+
+/****************************************************************
+ * rraew_converge_reset
+ ****************************************************************/
+void rraew_converge_reset(struct rraew_converge *converge)
+{
+    converge->converged = 0;
+    converge->settled = 0;
+    converge->idle = 0;
+}
+
+/****************************************************************
+ * rraew_converge_update
+ ****************************************************************/
+void rraew_converge_update(struct rraew_converge *converge,
+    const struct rraew_stats_summary *summary,
+    const struct rraew_stat *stats, int windows)
+{
+    __u32 now[3];
+
+    now[0] = summary->r_sum;
+    now[1] = summary->g_sum;
+    now[2] = summary->b_sum;
+
+    if (converge_moved(now, converge->last, converge->config.enter_permille))
+        converge->settled = 0;
+    else if (converge->settled < converge->config.settle_frames)
+        converge->settled++;
+    memcpy(converge->last, now, sizeof(now));
+
+    if (!converge->converged &&
+        converge->settled >= converge->config.settle_frames) {
+        converge->converged = 1;
+        converge->idle = 0;
+        converge_subsample(converge, stats, windows, converge->reference);
+    }
+}
+
+/****************************************************************
+ * rraew_converge_due
+ ****************************************************************/
+int rraew_converge_due(struct rraew_converge *converge,
+    const struct rraew_stat *stats, int windows)
+{
+    __u32 now[3];
+
+    if (!converge->converged || converge->config.idle_interval <= 1)
+        return 1;
+
+    converge_subsample(converge, stats, windows, now);
+    if (converge_moved(now, converge->reference,
+            converge->config.exit_permille)) {
+        rraew_converge_reset(converge);
+        return 1;
+    }
+
+    if (++converge->idle < converge->config.idle_interval)
+        return 0;
+
+    converge->idle = 0;
+    return 1;
+}
+
+/****************************************************************
+ * rraew_quantize_gain
+ ****************************************************************/
+__u32 rraew_quantize_gain(__u32 q10_gain, const struct rraew_gain_step *steps,
+    int n_steps, float min_gain)
+{
+    __u32 start = min_gain * 1024;
+    __u32 end;
+    __u32 step;
+    int i;
+
+    if (!steps || n_steps <= 0)
+        return q10_gain;
+    if (q10_gain <= start)
+        return start;
+
+    for (i = 0; i < n_steps; i++) {
+        end = steps[i].range_end * 1024;
+        if (q10_gain <= end || i == n_steps - 1)
+            break;
+        start = end;
+    }
+
+    step = (steps[i].step_n * 1024) / steps[i].step_d;
+    if (!step)
+        return q10_gain;
+
+    q10_gain = start + (q10_gain - start + step / 2) / step * step;
+    return q10_gain > end ? end : q10_gain;
+}
@@ -0,0 +1,94 @@
+/* librraew event driven AEW loop
+
+ * Copyright 2012 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#ifndef RRAEW_CONVERGE_H
+#define RRAEW_CONVERGE_H
+
+#include <rraew.h>
+#include "rraew-stats.h"
+
+/****************************************************************
+ * Convergence detection
+ *
+ * A scene is converged after settle_frames consecutive frames whose
+ * channel sums moved less than enter_permille from the previous one.
+ * From then on only one window in subsample is summed per frame and
+ * compared with the sums taken at convergence; the scene is active
+ * again when any channel moves more than exit_permille. Having the
+ * exit threshold above the enter one keeps noise from toggling it.
+ ****************************************************************/
+
+struct rraew_converge_config {
+    int enter_permille;
+    int exit_permille;
+    int settle_frames;
+    /** Run the algorithms one frame in idle_interval once converged */
+    int idle_interval;
+    int subsample;
+};
+
+#define RRAEW_CONVERGE_DEFAULTS {20, 60, 8, 15, 8}
+
+struct rraew_converge {
+    struct rraew_converge_config config;
+    int converged;
+    int settled;
+    int idle;
+    __u32 last[3];
+    __u32 reference[3];
+};
+
+void rraew_converge_init(struct rraew_converge *converge,
+    const struct rraew_converge_config *config);
+void rraew_converge_reset(struct rraew_converge *converge);
+
+/** Feeds a frame the algorithms ran on */
+void rraew_converge_update(struct rraew_converge *converge,
+    const struct rraew_stats_summary *summary,
+    const struct rraew_stat *stats, int windows);
+
+/**
+ * Decides if the algorithms have to run on a frame. Always true while
+ * the scene is active, once converged it is true one frame in
+ * idle_interval or when the subsampled windows changed.
+ */
+int rraew_converge_due(struct rraew_converge *converge,
+    const struct rraew_stat *stats, int windows);
+
+/****************************************************************
+ * Gain quantization
+ *
+ * Rounds a Q10 gain to the closest value the device can take
+ * according to its gain step ranges, so writes that would program
+ * the same register value can be skipped.
+ ****************************************************************/
+__u32 rraew_quantize_gain(__u32 q10_gain, const struct rraew_gain_step *steps,
+    int n_steps, float min_gain);
+
+#endif /* RRAEW_CONVERGE_H */
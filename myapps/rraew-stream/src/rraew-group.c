@@ -0,0 +1,524 @@
+/* librraew event driven AEW loop
+
+ * Copyright 2012 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include "rraew-group.h"
+#include "rraew-converge.h"
+
+/* Wake up from poll() this often to notice a stop request */
+#define GROUP_POLL_MS 100
+
+struct group_member {
+    struct rraew_group *group;
+    struct rraew *aew;
+    int leader;
+
+    /* What the group replaced in the aew handler */
+    RraewReadStatData read_stat_data;
+    void *read_stat_data_target;
+    struct rraew_stat *aew_stats;
+    __u32 (*metering) (struct rraew *aew);
+    RraewSetGain sensor_set_gain;
+    void *sensor_set_gain_target;
+    RraewSetExposure set_exposure;
+    void *set_exposure_target;
+    RraewSetGain digital_set_gain;
+    void *digital_set_gain_target;
+
+    struct rraew_stat *stats;
+    int fresh;
+};
+
+struct rraew_group {
+    unsigned int link;
+    struct group_member members[RRAEW_GROUP_MAX];
+    int n_members;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    int started;
+    int running;
+
+    struct rraew_group_timing timing;
+};
+
+/* Group whose thread is calling rraew_run() on this thread */
+static __thread struct rraew_group *group_current;
+
+/****************************************************************
+ * group_now_us
+ ****************************************************************/
+static long long group_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/****************************************************************
+ * group_read_stat_data
+ *
+ * Installed as the interface's read_stat_data, the group thread
+ * already read the frame
+ ****************************************************************/
+static int group_read_stat_data(int *aew_fd, char *owner_aew_fd,
+    struct rraew_stat_config *stat_config, struct rraew_colorpattern colorptn,
+    struct rraew_stat *stats, void *data)
+{
+    return 0;
+}
+
+/****************************************************************
+ * group_metering
+ *
+ * Leader's metering with linked exposure: the mean of what each
+ * member's own metering gives on its latest frame
+ ****************************************************************/
+static __u32 group_metering(struct rraew *aew)
+{
+    struct rraew_group *group = group_current;
+    unsigned long long sum = 0;
+    int n = 0;
+    int i;
+
+    for (i = 0; i < group->n_members; i++) {
+        struct group_member *member = &group->members[i];
+
+        /* Members without a frame yet would pull the mean down */
+        if (!group->timing.frames[i] || !member->metering)
+            continue;
+        sum += member->metering(member->aew);
+        n++;
+    }
+
+    return n ? sum / n : 0;
+}
+
+/****************************************************************
+ * group_gain
+ *
+ * Fits a gain of the leader in the range and the steps of a member's
+ * device
+ ****************************************************************/
+static __u32 group_gain(__u32 q10_gain, float min_gain, float max_gain,
+    const struct rraew_gain_step *steps, int n_steps)
+{
+    __u32 min = min_gain * 1024;
+    __u32 max = max_gain * 1024;
+
+    if (max && q10_gain > max)
+        q10_gain = max;
+    if (q10_gain < min)
+        q10_gain = min;
+
+    return rraew_quantize_gain(q10_gain, steps, n_steps, min_gain);
+}
+
+/****************************************************************
+ * group_sensor_set_gain
+ ****************************************************************/
+static int group_sensor_set_gain(int *fd, char *owner_fd, __u32 q10r_gain,
+    __u32 q10g_gain, __u32 q10b_gain, void *data)
+{
+    struct group_member *member = data;
+    struct rraew_group *group = member->group;
+    int ret = 0;
+    int i;
+
+    if (!member->leader)
+        return 0;
+
+    for (i = 0; i < group->n_members; i++) {
+        struct group_member *to = &group->members[i];
+        struct rraew_file_descriptors *fds = &to->aew->file_descriptors;
+        struct rraew_sensor *sensor = &to->aew->sensor;
+
+        if (!to->sensor_set_gain)
+            continue;
+        if (to->sensor_set_gain(&fds->capture_fd, &fds->owner_capture_fd,
+                group_gain(q10r_gain, sensor->min_gain, sensor->max_gain,
+                    sensor->gain_steps, sensor->n_gain_steps),
+                group_gain(q10g_gain, sensor->min_gain, sensor->max_gain,
+                    sensor->gain_steps, sensor->n_gain_steps),
+                group_gain(q10b_gain, sensor->min_gain, sensor->max_gain,
+                    sensor->gain_steps, sensor->n_gain_steps),
+                to->sensor_set_gain_target))
+            ret = -1;
+    }
+
+    return ret;
+}
+
+/****************************************************************
+ * group_set_exposure
+ ****************************************************************/
+static int group_set_exposure(int *capture_fd, char *owner_capture_fd,
+    __u32 exp_time, void *data)
+{
+    struct group_member *member = data;
+    struct rraew_group *group = member->group;
+    int ret = 0;
+    int i;
+
+    if (!member->leader)
+        return 0;
+
+    for (i = 0; i < group->n_members; i++) {
+        struct group_member *to = &group->members[i];
+        struct rraew_file_descriptors *fds = &to->aew->file_descriptors;
+        struct rraew_sensor *sensor = &to->aew->sensor;
+        __u32 exposure = exp_time;
+
+        if (!to->set_exposure)
+            continue;
+        if (sensor->max_exp_time > 0 && exposure > (__u32)sensor->max_exp_time)
+            exposure = sensor->max_exp_time;
+        if (sensor->min_exp_time > 0 && exposure < (__u32)sensor->min_exp_time)
+            exposure = sensor->min_exp_time;
+        if (to->set_exposure(&fds->capture_fd, &fds->owner_capture_fd,
+                exposure, to->set_exposure_target))
+            ret = -1;
+    }
+
+    return ret;
+}
+
+/****************************************************************
+ * group_digital_set_gain
+ ****************************************************************/
+static int group_digital_set_gain(int *fd, char *owner_fd, __u32 q10r_gain,
+    __u32 q10g_gain, __u32 q10b_gain, void *data)
+{
+    struct group_member *member = data;
+    struct rraew_group *group = member->group;
+    int ret = 0;
+    int i;
+
+    if (!member->leader)
+        return 0;
+
+    for (i = 0; i < group->n_members; i++) {
+        struct group_member *to = &group->members[i];
+        struct rraew_file_descriptors *fds = &to->aew->file_descriptors;
+        struct rraew_interface *interface = &to->aew->interface;
+
+        if (!to->digital_set_gain)
+            continue;
+        if (to->digital_set_gain(&fds->previewer_fd, &fds->owner_previewer_fd,
+                group_gain(q10r_gain, interface->min_gain, interface->max_gain,
+                    interface->gain_steps, interface->n_gain_steps),
+                group_gain(q10g_gain, interface->min_gain, interface->max_gain,
+                    interface->gain_steps, interface->n_gain_steps),
+                group_gain(q10b_gain, interface->min_gain, interface->max_gain,
+                    interface->gain_steps, interface->n_gain_steps),
+                to->digital_set_gain_target))
+            ret = -1;
+    }
+
+    return ret;
+}
+
+/****************************************************************
+ * group_read
+ *
+ * Reads the frame of every member whose device is readable
+ ****************************************************************/
+static int group_read(struct rraew_group *group, struct pollfd *pfds)
+{
+    int got = 0;
+    int i;
+
+    for (i = 0; i < group->n_members; i++) {
+        struct group_member *member = &group->members[i];
+        struct rraew *aew = member->aew;
+
+        if (!(pfds[i].revents & POLLIN))
+            continue;
+        pfds[i].events = 0;
+
+        if (member->read_stat_data(&aew->file_descriptors.aew_fd,
+                &aew->file_descriptors.owner_aew_fd, &aew->stat_config,
+                aew->sensor.colorptn, member->stats,
+                member->read_stat_data_target) < 0)
+            continue;
+
+        member->fresh = 1;
+        got++;
+    }
+
+    return got;
+}
+
+/****************************************************************
+ * group_thread
+ ****************************************************************/
+static void *group_thread(void *data)
+{
+    struct rraew_group *group = data;
+    struct pollfd pfds[RRAEW_GROUP_MAX];
+    long long start;
+    long long run_us;
+    int waiting;
+    int got;
+    int ret;
+    int i;
+
+    group_current = group;
+
+    pthread_mutex_lock(&group->mutex);
+    while (group->running) {
+        pthread_mutex_unlock(&group->mutex);
+
+        for (i = 0; i < group->n_members; i++) {
+            pfds[i].fd = group->members[i].aew->file_descriptors.aew_fd;
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+        }
+
+        ret = poll(pfds, group->n_members, GROUP_POLL_MS);
+        if (ret < 0 && errno != EINTR) {
+            fprintf(stderr, "rraew-group: can't poll AEW devices: %s\n",
+                strerror(errno));
+            pthread_mutex_lock(&group->mutex);
+            break;
+        }
+
+        got = 0;
+        if (ret > 0) {
+            got = group_read(group, pfds);
+
+            /* Give the other sensors' frames a moment to land */
+            waiting = group->n_members - ret;
+            if (waiting > 0 && poll(pfds, group->n_members,
+                    RRAEW_GROUP_GATHER_MS) > 0)
+                got += group_read(group, pfds);
+        }
+
+        start = group_now_us();
+        for (i = 0; i < group->n_members; i++) {
+            struct group_member *member = &group->members[i];
+
+            if (!member->fresh)
+                continue;
+            member->fresh = 0;
+            member->aew->stats = member->stats;
+
+            pthread_mutex_lock(&group->mutex);
+            group->timing.frames[i]++;
+            pthread_mutex_unlock(&group->mutex);
+
+            if (rraew_run(member->aew))
+                fprintf(stderr, "rraew-group: AEW run of sensor %d failed\n", i);
+
+            pthread_mutex_lock(&group->mutex);
+            group->timing.runs[i]++;
+            pthread_mutex_unlock(&group->mutex);
+        }
+        run_us = group_now_us() - start;
+
+        pthread_mutex_lock(&group->mutex);
+        if (got) {
+            group->timing.wakeups++;
+            group->timing.run_us = run_us;
+            if (run_us > group->timing.run_max_us)
+                group->timing.run_max_us = run_us;
+        }
+    }
+
+    group->running = 0;
+    pthread_mutex_unlock(&group->mutex);
+
+    return NULL;
+}
+
+/****************************************************************
+ * rraew_group_new
+ ****************************************************************/
+struct rraew_group *rraew_group_new(unsigned int link)
+{
+    struct rraew_group *group;
+
+    group = calloc(1, sizeof(struct rraew_group));
+    if (!group)
+        return NULL;
+
+    group->link = link;
+    pthread_mutex_init(&group->mutex, NULL);
+
+    return group;
+}
+
+/****************************************************************
+ * rraew_group_free
+ *
+ * Gives the statistics read and the writes back to the handlers
+ ****************************************************************/
+void rraew_group_free(struct rraew_group *group)
+{
+    int i;
+
+    if (!group)
+        return;
+
+    rraew_group_stop(group);
+
+    for (i = 0; i < group->n_members; i++) {
+        struct group_member *member = &group->members[i];
+        struct rraew *aew = member->aew;
+
+        aew->interface.read_stat_data = member->read_stat_data;
+        aew->interface.read_stat_data_target = member->read_stat_data_target;
+        aew->stats = member->aew_stats;
+        aew->ae.metering = member->metering;
+        aew->sensor.set_gain = member->sensor_set_gain;
+        aew->sensor.set_gain_target = member->sensor_set_gain_target;
+        aew->sensor.set_exposure = member->set_exposure;
+        aew->sensor.set_exposure_target = member->set_exposure_target;
+        aew->interface.set_gain = member->digital_set_gain;
+        aew->interface.set_gain_target = member->digital_set_gain_target;
+        free(member->stats);
+    }
+
+    pthread_mutex_destroy(&group->mutex);
+    free(group);
+}
+
+/****************************************************************
+ * rraew_group_add
+ ****************************************************************/
+int rraew_group_add(struct rraew_group *group, struct rraew *aew)
+{
+    struct group_member *member;
+    int windows;
+
+    if (group->started || group->n_members == RRAEW_GROUP_MAX)
+        return -1;
+
+    member = &group->members[group->n_members];
+    memset(member, 0, sizeof(*member));
+
+    /* Sized for the largest grid so the windowing can change later */
+    windows = aew->interface.stat_max_h_window *
+        aew->interface.stat_max_v_window;
+    if (windows < aew->stat_config.hz_cnt * aew->stat_config.vt_cnt)
+        windows = aew->stat_config.hz_cnt * aew->stat_config.vt_cnt;
+
+    member->stats = calloc(windows, sizeof(struct rraew_stat));
+    if (!member->stats)
+        return -1;
+
+    member->group = group;
+    member->aew = aew;
+    member->leader = (group->n_members == 0);
+
+    member->read_stat_data = aew->interface.read_stat_data;
+    member->read_stat_data_target = aew->interface.read_stat_data_target;
+    member->aew_stats = aew->stats;
+    member->metering = aew->ae.metering;
+    member->sensor_set_gain = aew->sensor.set_gain;
+    member->sensor_set_gain_target = aew->sensor.set_gain_target;
+    member->set_exposure = aew->sensor.set_exposure;
+    member->set_exposure_target = aew->sensor.set_exposure_target;
+    member->digital_set_gain = aew->interface.set_gain;
+    member->digital_set_gain_target = aew->interface.set_gain_target;
+
+    aew->interface.read_stat_data = group_read_stat_data;
+    aew->interface.read_stat_data_target = member;
+
+    if (group->link & RRAEW_GROUP_LINK_EXPOSURE) {
+        if (member->leader && aew->ae.metering)
+            aew->ae.metering = group_metering;
+        aew->sensor.set_gain = group_sensor_set_gain;
+        aew->sensor.set_gain_target = member;
+        aew->sensor.set_exposure = group_set_exposure;
+        aew->sensor.set_exposure_target = member;
+    }
+    if (group->link & RRAEW_GROUP_LINK_WB) {
+        aew->interface.set_gain = group_digital_set_gain;
+        aew->interface.set_gain_target = member;
+    }
+
+    group->n_members++;
+
+    return 0;
+}
+
+/****************************************************************
+ * rraew_group_start
+ ****************************************************************/
+int rraew_group_start(struct rraew_group *group)
+{
+    if (group->started)
+        return 0;
+    if (!group->n_members)
+        return -1;
+
+    group->running = 1;
+    if (pthread_create(&group->thread, NULL, group_thread, group)) {
+        group->running = 0;
+        return -1;
+    }
+    group->started = 1;
+
+    return 0;
+}
+
+/****************************************************************
+ * rraew_group_stop
+ ****************************************************************/
+void rraew_group_stop(struct rraew_group *group)
+{
+    if (!group->started)
+        return;
+
+    pthread_mutex_lock(&group->mutex);
+    group->running = 0;
+    pthread_mutex_unlock(&group->mutex);
+
+    pthread_join(group->thread, NULL);
+    group->started = 0;
+}
+
+/****************************************************************
+ * rraew_group_timing
+ ****************************************************************/
+void rraew_group_timing(struct rraew_group *group,
+    struct rraew_group_timing *timing)
+{
+    pthread_mutex_lock(&group->mutex);
+    *timing = group->timing;
+    pthread_mutex_unlock(&group->mutex);
+}
@@ -0,0 +1,97 @@
+/* librraew event driven AEW loop
+
+ * Copyright 2012 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#ifndef RRAEW_GROUP_H
+#define RRAEW_GROUP_H
+
+#include <rraew.h>
+
+/****************************************************************
+ * Sensor groups
+ *
+ * Rigs with several sensors run one aew handler per sensor. Used on
+ * their own, or with one stream each, every handler wakes up for its
+ * own frames and runs its own exposure loop, so the views drift
+ * apart photometrically. A group schedules all of them on a single
+ * thread:
+ *
+ *  - one poll() waits on every AEW device; after the first frame
+ *    arrives the others get RRAEW_GROUP_GATHER_MS to follow, so
+ *    frame synchronized sensors are read in a single wakeup
+ *  - rraew_run() is called for each handler that got a frame
+ *
+ * The first handler added is the leader. With RRAEW_GROUP_LINK_EXPOSURE
+ * the leader meters on the mean luma of all the sensors and its
+ * sensor gain and exposure writes go to every sensor; the writes of
+ * the other handlers are dropped. RRAEW_GROUP_LINK_WB does the same
+ * with the digital white balance gains. Each write goes through the
+ * member's own sensor or interface callbacks, with the Q10 gains
+ * clamped to that member's min_gain and max_gain and rounded to its
+ * gain steps, and the exposure clamped to its min_exp_time and
+ * max_exp_time. The exposure itself isn't converted, so every sensor
+ * must take it in the same unit.
+ ****************************************************************/
+
+#define RRAEW_GROUP_MAX 4
+#define RRAEW_GROUP_GATHER_MS 4
+
+#define RRAEW_GROUP_LINK_EXPOSURE (1 << 0)
+#define RRAEW_GROUP_LINK_WB (1 << 1)
+
+struct rraew_group;
+
+struct rraew_group_timing {
+    /** Times the group thread woke up with at least one frame */
+    unsigned int wakeups;
+    /** Frames read and algorithm iterations, per member */
+    unsigned int frames[RRAEW_GROUP_MAX];
+    unsigned int runs[RRAEW_GROUP_MAX];
+    /** Time spent in rraew_run() for all members, last and worst */
+    unsigned int run_us;
+    unsigned int run_max_us;
+};
+
+struct rraew_group *rraew_group_new(unsigned int link);
+void rraew_group_free(struct rraew_group *group);
+
+/**
+ * Takes over the statistics read and, when linked, the writes of an
+ * aew handler created with rraew_create(). Only while the group is
+ * stopped. The handler must not be run by anyone else or be part of
+ * a stream until the group is freed.
+ */
+int rraew_group_add(struct rraew_group *group, struct rraew *aew);
+
+int rraew_group_start(struct rraew_group *group);
+void rraew_group_stop(struct rraew_group *group);
+
+void rraew_group_timing(struct rraew_group *group,
+    struct rraew_group_timing *timing);
+
+#endif /* RRAEW_GROUP_H */
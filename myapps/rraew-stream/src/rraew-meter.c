@@ -0,0 +1,184 @@
+/* librraew event driven AEW loop
+
+ * Copyright 2012 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rraew-meter.h"
+
+/* The last bin holds the windows at or near the clip level */
+#define METER_CLIP_BIN (RRAEW_METER_BINS - 1)
+
+/****************************************************************
+ * meter_to_luma
+ *
+ * From window R + G + B to the librraew metering scale, the mean
+ * of (R + G + B) / 6 with the averages shifted by 6
+ ****************************************************************/
+static __u32 meter_to_luma(unsigned long long rgb)
+{
+    return rgb * 64 / 6;
+}
+
+/****************************************************************
+ * rraew_meter_init
+ ****************************************************************/
+int rraew_meter_init(struct rraew_meter *meter, int max_windows,
+    const struct rraew_meter_config *config)
+{
+    struct rraew_meter_config defaults = RRAEW_METER_DEFAULTS;
+
+    memset(meter, 0, sizeof(*meter));
+    meter->config = config ? *config : defaults;
+    if (meter->config.percentile_permille < 0 ||
+        meter->config.percentile_permille > 1000)
+        meter->config.percentile_permille = defaults.percentile_permille;
+    if (meter->config.background_weight < 0)
+        meter->config.background_weight = defaults.background_weight;
+
+    meter->weights = calloc(max_windows, sizeof(__u16));
+    if (!meter->weights)
+        return -1;
+    meter->windows = max_windows;
+    rraew_meter_set_rois(meter, NULL, 0, 0, 0, 0, 0);
+
+    return 0;
+}
+
+/****************************************************************
+ * rraew_meter_cleanup
+ ****************************************************************/
+void rraew_meter_cleanup(struct rraew_meter *meter)
+{
+    free(meter->weights);
+    meter->weights = NULL;
+}
+
+/****************************************************************
+ * rraew_meter_set_rois
+ ****************************************************************/
+void rraew_meter_set_rois(struct rraew_meter *meter,
+    const struct rraew_roi *rois, int n_rois, int width, int height,
+    int hz_cnt, int vt_cnt)
+{
+    int background = meter->config.background_weight;
+    int weighted = 0;
+    int i;
+
+    /* Without regions the background is all there is */
+    if (n_rois <= 0 || width <= 0 || height <= 0 || hz_cnt <= 0 ||
+        vt_cnt <= 0) {
+        for (i = 0; i < meter->windows; i++)
+            meter->weights[i] = 1;
+        return;
+    }
+
+    for (i = 0; i < meter->windows; i++)
+        meter->weights[i] = background;
+
+    for (i = 0; i < n_rois && i < RRAEW_METER_MAX_ROIS; i++) {
+        const struct rraew_roi *roi = &rois[i];
+        int col0 = roi->x * hz_cnt / width;
+        int col1 = ((roi->x + roi->width) * hz_cnt + width - 1) / width;
+        int row0 = roi->y * vt_cnt / height;
+        int row1 = ((roi->y + roi->height) * vt_cnt + height - 1) / height;
+        int row;
+        int col;
+
+        if (col0 < 0)
+            col0 = 0;
+        if (row0 < 0)
+            row0 = 0;
+        if (col1 > hz_cnt)
+            col1 = hz_cnt;
+        if (row1 > vt_cnt)
+            row1 = vt_cnt;
+
+        for (row = row0; row < row1; row++) {
+            for (col = col0; col < col1; col++) {
+                int w = row * hz_cnt + col;
+
+                if (w < meter->windows && roi->weight > meter->weights[w])
+                    meter->weights[w] = roi->weight;
+            }
+        }
+    }
+
+    /* Regions off the grid with no background, meter everything */
+    for (i = 0; i < meter->windows; i++)
+        weighted |= meter->weights[i];
+    if (!weighted)
+        rraew_meter_set_rois(meter, NULL, 0, 0, 0, 0, 0);
+}
+
+/****************************************************************
+ * rraew_meter_histogram
+ ****************************************************************/
+__u32 rraew_meter_histogram(struct rraew_meter *meter,
+    const struct rraew_stats_soa *soa)
+{
+    const __u16 *__restrict__ r = soa->r_avg;
+    const __u16 *__restrict__ g = soa->g_avg;
+    const __u16 *__restrict__ b = soa->b_avg;
+    const __u16 *__restrict__ weights = meter->weights;
+    __u32 *__restrict__ histogram = meter->histogram;
+    int windows = soa->windows < meter->windows ? soa->windows : meter->windows;
+    unsigned long long total = 0;
+    unsigned long long rank;
+    unsigned long long below = 0;
+    int bin;
+    int i;
+
+    memset(histogram, 0, sizeof(meter->histogram));
+    for (i = 0; i < windows; i++) {
+        bin = (r[i] + g[i] + b[i]) >> RRAEW_METER_BIN_SHIFT;
+        if (bin > METER_CLIP_BIN)
+            bin = METER_CLIP_BIN;
+        histogram[bin] += weights[i];
+        total += weights[i];
+    }
+    if (!total)
+        return 0;
+
+    rank = total * meter->config.percentile_permille / 1000;
+    if (rank >= total)
+        rank = total - 1;
+    for (bin = 0; bin < METER_CLIP_BIN; bin++) {
+        if (below + histogram[bin] > rank) {
+            /* Interpolated inside the bin, keeps the result linear */
+            return meter_to_luma(((unsigned long long)bin << RRAEW_METER_BIN_SHIFT) +
+                ((rank - below) << RRAEW_METER_BIN_SHIFT) / histogram[bin]);
+        }
+        below += histogram[bin];
+    }
+
+    /* The percentile is clipped, the more weight above it the further
+     * the true level is past the top of the range */
+    return meter_to_luma(((unsigned long long)RRAEW_METER_BINS << RRAEW_METER_BIN_SHIFT) *
+        histogram[METER_CLIP_BIN] / (total - rank));
+}
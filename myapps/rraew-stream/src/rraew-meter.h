@@ -0,0 +1,104 @@
+/* librraew event driven AEW loop
+
+ * Copyright 2012 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#ifndef RRAEW_METER_H
+#define RRAEW_METER_H
+
+#include <rraew.h>
+#include "rraew-stats.h"
+
+/****************************************************************
+ * Histogram metering
+ *
+ * The librraew metering modes average the windows, so a bright
+ * background pulls a backlit subject into the shadows, and clipped
+ * windows hide how far the exposure is off. This mode drops every
+ * window's luma in a weighted histogram, one pass over the columns
+ * the reader already transposed, and meters on a percentile of it:
+ *
+ *  - below the clip level the percentile scales with the exposure
+ *    like the average does, so the auto exposure step lands on the
+ *    target instead of creeping towards it
+ *  - when the percentile falls among clipped windows the luma is
+ *    extrapolated from the clipped weight, so overexposed frames
+ *    step down in proportion instead of by a fixed amount
+ *
+ * Regions of interest, for example from a face or motion detector,
+ * weigh their windows above the background. They are given in
+ * captured image pixels and may change every frame.
+ ****************************************************************/
+
+/* Window luma is R + G + B of the averages, up to 3 * 1023 */
+#define RRAEW_METER_BIN_SHIFT 6
+#define RRAEW_METER_BINS 48
+#define RRAEW_METER_MAX_ROIS 8
+
+struct rraew_roi {
+    int x;
+    int y;
+    int width;
+    int height;
+    /** Weight of the windows it covers, the background weighs 1 */
+    int weight;
+};
+
+struct rraew_meter_config {
+    /** Percentile of the weighted histogram metered, 500 is the median */
+    int percentile_permille;
+    /** Background weight, 0 meters on the regions of interest only */
+    int background_weight;
+};
+
+#define RRAEW_METER_DEFAULTS {500, 1}
+
+struct rraew_meter {
+    struct rraew_meter_config config;
+    int windows;
+    __u16 *weights;
+    __u32 histogram[RRAEW_METER_BINS];
+};
+
+int rraew_meter_init(struct rraew_meter *meter, int max_windows,
+    const struct rraew_meter_config *config);
+void rraew_meter_cleanup(struct rraew_meter *meter);
+
+/**
+ * Maps the regions of interest to the window grid of a width by
+ * height image. Windows covered by several regions take the highest
+ * weight; with no regions every window weighs the same.
+ */
+void rraew_meter_set_rois(struct rraew_meter *meter,
+    const struct rraew_roi *rois, int n_rois, int width, int height,
+    int hz_cnt, int vt_cnt);
+
+/** Frame luma on the scale the auto exposure expects */
+__u32 rraew_meter_histogram(struct rraew_meter *meter,
+    const struct rraew_stats_soa *soa);
+
+#endif /* RRAEW_METER_H */
@@ -0,0 +1,145 @@
+/* librraew event driven AEW loop
+
+ * Copyright 2012 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+#include "rraew-sensor.h"
+
+/* Gain units of the V4L2 control, in Q10 */
+#define SENSOR_GAIN_SHIFT 7
+
+static struct rraew_gain_step mt9p031_gain_steps[] = {
+    {4.0, 1, 8},
+    {8.0, 1, 4},
+    {128.0, 1, 1},
+};
+
+/****************************************************************
+ * sensor_set_ctrl
+ ****************************************************************/
+static int sensor_set_ctrl(int fd, __u32 id, __s32 value)
+{
+    struct v4l2_control ctrl;
+
+    if (fd < 0)
+        return -1;
+
+    ctrl.id = id;
+    ctrl.value = value;
+    return ioctl(fd, VIDIOC_S_CTRL, &ctrl) < 0 ? -1 : 0;
+}
+
+/****************************************************************
+ * sensor_get_ctrl
+ ****************************************************************/
+static int sensor_get_ctrl(int fd, __u32 id, __s32 *value)
+{
+    struct v4l2_control ctrl;
+
+    if (fd < 0)
+        return -1;
+
+    ctrl.id = id;
+    if (ioctl(fd, VIDIOC_G_CTRL, &ctrl) < 0)
+        return -1;
+    *value = ctrl.value;
+    return 0;
+}
+
+/****************************************************************
+ * mt9p031_set_gain
+ *
+ * The sensor has a single analog gain, the green one is used
+ ****************************************************************/
+static int mt9p031_set_gain(int *fd, char *owner_fd, __u32 q10r_gain,
+    __u32 q10g_gain, __u32 q10b_gain, void *data)
+{
+    return sensor_set_ctrl(*fd, V4L2_CID_GAIN, q10g_gain >> SENSOR_GAIN_SHIFT);
+}
+
+/****************************************************************
+ * mt9p031_get_gain
+ ****************************************************************/
+static int mt9p031_get_gain(int *fd, char *owner_fd, __u32 *q10r_gain,
+    __u32 *q10g_gain, __u32 *q10b_gain, void *data)
+{
+    __s32 value;
+
+    if (sensor_get_ctrl(*fd, V4L2_CID_GAIN, &value))
+        return -1;
+
+    *q10r_gain = *q10g_gain = *q10b_gain = value << SENSOR_GAIN_SHIFT;
+    return 0;
+}
+
+/****************************************************************
+ * mt9p031_set_exposure
+ ****************************************************************/
+static int mt9p031_set_exposure(int *capture_fd, char *owner_capture_fd,
+    __u32 exp_time, void *data)
+{
+    return sensor_set_ctrl(*capture_fd, V4L2_CID_EXPOSURE, exp_time);
+}
+
+/****************************************************************
+ * mt9p031_get_exposure
+ ****************************************************************/
+static int mt9p031_get_exposure(int *capture_fd, char *owner_capture_fd,
+    __u32 *exp_time, void *data)
+{
+    __s32 value;
+
+    if (sensor_get_ctrl(*capture_fd, V4L2_CID_EXPOSURE, &value))
+        return -1;
+
+    *exp_time = value;
+    return 0;
+}
+
+/****************************************************************
+ * rraew_sensor_mt9p031
+ ****************************************************************/
+void rraew_sensor_mt9p031(struct rraew_sensor *sensor)
+{
+    memset(sensor, 0, sizeof(struct rraew_sensor));
+
+    sensor->colorptn = colorptn_GrRBGb;
+    sensor->min_exp_time = 100;
+    sensor->max_exp_time = 33333;
+    sensor->min_gain = 1.0;
+    sensor->max_gain = 8.0;
+    sensor->n_gain_steps = sizeof(mt9p031_gain_steps) /
+        sizeof(mt9p031_gain_steps[0]);
+    sensor->gain_steps = mt9p031_gain_steps;
+    sensor->set_gain = mt9p031_set_gain;
+    sensor->get_gain = mt9p031_get_gain;
+    sensor->set_exposure = mt9p031_set_exposure;
+    sensor->get_exposure = mt9p031_get_exposure;
+}
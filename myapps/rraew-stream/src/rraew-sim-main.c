@@ -0,0 +1,742 @@
+/* librraew event driven AEW loop
+
+ * Copyright 2012 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <rraew.h>
+#include "rraew-group.h"
+#include "rraew-sim.h"
+#include "rraew-sensor.h"
+#include "rraew-stats.h"
+#include "rraew-meter.h"
+#include "rraew-stream.h"
+
+/****************************************************************
+ * Constants
+ ****************************************************************/
+#define PROGNAME "rraew-sim"
+
+#define DEFAULT_WIDTH 1280
+#define DEFAULT_HEIGHT 720
+#define DEFAULT_SEGMENTATION 50
+#define DEFAULT_FRAMES 300
+
+/* Exposure times gain steadier than this for SETTLE_FRAMES frames
+ * is converged, whatever the scene does */
+#define SETTLE_PERMILLE 30
+#define SETTLE_FRAMES 8
+
+/* Longest a sensor group or a stream may take to run one frame */
+#define GROUP_FRAME_TIMEOUT_MS 1000
+
+/* Each sensor of a group after the first sees the scene this much
+ * darker, as the sensors of one rig never quite match */
+#define GROUP_SENSITIVITY_STEP_PCT 10
+
+/***************************************************************************
+ * Debug Macros
+ ***************************************************************************/
+# define  prt(format, arg...) do { printf(PROGNAME " %s: " format "\n", __FUNCTION__, ##arg); } while (0);
+
+# define  dbg(format, arg...) if (debug_level > 0) \
+                do { printf(PROGNAME " %s: " format "\n", __FUNCTION__, ##arg); } while (0);
+
+/************************************************************************
+ * Private Data
+ ************************************************************************/
+
+static char *progname = NULL;
+
+/* values that can be set from the command line */
+static int debug_level = 0;
+static char *recording_path = NULL;
+static char *raw_path = NULL;
+static int frames = DEFAULT_FRAMES;
+static int max_converge_frames = 0;	/* 0 doesn't check */
+static int max_ripple_pct = 0;	/* 0 doesn't check */
+static struct rraew_sim_config sim_config = RRAEW_SIM_DEFAULTS;
+static struct rraew_awb_configuration awb_config = {AWB_GRAY_WORLD, GAIN_DIGITAL};
+static struct rraew_ae_configuration ae_config = {AE_EC, METER_AVERAGE, {0, 0, 1}, 50};
+static int histogram = 0;
+static struct rraew_meter_config meter_config = RRAEW_METER_DEFAULTS;
+static struct rraew_roi rois[RRAEW_METER_MAX_ROIS];
+static int n_rois = 0;
+static struct rraew_configuration aew_config = {DEFAULT_WIDTH, DEFAULT_HEIGHT, DEFAULT_SEGMENTATION};
+static int sensors = 1;
+static int reconfigure_frame = -1;	/* -1 runs without a stream */
+static int reconfigure_segmentation = 0;
+
+/* Simulated sensors. In a group each one gets its frames through a
+ * pipe standing for its AEW device, so the group thread polls them as
+ * it would the real devices. */
+struct sim_member {
+    struct rraew_sim *sim;
+    struct rraew *aew;
+    int pipe[2];
+    RraewReadStatData read_stat_data;
+    void *read_stat_data_target;
+};
+
+static struct sim_member members[RRAEW_GROUP_MAX];
+
+/****************************************************************
+ * Usage
+ ****************************************************************/
+static void show_usage(char *progname)
+{
+    fprintf(stderr, "\n%s [-h] [-d <debug lvl>] (-T <recording> | -B <raw> -W <width> -H <height> [-p <pattern>]) [-n <frames>] [-l <frames>] [-N <noise>] [-e <us>] [-f <percent>] [-a <awb>] [-m <metering>] [-R <x,y,w,h[,weight]>] [-c <frames>] [-o <percent>] [-s <sensors>] [-F <frame>:<percent>]\n", progname);
+    fprintf(stderr, "   -h                     print usage information\n");
+    fprintf(stderr, "   -d <debug level>       set debug level 0-1, 1 prints every frame\n");
+    fprintf(stderr, "   -T <recording>         replay statistics recorded with rraew-stream -r\n");
+    fprintf(stderr, "   -B <raw>               compute the statistics from raw Bayer frames,\n");
+    fprintf(stderr, "                          16 bit little endian samples holding 10 bit values\n");
+    fprintf(stderr, "   -W <width>             raw frame and captured image width, default %d\n", DEFAULT_WIDTH);
+    fprintf(stderr, "   -H <height>            raw frame and captured image height, default %d\n", DEFAULT_HEIGHT);
+    fprintf(stderr, "   -p <pattern>           raw Bayer order: GrRBGb, BGbGrR, RGrGbB or GbBRGr, default GrRBGb\n");
+    fprintf(stderr, "   -e <us>                exposure the raw frames were taken with, default %d\n", sim_config.exposure);
+    fprintf(stderr, "   -n <frames>            frames to simulate, default %d\n", DEFAULT_FRAMES);
+    fprintf(stderr, "   -l <frames>            sensor write latency, default %d\n", sim_config.latency);
+    fprintf(stderr, "   -N <noise>             peak noise added to the window averages, default %d\n", sim_config.noise);
+    fprintf(stderr, "   -f <percent>           statistics segmentation factor 10-100, default %d\n", DEFAULT_SEGMENTATION);
+    fprintf(stderr, "   -a <awb>               white balance: none, grayworld, whitepatch or whitepatch2\n");
+    fprintf(stderr, "   -m <metering>          exposure metering: none, partial, rect, average, segment or histogram\n");
+    fprintf(stderr, "   -R <x,y,w,h[,weight]>  region of interest for the histogram metering, in\n");
+    fprintf(stderr, "                          image pixels, default weight 4, up to %d\n", RRAEW_METER_MAX_ROIS);
+    fprintf(stderr, "   -c <frames>            fail unless converged within <frames>\n");
+    fprintf(stderr, "   -o <percent>           fail if the converged luma ripples more than <percent>\n");
+    fprintf(stderr, "   -s <sensors>           run up to %d sensors on the scene as a group with linked\n", RRAEW_GROUP_MAX);
+    fprintf(stderr, "                          exposure and white balance, each one %d%% less sensitive\n", GROUP_SENSITIVITY_STEP_PCT);
+    fprintf(stderr, "                          than the previous, the limits apply to the leader\n");
+    fprintf(stderr, "   -F <frame>:<percent>   run a single sensor through rraew-stream and change\n");
+    fprintf(stderr, "                          the segmentation factor before <frame>\n");
+    fprintf(stderr, " \n");
+    fprintf(stderr, "The last line printed holds the results as key=value pairs. The exit\n");
+    fprintf(stderr, "status is 1 when a -c or -o limit is exceeded, when the sensors of a\n");
+    fprintf(stderr, "group end up with different exposures, or when the stream didn't\n");
+    fprintf(stderr, "change to the -F segmentation factor.\n\n");
+}
+
+/***************************************************************************
+ * parse_options
+ ***************************************************************************/
+static void parse_options(int argc, char *argv[])
+{
+    int opt;
+
+    /* for show_usage */
+    progname = argv[0];
+
+    while ((opt = getopt(argc, argv, "hd:T:B:W:H:p:e:n:l:N:f:a:m:c:o:R:s:F:")) != -1) {
+        switch (opt) {
+        case 'h':
+            show_usage(progname);
+            exit(0);
+            break;
+
+        case 'd':
+            debug_level = atoi(optarg);
+            break;
+
+        case 'T':
+            recording_path = optarg;
+            break;
+
+        case 'B':
+            raw_path = optarg;
+            break;
+
+        case 'W':
+            aew_config.width = atoi(optarg);
+            break;
+
+        case 'H':
+            aew_config.height = atoi(optarg);
+            break;
+
+        case 'p':
+            if (!strcmp(optarg, "GrRBGb"))
+                sim_config.colorptn = colorptn_GrRBGb;
+            else if (!strcmp(optarg, "BGbGrR"))
+                sim_config.colorptn = colorptn_BGbGrR;
+            else if (!strcmp(optarg, "RGrGbB"))
+                sim_config.colorptn = colorptn_RGrGbB;
+            else if (!strcmp(optarg, "GbBRGr"))
+                sim_config.colorptn = colorptn_GbBRGr;
+            else {
+                show_usage(progname);
+                printf("ERROR: Unknown Bayer pattern '%s'\n", optarg);
+                exit(-1);
+            }
+            break;
+
+        case 'e':
+            sim_config.exposure = atoi(optarg);
+            break;
+
+        case 'n':
+            frames = atoi(optarg);
+            break;
+
+        case 'l':
+            sim_config.latency = atoi(optarg);
+            break;
+
+        case 'N':
+            sim_config.noise = atoi(optarg);
+            break;
+
+        case 'f':
+            aew_config.segmentation_factor = atoi(optarg);
+            break;
+
+        case 'a':
+            if (!strcmp(optarg, "none"))
+                awb_config.algorithm = AWB_NONE;
+            else if (!strcmp(optarg, "grayworld"))
+                awb_config.algorithm = AWB_GRAY_WORLD;
+            else if (!strcmp(optarg, "whitepatch"))
+                awb_config.algorithm = AWB_WHITE_PATCH;
+            else if (!strcmp(optarg, "whitepatch2"))
+                awb_config.algorithm = AWB_WHITE_PATCH_2;
+            else {
+                show_usage(progname);
+                printf("ERROR: Unknown white balance algorithm '%s'\n", optarg);
+                exit(-1);
+            }
+            break;
+
+        case 'm':
+            if (!strcmp(optarg, "none"))
+                ae_config.algorithm = AE_NONE;
+            else if (!strcmp(optarg, "partial"))
+                ae_config.meter_type = METER_PARTIAL_AREA;
+            else if (!strcmp(optarg, "rect"))
+                ae_config.meter_type = METER_RECT_WEIGHTED;
+            else if (!strcmp(optarg, "average"))
+                ae_config.meter_type = METER_AVERAGE;
+            else if (!strcmp(optarg, "segment"))
+                ae_config.meter_type = METER_SEGMENT;
+            else if (!strcmp(optarg, "histogram"))
+                histogram = 1;
+            else {
+                show_usage(progname);
+                printf("ERROR: Unknown metering '%s'\n", optarg);
+                exit(-1);
+            }
+            break;
+
+        case 'c':
+            max_converge_frames = atoi(optarg);
+            break;
+
+        case 'o':
+            max_ripple_pct = atoi(optarg);
+            break;
+
+        case 's':
+            sensors = atoi(optarg);
+            if (sensors < 1 || sensors > RRAEW_GROUP_MAX) {
+                show_usage(progname);
+                printf("ERROR: between 1 and %d sensors\n", RRAEW_GROUP_MAX);
+                exit(-1);
+            }
+            break;
+
+        case 'R':
+            if (n_rois == RRAEW_METER_MAX_ROIS) {
+                printf("ERROR: at most %d regions of interest\n", RRAEW_METER_MAX_ROIS);
+                exit(-1);
+            }
+            rois[n_rois].weight = 4;
+            if (sscanf(optarg, "%d,%d,%d,%d,%d", &rois[n_rois].x, &rois[n_rois].y,
+                    &rois[n_rois].width, &rois[n_rois].height,
+                    &rois[n_rois].weight) < 4) {
+                show_usage(progname);
+                printf("ERROR: Bad region of interest '%s'\n", optarg);
+                exit(-1);
+            }
+            n_rois++;
+            break;
+
+        case 'F':
+            if (sscanf(optarg, "%d:%d", &reconfigure_frame,
+                    &reconfigure_segmentation) != 2 || reconfigure_frame < 0 ||
+                reconfigure_segmentation < 10 || reconfigure_segmentation > 100) {
+                show_usage(progname);
+                printf("ERROR: Invalid segmentation change '%s'\n", optarg);
+                exit(-1);
+            }
+            break;
+
+        default: /* '?' */
+            show_usage(progname);
+            printf("ERROR: Unknown option '%c'\n", opt);
+            exit(-1);
+        }
+    }
+
+    if (optind < argc) {
+        show_usage(progname);
+        printf("ERROR: unexpected command line parameter: %s\n", argv[optind]);
+        exit(-1);
+    }
+
+    if (!recording_path == !raw_path || frames <= 0) {
+        show_usage(progname);
+        printf("ERROR: give either a recording or a raw frame file\n");
+        exit(-1);
+    }
+
+    /* The histogram metering keeps one state, for one sensor */
+    if (sensors > 1 && histogram) {
+        show_usage(progname);
+        printf("ERROR: histogram metering only runs on a single sensor\n");
+        exit(-1);
+    }
+
+    /* rraew-stream takes over one handler, groups have their own thread */
+    if (sensors > 1 && reconfigure_frame >= 0) {
+        show_usage(progname);
+        printf("ERROR: a segmentation change only runs on a single sensor\n");
+        exit(-1);
+    }
+}
+
+/* Histogram metering state, rraew-stream keeps it per stream */
+static struct rraew_stats_soa *soa = NULL;
+static struct rraew_meter meter;
+
+/****************************************************************
+ * histogram_metering
+ *
+ * Installed as the auto exposure metering with -m histogram. Runs
+ * inside rraew_run() so its cost is part of the reported run time.
+ ****************************************************************/
+static __u32 histogram_metering(struct rraew *aew)
+{
+    rraew_stats_soa_load(soa, aew->stats,
+        aew->stat_config.hz_cnt * aew->stat_config.vt_cnt);
+    return rraew_meter_histogram(&meter, soa);
+}
+
+/****************************************************************
+ * cpu_us
+ *
+ * CPU time of this thread, so the figures don't depend on the
+ * load of the machine running the benchmark
+ ****************************************************************/
+static long long cpu_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/****************************************************************
+ * member_read_stat_data
+ *
+ * Read callback of a group member, takes the frame token off the
+ * pipe and renders the frame
+ ****************************************************************/
+static int member_read_stat_data(int *aew_fd, char *owner_aew_fd,
+    struct rraew_stat_config *stat_config, struct rraew_colorpattern colorptn,
+    struct rraew_stat *stats, void *data)
+{
+    struct sim_member *member = data;
+    char token;
+
+    if (read(member->pipe[0], &token, 1) != 1)
+        return -1;
+
+    return member->read_stat_data(aew_fd, owner_aew_fd, stat_config,
+        colorptn, stats, member->read_stat_data_target);
+}
+
+/****************************************************************
+ * member_open
+ *
+ * Opens the scene for one sensor and creates its aew handler. Group
+ * members and streamed sensors read their frames through a pipe.
+ ****************************************************************/
+static int member_open(struct sim_member *member, int index, int piped)
+{
+    struct rraew_sensor sensor;
+    struct rraew_interface interface = dm365_vpfe_interface;
+    struct rraew_file_descriptors fds;
+    struct rraew_sim_config config = sim_config;
+
+    /* The scene is referred to a longer exposure on a less sensitive sensor */
+    config.exposure += config.exposure * index * GROUP_SENSITIVITY_STEP_PCT / 100;
+
+    member->pipe[0] = member->pipe[1] = -1;
+    if (recording_path)
+        member->sim = rraew_sim_open_recording(recording_path, &config);
+    else
+        member->sim = rraew_sim_open_raw(raw_path, &config);
+    if (!member->sim) {
+        printf("ERROR: can't open %s\n", recording_path ? recording_path : raw_path);
+        return -1;
+    }
+
+    /* Same limits and steps as on the board, devices simulated */
+    rraew_sensor_mt9p031(&sensor);
+    rraew_sim_sensor(member->sim, &sensor);
+    rraew_sim_interface(member->sim, &interface);
+
+    /* Every sensor starts on the same exposure */
+    if (index)
+        sensor.set_exposure(NULL, NULL, sim_config.exposure,
+            sensor.set_exposure_target);
+
+    memset(&fds, 0, sizeof(fds));
+    fds.previewer_fd = fds.aew_fd = fds.capture_fd = -1;
+
+    if (piped) {
+        if (pipe(member->pipe)) {
+            printf("ERROR: can't create the frame pipe\n");
+            return -1;
+        }
+        fds.aew_fd = member->pipe[0];
+        member->read_stat_data = interface.read_stat_data;
+        member->read_stat_data_target = interface.read_stat_data_target;
+        interface.read_stat_data = member_read_stat_data;
+        interface.read_stat_data_target = member;
+    }
+
+    member->aew = rraew_create(&awb_config, &ae_config, &aew_config, &sensor,
+        &interface, &fds);
+    if (!member->aew) {
+        printf("ERROR: can't create the AEW handler\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/****************************************************************
+ * member_close
+ ****************************************************************/
+static void member_close(struct sim_member *member)
+{
+    if (member->aew)
+        rraew_destroy(member->aew);
+    if (member->sim)
+        rraew_sim_free(member->sim);
+    if (member->pipe[0] >= 0) {
+        close(member->pipe[0]);
+        close(member->pipe[1]);
+    }
+}
+
+/****************************************************************
+ * group_frame
+ *
+ * Hands one frame to every sensor of the group and waits until the
+ * group thread ran all of them. Returns the time the group spent in
+ * rraew_run(), wall clock since it runs on its own thread.
+ ****************************************************************/
+static int group_frame(struct rraew_group *group, int frame, long long *run_us)
+{
+    struct rraew_group_timing timing;
+    int waited_ms = 0;
+    int done;
+    int i;
+
+    for (i = 0; i < sensors; i++) {
+        if (write(members[i].pipe[1], "f", 1) != 1)
+            return -1;
+    }
+
+    for (;;) {
+        rraew_group_timing(group, &timing);
+        for (done = 0, i = 0; i < sensors; i++)
+            done += (timing.runs[i] > (unsigned int)frame);
+        if (done == sensors)
+            break;
+        if (waited_ms++ == GROUP_FRAME_TIMEOUT_MS)
+            return -1;
+        poll(NULL, 0, 1);
+    }
+
+    *run_us = timing.run_us;
+    return 0;
+}
+
+/****************************************************************
+ * stream_frame
+ *
+ * Hands one frame to the stream and waits until its runner ran the
+ * algorithms on it, returning the time they took
+ ****************************************************************/
+static int stream_frame(struct rraew_stream *stream, int frame,
+    long long *run_us)
+{
+    struct rraew_stream_timing timing;
+    int waited_ms = 0;
+
+    if (write(members[0].pipe[1], "f", 1) != 1)
+        return -1;
+
+    for (;;) {
+        rraew_stream_timing(stream, &timing);
+        if (timing.runs > (unsigned int)frame)
+            break;
+        if (waited_ms++ == GROUP_FRAME_TIMEOUT_MS)
+            return -1;
+        poll(NULL, 0, 1);
+    }
+
+    *run_us = timing.run_us;
+    return 0;
+}
+
+/****************************************************************
+ * main
+ ****************************************************************/
+int main(int argc, char **argv)
+{
+    struct rraew_sim_state state;
+    struct rraew_sim *sim;
+    struct rraew *aew;
+    struct rraew_group *group = NULL;
+    struct rraew_stream *stream = NULL;
+    long long start;
+    long long run_us;
+    long long run_total_us = 0;
+    long long run_max_us = 0;
+    long long luma_sum = 0;
+    unsigned long long level;
+    unsigned long long last_level = 0;
+    __u32 luma_min = ~0u;
+    __u32 luma_max = 0;
+    __u32 exposure_min = ~0u;
+    __u32 exposure_max = 0;
+    int converged_at = -1;
+    int steady = 0;
+    int direction = 0;
+    int reversals = 0;
+    int settled = 0;
+    int ripple_pct = 0;
+    int failed = 0;
+    int frame;
+    int i;
+
+    parse_options(argc, argv);
+
+    sim_config.width = aew_config.width;
+    sim_config.height = aew_config.height;
+    for (i = 0; i < sensors; i++) {
+        if (member_open(&members[i], i, sensors > 1 || reconfigure_frame >= 0)) {
+            while (i >= 0)
+                member_close(&members[i--]);
+            exit(255);
+        }
+    }
+
+    /* The first sensor is the group leader, the results are its own */
+    sim = members[0].sim;
+    aew = members[0].aew;
+
+    if (reconfigure_frame >= 0) {
+        stream = rraew_stream_new(aew);
+        if (!stream || rraew_stream_start(stream)) {
+            printf("ERROR: can't set up the statistics stream\n");
+            exit(255);
+        }
+        if (histogram) {
+            rraew_stream_set_histogram(stream, &meter_config);
+            rraew_stream_set_rois(stream, rois, n_rois);
+        }
+    } else if (histogram) {
+        int windows = aew->stat_config.hz_cnt * aew->stat_config.vt_cnt;
+
+        soa = rraew_stats_soa_new(windows);
+        if (!soa || rraew_meter_init(&meter, windows, &meter_config)) {
+            printf("ERROR: can't set up the histogram metering\n");
+            exit(255);
+        }
+        rraew_meter_set_rois(&meter, rois, n_rois, aew_config.width,
+            aew_config.height, aew->stat_config.hz_cnt, aew->stat_config.vt_cnt);
+        aew->ae.metering = histogram_metering;
+    }
+
+    if (sensors > 1) {
+        group = rraew_group_new(RRAEW_GROUP_LINK_EXPOSURE | RRAEW_GROUP_LINK_WB);
+        for (i = 0; group && i < sensors; i++) {
+            if (rraew_group_add(group, members[i].aew))
+                break;
+        }
+        if (!group || i < sensors || rraew_group_start(group)) {
+            printf("ERROR: can't set up the sensor group\n");
+            exit(255);
+        }
+    }
+
+    for (frame = 0; frame < frames; frame++) {
+        /* Between two frames, as a control thread would */
+        if (stream && frame == reconfigure_frame &&
+            rraew_stream_reconfigure(stream, NULL, reconfigure_segmentation)) {
+            printf("ERROR: can't change the segmentation on frame %d\n", frame);
+            failed = 1;
+            break;
+        }
+
+        if (stream) {
+            if (stream_frame(stream, frame, &run_us)) {
+                printf("ERROR: the stream didn't run frame %d\n", frame);
+                failed = 1;
+                break;
+            }
+        } else if (group) {
+            if (group_frame(group, frame, &run_us)) {
+                printf("ERROR: the sensor group didn't run frame %d\n", frame);
+                failed = 1;
+                break;
+            }
+        } else {
+            start = cpu_us();
+            if (rraew_run(aew)) {
+                printf("ERROR: rraew_run failed on frame %d\n", frame);
+                failed = 1;
+                break;
+            }
+            run_us = cpu_us() - start;
+        }
+        run_total_us += run_us;
+        if (run_us > run_max_us)
+            run_max_us = run_us;
+
+        rraew_sim_state(sim, &state);
+        dbg("frame %u: exposure %u us, gain %u/%u/%u, luma %u, run %lld us",
+            state.frame, state.exposure, state.gain[0], state.gain[1],
+            state.gain[2], state.luma, run_us);
+
+        /* Converged at the first frame of a steady stretch */
+        level = (unsigned long long)state.exposure * state.gain[1];
+        if (converged_at < 0) {
+            if (last_level && (level > last_level ? level - last_level :
+                last_level - level) * 1000 <= last_level * SETTLE_PERMILLE)
+                steady++;
+            else
+                steady = 0;
+            if (steady == SETTLE_FRAMES)
+                converged_at = frame - SETTLE_FRAMES;
+        }
+
+        if (converged_at < 0) {
+            last_level = level;
+            continue;
+        }
+
+        /* Ripple of the luma and hunting of the exposure afterwards */
+        if (state.luma < luma_min)
+            luma_min = state.luma;
+        if (state.luma > luma_max)
+            luma_max = state.luma;
+        luma_sum += state.luma;
+        settled++;
+
+        if (level != last_level) {
+            if (direction && (level > last_level) != (direction > 0))
+                reversals++;
+            direction = level > last_level ? 1 : -1;
+        }
+        last_level = level;
+    }
+
+    if (settled && luma_sum)
+        ripple_pct = (luma_max - luma_min) * 100 * (long long)settled / luma_sum;
+
+    if (max_converge_frames &&
+        (converged_at < 0 || converged_at > max_converge_frames)) {
+        prt("FAIL: converged at frame %d, limit %d", converged_at,
+            max_converge_frames);
+        failed = 1;
+    }
+    if (max_ripple_pct && ripple_pct > max_ripple_pct) {
+        prt("FAIL: luma ripple %d%%, limit %d%%", ripple_pct, max_ripple_pct);
+        failed = 1;
+    }
+
+    /* Linked sensors must all end up on the leader's exposure */
+    if (group) {
+        rraew_group_free(group);
+        for (i = 0; i < sensors; i++) {
+            rraew_sim_state(members[i].sim, &state);
+            if (state.exposure < exposure_min)
+                exposure_min = state.exposure;
+            if (state.exposure > exposure_max)
+                exposure_max = state.exposure;
+        }
+        if (exposure_min != exposure_max) {
+            prt("FAIL: sensor exposures between %u and %u us", exposure_min,
+                exposure_max);
+            failed = 1;
+        }
+    }
+
+    /* The runner applied it, freeing the stream goes back to -f */
+    if (stream) {
+        rraew_stream_stop(stream);
+        if (frame > reconfigure_frame &&
+            aew->config.segmentation_factor != reconfigure_segmentation) {
+            prt("FAIL: segmentation factor %d, changed to %d on frame %d",
+                aew->config.segmentation_factor, reconfigure_segmentation,
+                reconfigure_frame);
+            failed = 1;
+        }
+    }
+
+    printf("frames=%d converged_at=%d settled_luma=%lld ripple_pct=%d reversals=%d run_avg_us=%lld run_max_us=%lld",
+        frame, converged_at, settled ? luma_sum / settled : 0, ripple_pct,
+        reversals, frame ? run_total_us / frame : 0, run_max_us);
+    if (group)
+        printf(" sensors=%d exposure_spread_us=%u", sensors,
+            exposure_max - exposure_min);
+    if (stream)
+        printf(" segmentation=%d windows=%d", aew->config.segmentation_factor,
+            aew->stat_config.hz_cnt * aew->stat_config.vt_cnt);
+    printf("\n");
+
+    rraew_stream_free(stream);
+
+    for (i = 0; i < sensors; i++)
+        member_close(&members[i]);
+    if (soa) {
+        rraew_meter_cleanup(&meter);
+        rraew_stats_soa_free(soa);
+    }
+
+    return failed;
+}
@@ -0,0 +1,597 @@
+/* librraew event driven AEW loop
+
+ * Copyright 2012 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rraew-sim.h"
+
+/* Fields of struct rraew_stat, in order */
+#define SIM_FIELDS 9
+
+/* AEW engine output range */
+#define SIM_MAX_VALUE 1023
+
+/* Sensor writes waiting for the frame they show in */
+#define SIM_MAX_PENDING 16
+
+struct sim_write {
+    unsigned int due;
+    int exposure;
+    __u32 value[3];
+};
+
+struct rraew_sim {
+    struct rraew_sim_config config;
+    FILE *file;
+    int raw;
+    __u16 *pixels;
+
+    /* Scene at the reference exposure and unity gain, SIM_FIELDS
+     * floats per window in struct rraew_stat order */
+    float *scene;
+    int scene_windows;
+    int scene_hz_cnt;
+    int scene_vt_cnt;
+
+    struct sim_write pending[SIM_MAX_PENDING];
+    int n_pending;
+
+    /* In effect for the current frame, and last written */
+    __u32 exposure;
+    __u32 gain[3];
+    __u32 written_exposure;
+    __u32 written_gain[3];
+    __u32 digital_gain[3];
+
+    unsigned int frame;
+    __u32 luma;
+    unsigned int seed;
+};
+
+/****************************************************************
+ * sim_noise
+ ****************************************************************/
+static int sim_noise(struct rraew_sim *sim)
+{
+    if (!sim->config.noise)
+        return 0;
+
+    sim->seed = sim->seed * 1103515245 + 12345;
+    return (int)((sim->seed >> 16) % (2 * sim->config.noise + 1)) -
+        sim->config.noise;
+}
+
+/****************************************************************
+ * sim_scene_alloc
+ ****************************************************************/
+static int sim_scene_alloc(struct rraew_sim *sim, int hz_cnt, int vt_cnt)
+{
+    float *scene;
+
+    if (hz_cnt * vt_cnt > sim->scene_windows) {
+        scene = realloc(sim->scene, hz_cnt * vt_cnt * SIM_FIELDS * sizeof(float));
+        if (!scene)
+            return -1;
+        sim->scene = scene;
+        sim->scene_windows = hz_cnt * vt_cnt;
+    }
+    sim->scene_hz_cnt = hz_cnt;
+    sim->scene_vt_cnt = vt_cnt;
+
+    return 0;
+}
+
+/****************************************************************
+ * sim_load_recording
+ *
+ * Reads the next recorded frame and refers it back to the
+ * reference exposure with unity gain
+ ****************************************************************/
+static int sim_load_recording(struct rraew_sim *sim)
+{
+    struct rraew_sim_frame_header header;
+    struct rraew_stat stat;
+    float scale[3];
+    float *scene;
+    int i;
+    int c;
+
+    if (fread(&header, sizeof(header), 1, sim->file) != 1) {
+        fseek(sim->file, sizeof(struct rraew_sim_file_header), SEEK_SET);
+        if (fread(&header, sizeof(header), 1, sim->file) != 1)
+            return -1;
+    }
+
+    if (!header.exposure || sim_scene_alloc(sim, header.hz_cnt, header.vt_cnt))
+        return -1;
+
+    for (c = 0; c < 3; c++)
+        scale[c] = header.gain[c] ? (float)sim->config.exposure * 1024 /
+            ((float)header.exposure * header.gain[c]) : 0;
+
+    for (i = 0; i < sim->scene_hz_cnt * sim->scene_vt_cnt; i++) {
+        if (fread(&stat, sizeof(stat), 1, sim->file) != 1)
+            return -1;
+
+        scene = &sim->scene[i * SIM_FIELDS];
+        scene[0] = stat.r_avg * scale[0];
+        scene[1] = stat.g_avg * scale[1];
+        scene[2] = stat.b_avg * scale[2];
+        scene[3] = stat.r_max * scale[0];
+        scene[4] = stat.g_max * scale[1];
+        scene[5] = stat.b_max * scale[2];
+        scene[6] = stat.r_min * scale[0];
+        scene[7] = stat.g_min * scale[1];
+        scene[8] = stat.b_min * scale[2];
+    }
+
+    return 0;
+}
+
+/****************************************************************
+ * sim_load_raw
+ *
+ * Reads the next Bayer frame and computes the window statistics
+ * the AEW engine would produce on the requested grid
+ ****************************************************************/
+static int sim_load_raw(struct rraew_sim *sim, int hz_cnt, int vt_cnt)
+{
+    const struct rraew_colorpattern *ptn = &sim->config.colorptn;
+    int width = sim->config.width;
+    int height = sim->config.height;
+    int pixels = width * height;
+    int win_w;
+    int win_h;
+    int wx;
+    int wy;
+    int x;
+    int y;
+
+    if (fread(sim->pixels, sizeof(__u16), pixels, sim->file) != (size_t)pixels) {
+        fseek(sim->file, 0, SEEK_SET);
+        if (fread(sim->pixels, sizeof(__u16), pixels, sim->file) != (size_t)pixels)
+            return -1;
+    }
+
+    if (hz_cnt <= 0 || vt_cnt <= 0 || sim_scene_alloc(sim, hz_cnt, vt_cnt))
+        return -1;
+
+    /* Whole Bayer cells per window */
+    win_w = (width / hz_cnt) & ~1;
+    win_h = (height / vt_cnt) & ~1;
+    if (win_w < 2 || win_h < 2)
+        return -1;
+
+    for (wy = 0; wy < vt_cnt; wy++) {
+        for (wx = 0; wx < hz_cnt; wx++) {
+            float *scene = &sim->scene[(wy * hz_cnt + wx) * SIM_FIELDS];
+            float sum[3] = {0, 0, 0};
+            float max[3] = {0, 0, 0};
+            float min[3] = {SIM_MAX_VALUE, SIM_MAX_VALUE, SIM_MAX_VALUE};
+            int cells = 0;
+            int c;
+
+            for (y = wy * win_h; y < (wy + 1) * win_h; y += 2) {
+                for (x = wx * win_w; x < (wx + 1) * win_w; x += 2) {
+                    const __u16 *cell = &sim->pixels[y * width + x];
+                    float value[4];
+                    int i;
+
+                    /* Offsets count the 2x2 cell in raster order */
+                    for (i = 0; i < 4; i++)
+                        value[i] = cell[(i >> 1) * width + (i & 1)] & SIM_MAX_VALUE;
+
+                    value[ptn->gr_offset] = (value[ptn->gr_offset] +
+                        value[ptn->gb_offset]) / 2;
+                    sum[0] += value[ptn->r_offset];
+                    sum[1] += value[ptn->gr_offset];
+                    sum[2] += value[ptn->b_offset];
+                    for (c = 0; c < 3; c++) {
+                        float v = value[c == 0 ? ptn->r_offset :
+                            c == 1 ? ptn->gr_offset : ptn->b_offset];
+
+                        if (v > max[c])
+                            max[c] = v;
+                        if (v < min[c])
+                            min[c] = v;
+                    }
+                    cells++;
+                }
+            }
+
+            for (c = 0; c < 3; c++) {
+                scene[c] = sum[c] / cells;
+                scene[3 + c] = max[c];
+                scene[6 + c] = min[c];
+            }
+        }
+    }
+
+    return 0;
+}
+
+/****************************************************************
+ * sim_apply_writes
+ ****************************************************************/
+static void sim_apply_writes(struct rraew_sim *sim)
+{
+    int i = 0;
+
+    while (i < sim->n_pending) {
+        struct sim_write *write = &sim->pending[i];
+
+        if (write->due > sim->frame) {
+            i++;
+            continue;
+        }
+
+        if (write->exposure)
+            sim->exposure = write->value[0];
+        else
+            memcpy(sim->gain, write->value, sizeof(sim->gain));
+
+        memmove(write, write + 1, (--sim->n_pending - i) * sizeof(*write));
+    }
+}
+
+/****************************************************************
+ * sim_queue_write
+ ****************************************************************/
+static void sim_queue_write(struct rraew_sim *sim, int exposure,
+    const __u32 *value)
+{
+    struct sim_write *write;
+
+    /* Too many in flight, the oldest one is overtaken anyway */
+    if (sim->n_pending == SIM_MAX_PENDING) {
+        memmove(sim->pending, sim->pending + 1,
+            --sim->n_pending * sizeof(struct sim_write));
+    }
+
+    write = &sim->pending[sim->n_pending++];
+    write->due = sim->frame + sim->config.latency;
+    write->exposure = exposure;
+    memcpy(write->value, value, sizeof(write->value));
+}
+
+/****************************************************************
+ * sim_render
+ ****************************************************************/
+static void sim_render(struct rraew_sim *sim, int hz_cnt, int vt_cnt,
+    struct rraew_stat *stats)
+{
+    unsigned long long rgb_sum = 0;
+    float factor[3];
+    int windows = hz_cnt * vt_cnt;
+    int x;
+    int y;
+    int c;
+
+    for (c = 0; c < 3; c++)
+        factor[c] = (float)sim->exposure * sim->gain[c] /
+            ((float)sim->config.exposure * 1024);
+
+    for (y = 0; y < vt_cnt; y++) {
+        for (x = 0; x < hz_cnt; x++) {
+            const float *scene = &sim->scene[((y * sim->scene_vt_cnt / vt_cnt) *
+                sim->scene_hz_cnt + x * sim->scene_hz_cnt / hz_cnt) * SIM_FIELDS];
+            unsigned int *out = (unsigned int *)&stats[y * hz_cnt + x];
+            int i;
+
+            for (i = 0; i < SIM_FIELDS; i++) {
+                float value = scene[i] * factor[i % 3];
+
+                if (i < 3)
+                    value += sim_noise(sim);
+                out[i] = value < 0 ? 0 :
+                    value > SIM_MAX_VALUE ? SIM_MAX_VALUE : (unsigned int)value;
+            }
+            rgb_sum += out[0] + out[1] + out[2];
+        }
+    }
+
+    sim->luma = windows ? (rgb_sum * 64 / windows) / 6 : 0;
+}
+
+/****************************************************************
+ * Interface callbacks
+ ****************************************************************/
+static int sim_set_stat_parameters(int *aew_fd, char *owner_aew_fd, int width,
+    int height, struct rraew_stat_config *stat_config, void *data)
+{
+    return 0;
+}
+
+static int sim_read_stat_data(int *aew_fd, char *owner_aew_fd,
+    struct rraew_stat_config *stat_config, struct rraew_colorpattern colorptn,
+    struct rraew_stat *stats, void *data)
+{
+    struct rraew_sim *sim = data;
+    int ret;
+
+    sim->frame++;
+    sim_apply_writes(sim);
+
+    if (sim->raw)
+        ret = sim_load_raw(sim, stat_config->hz_cnt, stat_config->vt_cnt);
+    else
+        ret = sim_load_recording(sim);
+    if (ret)
+        return -1;
+
+    sim_render(sim, stat_config->hz_cnt, stat_config->vt_cnt, stats);
+    return 0;
+}
+
+static int sim_release_stat_data(int *aew_fd, char *owner_aew_fd,
+    struct rraew_stat_config *stat_config, struct rraew_stat *stats, void *data)
+{
+    return 0;
+}
+
+static int sim_set_digital_gain(int *fd, char *owner_fd, __u32 q10r_gain,
+    __u32 q10g_gain, __u32 q10b_gain, void *data)
+{
+    struct rraew_sim *sim = data;
+
+    sim->digital_gain[0] = q10r_gain;
+    sim->digital_gain[1] = q10g_gain;
+    sim->digital_gain[2] = q10b_gain;
+    return 0;
+}
+
+static int sim_get_digital_gain(int *fd, char *owner_fd, __u32 *q10r_gain,
+    __u32 *q10g_gain, __u32 *q10b_gain, void *data)
+{
+    struct rraew_sim *sim = data;
+
+    *q10r_gain = sim->digital_gain[0];
+    *q10g_gain = sim->digital_gain[1];
+    *q10b_gain = sim->digital_gain[2];
+    return 0;
+}
+
+/****************************************************************
+ * Sensor callbacks
+ ****************************************************************/
+static int sim_set_sensor_gain(int *fd, char *owner_fd, __u32 q10r_gain,
+    __u32 q10g_gain, __u32 q10b_gain, void *data)
+{
+    struct rraew_sim *sim = data;
+
+    sim->written_gain[0] = q10r_gain;
+    sim->written_gain[1] = q10g_gain;
+    sim->written_gain[2] = q10b_gain;
+    sim_queue_write(sim, 0, sim->written_gain);
+    return 0;
+}
+
+static int sim_get_sensor_gain(int *fd, char *owner_fd, __u32 *q10r_gain,
+    __u32 *q10g_gain, __u32 *q10b_gain, void *data)
+{
+    struct rraew_sim *sim = data;
+
+    *q10r_gain = sim->written_gain[0];
+    *q10g_gain = sim->written_gain[1];
+    *q10b_gain = sim->written_gain[2];
+    return 0;
+}
+
+static int sim_set_exposure(int *capture_fd, char *owner_capture_fd,
+    __u32 exp_time, void *data)
+{
+    struct rraew_sim *sim = data;
+
+    sim->written_exposure = exp_time;
+    sim_queue_write(sim, 1, &sim->written_exposure);
+    return 0;
+}
+
+static int sim_get_exposure(int *capture_fd, char *owner_capture_fd,
+    __u32 *exp_time, void *data)
+{
+    struct rraew_sim *sim = data;
+
+    *exp_time = sim->written_exposure;
+    return 0;
+}
+
+/****************************************************************
+ * sim_new
+ ****************************************************************/
+static struct rraew_sim *sim_new(const char *path,
+    const struct rraew_sim_config *config)
+{
+    struct rraew_sim_config defaults = RRAEW_SIM_DEFAULTS;
+    struct rraew_sim *sim;
+    int c;
+
+    sim = calloc(1, sizeof(struct rraew_sim));
+    if (!sim)
+        return NULL;
+
+    sim->config = config ? *config : defaults;
+    if (sim->config.exposure <= 0)
+        sim->config.exposure = defaults.exposure;
+
+    sim->file = fopen(path, "rb");
+    if (!sim->file) {
+        free(sim);
+        return NULL;
+    }
+
+    sim->exposure = sim->written_exposure = sim->config.exposure;
+    for (c = 0; c < 3; c++)
+        sim->gain[c] = sim->written_gain[c] = sim->digital_gain[c] = 1024;
+    sim->seed = 1;
+
+    return sim;
+}
+
+/****************************************************************
+ * rraew_sim_open_recording
+ ****************************************************************/
+struct rraew_sim *rraew_sim_open_recording(const char *path,
+    const struct rraew_sim_config *config)
+{
+    struct rraew_sim_file_header header;
+    struct rraew_sim *sim;
+
+    sim = sim_new(path, config);
+    if (!sim)
+        return NULL;
+
+    if (fread(&header, sizeof(header), 1, sim->file) != 1 ||
+        header.magic != RRAEW_SIM_MAGIC || header.version != RRAEW_SIM_VERSION) {
+        fprintf(stderr, "rraew-sim: %s is not a statistics recording\n", path);
+        rraew_sim_free(sim);
+        return NULL;
+    }
+
+    return sim;
+}
+
+/****************************************************************
+ * rraew_sim_open_raw
+ ****************************************************************/
+struct rraew_sim *rraew_sim_open_raw(const char *path,
+    const struct rraew_sim_config *config)
+{
+    struct rraew_sim *sim;
+
+    if (!config || config->width < 2 || config->height < 2)
+        return NULL;
+
+    sim = sim_new(path, config);
+    if (!sim)
+        return NULL;
+
+    sim->raw = 1;
+    sim->pixels = malloc(config->width * config->height * sizeof(__u16));
+    if (!sim->pixels) {
+        rraew_sim_free(sim);
+        return NULL;
+    }
+
+    return sim;
+}
+
+/****************************************************************
+ * rraew_sim_free
+ ****************************************************************/
+void rraew_sim_free(struct rraew_sim *sim)
+{
+    if (!sim)
+        return;
+
+    if (sim->file)
+        fclose(sim->file);
+    free(sim->pixels);
+    free(sim->scene);
+    free(sim);
+}
+
+/****************************************************************
+ * rraew_sim_interface
+ ****************************************************************/
+void rraew_sim_interface(struct rraew_sim *sim,
+    struct rraew_interface *interface)
+{
+    interface->set_gain = sim_set_digital_gain;
+    interface->set_gain_target = sim;
+    interface->get_gain = sim_get_digital_gain;
+    interface->get_gain_target = sim;
+    interface->set_stat_parameters = sim_set_stat_parameters;
+    interface->set_stat_parameters_target = sim;
+    interface->read_stat_data = sim_read_stat_data;
+    interface->read_stat_data_target = sim;
+    interface->release_stat_data = sim_release_stat_data;
+    interface->release_stat_data_target = sim;
+}
+
+/****************************************************************
+ * rraew_sim_sensor
+ ****************************************************************/
+void rraew_sim_sensor(struct rraew_sim *sim, struct rraew_sensor *sensor)
+{
+    sensor->set_gain = sim_set_sensor_gain;
+    sensor->set_gain_target = sim;
+    sensor->get_gain = sim_get_sensor_gain;
+    sensor->get_gain_target = sim;
+    sensor->set_exposure = sim_set_exposure;
+    sensor->set_exposure_target = sim;
+    sensor->get_exposure = sim_get_exposure;
+    sensor->get_exposure_target = sim;
+}
+
+/****************************************************************
+ * rraew_sim_state
+ ****************************************************************/
+void rraew_sim_state(struct rraew_sim *sim, struct rraew_sim_state *state)
+{
+    state->frame = sim->frame;
+    state->exposure = sim->exposure;
+    memcpy(state->gain, sim->gain, sizeof(state->gain));
+    state->luma = sim->luma;
+}
+
+/****************************************************************
+ * rraew_sim_record_header
+ ****************************************************************/
+int rraew_sim_record_header(FILE *file)
+{
+    struct rraew_sim_file_header header;
+
+    header.magic = RRAEW_SIM_MAGIC;
+    header.version = RRAEW_SIM_VERSION;
+
+    return fwrite(&header, sizeof(header), 1, file) == 1 ? 0 : -1;
+}
+
+/****************************************************************
+ * rraew_sim_record
+ ****************************************************************/
+int rraew_sim_record(FILE *file, __u32 exposure, const __u32 *gain,
+    int hz_cnt, int vt_cnt, const struct rraew_stat *stats)
+{
+    struct rraew_sim_frame_header header;
+
+    header.exposure = exposure;
+    memcpy(header.gain, gain, sizeof(header.gain));
+    header.hz_cnt = hz_cnt;
+    header.vt_cnt = vt_cnt;
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fwrite(stats, sizeof(struct rraew_stat), hz_cnt * vt_cnt, file) !=
+        (size_t)(hz_cnt * vt_cnt))
+        return -1;
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+/* librraew event driven AEW loop
+
+ * Copyright 2012 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#ifndef RRAEW_SIM_H
+#define RRAEW_SIM_H
+
+#include <stdio.h>
+#include <rraew.h>
+
+/****************************************************************
+ * AEW simulator
+ *
+ * A rraew_interface and rraew_sensor backend that needs no devices.
+ * The scene comes from a statistics recording or from raw Bayer
+ * frames and is kept as the window statistics the sensor would
+ * give at the reference exposure with unity gain. Every statistics
+ * read renders the scene with the exposure and per channel sensor
+ * gains in effect, clipped to the 10 bit range of the AEW engine.
+ * Sensor writes take effect latency frames after they are made, as
+ * on the real pipeline. Digital gains are recorded but, like the
+ * IPIPE gains on the DM365, don't change the statistics.
+ *
+ * The scene loops when the recording or frame file ends.
+ ****************************************************************/
+
+struct rraew_sim_config {
+    /** Exposure in us and gain the scene radiance is referred to */
+    int exposure;
+    /** Frames between a sensor write and the first frame it shows in */
+    int latency;
+    /** Peak random variation added to each window average */
+    int noise;
+    /** Raw frames only: size and Bayer order, 16 bit little endian
+     * samples holding 10 bit values */
+    int width;
+    int height;
+    struct rraew_colorpattern colorptn;
+};
+
+#define RRAEW_SIM_DEFAULTS {10000, 2, 0, 0, 0, {1, 0, 3, 2}}
+
+struct rraew_sim;
+
+struct rraew_sim *rraew_sim_open_recording(const char *path,
+    const struct rraew_sim_config *config);
+struct rraew_sim *rraew_sim_open_raw(const char *path,
+    const struct rraew_sim_config *config);
+void rraew_sim_free(struct rraew_sim *sim);
+
+/**
+ * Fill the device callbacks. The interface keeps the limits it
+ * already has, so start from dm365_vpfe_interface to get the same
+ * windowing as on the board. The sensor keeps its ranges and steps.
+ */
+void rraew_sim_interface(struct rraew_sim *sim,
+    struct rraew_interface *interface);
+void rraew_sim_sensor(struct rraew_sim *sim, struct rraew_sensor *sensor);
+
+/** State after the last statistics read */
+struct rraew_sim_state {
+    unsigned int frame;
+    __u32 exposure;
+    __u32 gain[3];
+    /** Mean luma of the rendered statistics on the metering scale */
+    __u32 luma;
+};
+
+void rraew_sim_state(struct rraew_sim *sim, struct rraew_sim_state *state);
+
+/****************************************************************
+ * Statistics recordings
+ *
+ * A header followed by frames, each one holding the exposure and
+ * sensor gains the statistics were taken with and the window grid.
+ ****************************************************************/
+
+#define RRAEW_SIM_MAGIC 0x57454152	/* "RAEW" */
+#define RRAEW_SIM_VERSION 1
+
+struct rraew_sim_file_header {
+    __u32 magic;
+    __u32 version;
+};
+
+struct rraew_sim_frame_header {
+    __u32 exposure;
+    __u32 gain[3];
+    __u32 hz_cnt;
+    __u32 vt_cnt;
+};
+
+int rraew_sim_record_header(FILE *file);
+int rraew_sim_record(FILE *file, __u32 exposure, const __u32 *gain,
+    int hz_cnt, int vt_cnt, const struct rraew_stat *stats);
+
+#endif /* RRAEW_SIM_H */
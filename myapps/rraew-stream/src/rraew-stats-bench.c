@@ -0,0 +1,168 @@
+/* librraew event driven AEW loop
+
+ * Copyright 2012 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+/*
+ * Compares the per algorithm passes over the array of structs, a
+ * fused pass over the array of structs, and the transposition plus
+ * fused pass over the structure of arrays.
+ *
+ *   rraew-stats-bench [<windows> [<frames>]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rraew-stats.h"
+
+#define DEFAULT_WINDOWS 1024
+#define DEFAULT_FRAMES 10000
+
+/****************************************************************
+ * bench_now_ns
+ ****************************************************************/
+static long long bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/****************************************************************
+ * main
+ ****************************************************************/
+int main(int argc, char **argv)
+{
+    struct rraew_stats_summary aos_summary;
+    struct rraew_stats_summary fused_summary;
+    struct rraew_stats_summary soa_summary;
+    struct rraew_stats_soa *soa;
+    struct rraew_stat *stats;
+    struct rectangle_area rect;
+    int windows = DEFAULT_WINDOWS;
+    int frames = DEFAULT_FRAMES;
+    int hz_cnt;
+    long long start;
+    long long aos_ns;
+    long long fused_ns;
+    long long load_ns;
+    long long soa_ns;
+    volatile __u32 sink = 0;
+    int i;
+
+    if (argc > 1)
+        windows = atoi(argv[1]);
+    if (argc > 2)
+        frames = atoi(argv[2]);
+    if (windows <= 0 || frames <= 0) {
+        fprintf(stderr, "%s [<windows> [<frames>]]\n", argv[0]);
+        return 1;
+    }
+
+    stats = calloc(windows, sizeof(struct rraew_stat));
+    soa = rraew_stats_soa_new(windows);
+    if (!stats || !soa) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    srand(1);
+    for (i = 0; i < windows; i++) {
+        stats[i].r_avg = rand() % 1024;
+        stats[i].g_avg = rand() % 1024;
+        stats[i].b_avg = rand() % 1024;
+        stats[i].r_max = stats[i].r_avg + rand() % (1024 - stats[i].r_avg);
+        stats[i].g_max = stats[i].g_avg + rand() % (1024 - stats[i].g_avg);
+        stats[i].b_max = stats[i].b_avg + rand() % (1024 - stats[i].b_avg);
+    }
+
+    /* Centered rectangle of half the grid on a 4:3 layout */
+    hz_cnt = 1;
+    while ((hz_cnt + 1) * (hz_cnt + 1) * 3 / 4 <= windows)
+        hz_cnt++;
+    memset(&rect, 0, sizeof(rect));
+    rect.width = hz_cnt / 2;
+    rect.height = windows / hz_cnt / 2;
+    rect.col_start = hz_cnt / 4;
+    rect.row_start = windows / hz_cnt / 4;
+    rect.idx = rect.row_start * hz_cnt + rect.col_start;
+    rect.size = rect.width * rect.height;
+
+    rraew_stats_soa_load(soa, stats, windows);
+    rraew_stats_soa_set_rect(soa, &rect, hz_cnt);
+
+    start = bench_now_ns();
+    for (i = 0; i < frames; i++) {
+        rraew_stats_reduce_aos(stats, windows, soa->in_rect, &aos_summary);
+        sink += aos_summary.luma[METER_AVERAGE];
+    }
+    aos_ns = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for (i = 0; i < frames; i++) {
+        rraew_stats_reduce_aos_fused(stats, windows, soa->in_rect,
+            soa->rect_windows, &fused_summary);
+        sink += fused_summary.luma[METER_AVERAGE];
+    }
+    fused_ns = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for (i = 0; i < frames; i++) {
+        rraew_stats_soa_load(soa, stats, windows);
+        sink += soa->r_avg[i % windows];
+    }
+    load_ns = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for (i = 0; i < frames; i++) {
+        rraew_stats_reduce(soa, &soa_summary);
+        sink += soa_summary.luma[METER_AVERAGE];
+    }
+    soa_ns = bench_now_ns() - start;
+
+    if (memcmp(&aos_summary, &soa_summary, sizeof(aos_summary)) ||
+        memcmp(&aos_summary, &fused_summary, sizeof(aos_summary))) {
+        fprintf(stderr, "ERROR: layouts don't agree\n");
+        return 1;
+    }
+
+    printf("%d windows, %d frames\n", windows, frames);
+    printf("  array of structs, one pass per algorithm: %lld ns/frame\n",
+        aos_ns / frames);
+    printf("  array of structs, fused pass:             %lld ns/frame\n",
+        fused_ns / frames);
+    printf("  structure of arrays, fused pass:          %lld ns/frame (%lld ns/frame with the transposition)\n",
+        soa_ns / frames, (soa_ns + load_ns) / frames);
+
+    rraew_stats_soa_free(soa);
+    free(stats);
+
+    return 0;
+}
@@ -0,0 +1,359 @@
+/* librraew event driven AEW loop
+
+ * Copyright 2012 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rraew-stats.h"
+
+/* Weight of the rectangle of interest in the rectangle weighted
+ * metering, in percent, as librraew uses it */
+#define RECT_WEIGHT 75
+
+/****************************************************************
+ * stats_luma
+ *
+ * Same scale as the librraew metering: the mean of (R + G + B) / 6
+ * over the windows with the averages shifted by 6
+ ****************************************************************/
+static __u32 stats_luma(unsigned long long rgb_sum, int windows)
+{
+    if (windows <= 0)
+        return 0;
+
+    return (rgb_sum * 64 / windows) / 6;
+}
+
+/****************************************************************
+ * stats_summarize_luma
+ ****************************************************************/
+static void stats_summarize_luma(struct rraew_stats_summary *summary,
+    unsigned long long rgb_sum, unsigned long long rect_sum, int windows,
+    int rect_windows)
+{
+    __u32 inside = stats_luma(rect_sum, rect_windows);
+    __u32 outside = stats_luma(rgb_sum - rect_sum, windows - rect_windows);
+
+    summary->luma[METER_PARTIAL_AREA] = inside;
+    summary->luma[METER_RECT_WEIGHTED] =
+        (RECT_WEIGHT * inside + (100 - RECT_WEIGHT) * outside) / 100;
+    summary->luma[METER_AVERAGE] = stats_luma(rgb_sum, windows);
+    summary->luma[METER_SEGMENT] = 0;
+}
+
+/****************************************************************
+ * rraew_stats_soa_new
+ ****************************************************************/
+struct rraew_stats_soa *rraew_stats_soa_new(int max_windows)
+{
+    struct rraew_stats_soa *soa;
+    __u16 *columns;
+
+    soa = calloc(1, sizeof(struct rraew_stats_soa));
+    if (!soa)
+        return NULL;
+
+    /* One allocation for the six columns */
+    columns = calloc(6 * max_windows, sizeof(__u16));
+    soa->in_rect = calloc(max_windows, sizeof(__u8));
+    if (!columns || !soa->in_rect) {
+        free(columns);
+        free(soa->in_rect);
+        free(soa);
+        return NULL;
+    }
+
+    soa->r_avg = columns;
+    soa->g_avg = columns + max_windows;
+    soa->b_avg = columns + 2 * max_windows;
+    soa->r_max = columns + 3 * max_windows;
+    soa->g_max = columns + 4 * max_windows;
+    soa->b_max = columns + 5 * max_windows;
+
+    return soa;
+}
+
+/****************************************************************
+ * rraew_stats_soa_free
+ ****************************************************************/
+void rraew_stats_soa_free(struct rraew_stats_soa *soa)
+{
+    if (!soa)
+        return;
+
+    free(soa->r_avg);
+    free(soa->in_rect);
+    free(soa);
+}
+
+/****************************************************************
+ * rraew_stats_soa_set_rect
+ ****************************************************************/
+void rraew_stats_soa_set_rect(struct rraew_stats_soa *soa,
+    const struct rectangle_area *rect, int hz_cnt)
+{
+    int row;
+    int col;
+
+    memset(soa->in_rect, 0, soa->windows);
+    soa->rect_windows = 0;
+    if (!rect)
+        return;
+
+    for (row = 0; row < rect->height; row++) {
+        for (col = 0; col < rect->width; col++) {
+            int i = rect->idx + row * hz_cnt + col;
+
+            if (i < soa->windows) {
+                soa->in_rect[i] = 1;
+                soa->rect_windows++;
+            }
+        }
+    }
+}
+
+/****************************************************************
+ * rraew_stats_rect
+ ****************************************************************/
+void rraew_stats_rect(const struct rraew_ae_configuration *ae, int width,
+    int height, int hz_cnt, int vt_cnt, struct rectangle_area *rect)
+{
+    int percentage = ae->rect_percentage;
+    int col;
+    int row;
+
+    if (percentage < 1)
+        percentage = 1;
+    if (percentage > 100)
+        percentage = 100;
+
+    memset(rect, 0, sizeof(struct rectangle_area));
+    if (width <= 0 || height <= 0 || hz_cnt <= 0 || vt_cnt <= 0)
+        return;
+
+    rect->width = (hz_cnt * percentage + 50) / 100;
+    rect->height = (vt_cnt * percentage + 50) / 100;
+    if (rect->width < 1)
+        rect->width = 1;
+    if (rect->height < 1)
+        rect->height = 1;
+
+    /* Window holding the center point, the rectangle is moved back
+     * inside the grid when it doesn't fit around it */
+    if (ae->rect_center_point.centered) {
+        rect->col_start = (hz_cnt - rect->width) / 2;
+        rect->row_start = (vt_cnt - rect->height) / 2;
+    } else {
+        col = (int)((unsigned long long)ae->rect_center_point.x * hz_cnt / width);
+        row = (int)((unsigned long long)ae->rect_center_point.y * vt_cnt / height);
+        rect->col_start = col - rect->width / 2;
+        rect->row_start = row - rect->height / 2;
+    }
+    if (rect->col_start > hz_cnt - rect->width)
+        rect->col_start = hz_cnt - rect->width;
+    if (rect->row_start > vt_cnt - rect->height)
+        rect->row_start = vt_cnt - rect->height;
+    if (rect->col_start < 0)
+        rect->col_start = 0;
+    if (rect->row_start < 0)
+        rect->row_start = 0;
+
+    rect->idx = rect->row_start * hz_cnt + rect->col_start;
+    rect->size = rect->width * rect->height;
+}
+
+/****************************************************************
+ * rraew_stats_soa_load
+ ****************************************************************/
+void rraew_stats_soa_load(struct rraew_stats_soa *soa,
+    const struct rraew_stat *stats, int windows)
+{
+    int i;
+
+    if (windows != soa->windows) {
+        /* The rectangle is stale with a different grid */
+        soa->windows = windows;
+        memset(soa->in_rect, 0, windows);
+        soa->rect_windows = 0;
+    }
+
+    for (i = 0; i < windows; i++) {
+        soa->r_avg[i] = stats[i].r_avg;
+        soa->g_avg[i] = stats[i].g_avg;
+        soa->b_avg[i] = stats[i].b_avg;
+        soa->r_max[i] = stats[i].r_max;
+        soa->g_max[i] = stats[i].g_max;
+        soa->b_max[i] = stats[i].b_max;
+    }
+}
+
+/****************************************************************
+ * rraew_stats_reduce
+ ****************************************************************/
+void rraew_stats_reduce(const struct rraew_stats_soa *soa,
+    struct rraew_stats_summary *summary)
+{
+    const __u16 *__restrict__ r_avg = soa->r_avg;
+    const __u16 *__restrict__ g_avg = soa->g_avg;
+    const __u16 *__restrict__ b_avg = soa->b_avg;
+    const __u16 *__restrict__ r_max = soa->r_max;
+    const __u16 *__restrict__ g_max = soa->g_max;
+    const __u16 *__restrict__ b_max = soa->b_max;
+    const __u8 *__restrict__ in_rect = soa->in_rect;
+    __u32 r_sum = 0, g_sum = 0, b_sum = 0;
+    __u32 r_peak = 0, g_peak = 0, b_peak = 0;
+    __u32 r_max_sum = 0, g_max_sum = 0, b_max_sum = 0;
+    __u32 rect_sum = 0;
+    int i;
+
+    for (i = 0; i < soa->windows; i++) {
+        __u32 r = r_avg[i];
+        __u32 g = g_avg[i];
+        __u32 b = b_avg[i];
+
+        r_sum += r;
+        g_sum += g;
+        b_sum += b;
+        r_max_sum += r_max[i];
+        g_max_sum += g_max[i];
+        b_max_sum += b_max[i];
+        r_peak = r_max[i] > r_peak ? r_max[i] : r_peak;
+        g_peak = g_max[i] > g_peak ? g_max[i] : g_peak;
+        b_peak = b_max[i] > b_peak ? b_max[i] : b_peak;
+        rect_sum += (r + g + b) & -(__u32)in_rect[i];
+    }
+
+    summary->r_sum = r_sum;
+    summary->g_sum = g_sum;
+    summary->b_sum = b_sum;
+    summary->r_peak = r_peak;
+    summary->g_peak = g_peak;
+    summary->b_peak = b_peak;
+    summary->r_max_sum = r_max_sum;
+    summary->g_max_sum = g_max_sum;
+    summary->b_max_sum = b_max_sum;
+    stats_summarize_luma(summary, (unsigned long long)r_sum + g_sum + b_sum,
+        rect_sum, soa->windows, soa->rect_windows);
+}
+
+/****************************************************************
+ * rraew_stats_reduce_aos
+ ****************************************************************/
+void rraew_stats_reduce_aos(const struct rraew_stat *stats, int windows,
+    const __u8 *in_rect, struct rraew_stats_summary *summary)
+{
+    unsigned long long rgb_sum = 0;
+    unsigned long long rect_sum = 0;
+    int rect_windows = 0;
+    int i;
+
+    memset(summary, 0, sizeof(struct rraew_stats_summary));
+
+    /* Gray world */
+    for (i = 0; i < windows; i++) {
+        summary->r_sum += stats[i].r_avg;
+        summary->g_sum += stats[i].g_avg;
+        summary->b_sum += stats[i].b_avg;
+    }
+
+    /* White patch */
+    for (i = 0; i < windows; i++) {
+        if (stats[i].r_max > summary->r_peak)
+            summary->r_peak = stats[i].r_max;
+        if (stats[i].g_max > summary->g_peak)
+            summary->g_peak = stats[i].g_max;
+        if (stats[i].b_max > summary->b_peak)
+            summary->b_peak = stats[i].b_max;
+    }
+
+    /* White patch 2 */
+    for (i = 0; i < windows; i++) {
+        summary->r_max_sum += stats[i].r_max;
+        summary->g_max_sum += stats[i].g_max;
+        summary->b_max_sum += stats[i].b_max;
+    }
+
+    /* Average metering */
+    for (i = 0; i < windows; i++)
+        rgb_sum += stats[i].r_avg + stats[i].g_avg + stats[i].b_avg;
+
+    /* Partial and rectangle weighted metering */
+    for (i = 0; i < windows; i++) {
+        if (in_rect[i]) {
+            rect_sum += stats[i].r_avg + stats[i].g_avg + stats[i].b_avg;
+            rect_windows++;
+        }
+    }
+
+    stats_summarize_luma(summary, rgb_sum, rect_sum, windows, rect_windows);
+}
+
+/****************************************************************
+ * rraew_stats_reduce_aos_fused
+ ****************************************************************/
+void rraew_stats_reduce_aos_fused(const struct rraew_stat *stats, int windows,
+    const __u8 *in_rect, int rect_windows, struct rraew_stats_summary *summary)
+{
+    __u32 r_sum = 0, g_sum = 0, b_sum = 0;
+    __u32 r_peak = 0, g_peak = 0, b_peak = 0;
+    __u32 r_max_sum = 0, g_max_sum = 0, b_max_sum = 0;
+    __u32 rect_sum = 0;
+    int i;
+
+    for (i = 0; i < windows; i++) {
+        __u32 r = stats[i].r_avg;
+        __u32 g = stats[i].g_avg;
+        __u32 b = stats[i].b_avg;
+        __u32 r_max = stats[i].r_max;
+        __u32 g_max = stats[i].g_max;
+        __u32 b_max = stats[i].b_max;
+
+        r_sum += r;
+        g_sum += g;
+        b_sum += b;
+        r_max_sum += r_max;
+        g_max_sum += g_max;
+        b_max_sum += b_max;
+        r_peak = r_max > r_peak ? r_max : r_peak;
+        g_peak = g_max > g_peak ? g_max : g_peak;
+        b_peak = b_max > b_peak ? b_max : b_peak;
+        rect_sum += (r + g + b) & -(__u32)in_rect[i];
+    }
+
+    summary->r_sum = r_sum;
+    summary->g_sum = g_sum;
+    summary->b_sum = b_sum;
+    summary->r_peak = r_peak;
+    summary->g_peak = g_peak;
+    summary->b_peak = b_peak;
+    summary->r_max_sum = r_max_sum;
+    summary->g_max_sum = g_max_sum;
+    summary->b_max_sum = b_max_sum;
+    stats_summarize_luma(summary, (unsigned long long)r_sum + g_sum + b_sum,
+        rect_sum, windows, rect_windows);
+}
@@ -0,0 +1,129 @@
+/* librraew event driven AEW loop
+
+ * Copyright 2012 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#ifndef RRAEW_STATS_H
+#define RRAEW_STATS_H
+
+#include <rraew.h>
+
+/****************************************************************
+ * Statistics reduction
+ *
+ * The white balance algorithms and each metering mode walk the
+ * rraew_stat array on their own, touching nine words per window to
+ * use two or three of them. A single branch free pass produces every
+ * sum, maximum and luma they need. The loop only does adds, compares
+ * and masks on unsigned ints, so it runs in fixed point on the ARM9.
+ *
+ * The pass exists over the array of structs as read from the
+ * interface and over a structure of arrays keeping the six fields as
+ * 16 bit columns. The structure of arrays reduces faster and
+ * vectorizes on cores with NEON, but transposing it each frame costs
+ * more than it saves (see make bench), so the stream reduces the
+ * array of structs and only transposes for the histogram metering,
+ * which reads the columns.
+ *
+ * Window averages and maxima are assumed to fit in 16 bits, the AEW
+ * engine produces 10 bit values after its shift.
+ ****************************************************************/
+
+struct rraew_stats_soa {
+    int windows;
+    __u16 *r_avg;
+    __u16 *g_avg;
+    __u16 *b_avg;
+    __u16 *r_max;
+    __u16 *g_max;
+    __u16 *b_max;
+    /* 1 for the windows inside the rectangle of interest */
+    __u8 *in_rect;
+    int rect_windows;
+};
+
+struct rraew_stats_summary {
+    /* Gray world: window averages summed */
+    __u32 r_sum;
+    __u32 g_sum;
+    __u32 b_sum;
+    /* White patch: highest window maximum */
+    __u32 r_peak;
+    __u32 g_peak;
+    __u32 b_peak;
+    /* White patch 2: window maxima summed */
+    __u32 r_max_sum;
+    __u32 g_max_sum;
+    __u32 b_max_sum;
+    /* Frame luma for each rraew_metering_type on the scale the auto
+     * exposure expects, METER_SEGMENT is left to librraew */
+    __u32 luma[4];
+};
+
+struct rraew_stats_soa *rraew_stats_soa_new(int max_windows);
+void rraew_stats_soa_free(struct rraew_stats_soa *soa);
+
+/**
+ * Rectangle of interest of the partial and rectangle weighted
+ * metering in windows, from rect_center_point (or the image center
+ * when centered is set) and rect_percentage of the configuration, on
+ * a width x height image split in hz_cnt x vt_cnt windows
+ */
+void rraew_stats_rect(const struct rraew_ae_configuration *ae, int width,
+    int height, int hz_cnt, int vt_cnt, struct rectangle_area *rect);
+
+/**
+ * Marks the windows of the rectangle of interest for the partial and
+ * rectangle weighted metering
+ */
+void rraew_stats_soa_set_rect(struct rraew_stats_soa *soa,
+    const struct rectangle_area *rect, int hz_cnt);
+
+/** Transposes the statistics read from the interface */
+void rraew_stats_soa_load(struct rraew_stats_soa *soa,
+    const struct rraew_stat *stats, int windows);
+
+/** Fused single pass reduction over the structure of arrays */
+void rraew_stats_reduce(const struct rraew_stats_soa *soa,
+    struct rraew_stats_summary *summary);
+
+/**
+ * Same results computed like the algorithms do, one pass per
+ * consumer over the array of structs. Kept as reference for the
+ * benchmark.
+ */
+void rraew_stats_reduce_aos(const struct rraew_stat *stats, int windows,
+    const __u8 *in_rect, struct rraew_stats_summary *summary);
+
+/**
+ * Fused single pass straight over the array of structs, in_rect and
+ * rect_windows as set by rraew_stats_soa_set_rect()
+ */
+void rraew_stats_reduce_aos_fused(const struct rraew_stat *stats, int windows,
+    const __u8 *in_rect, int rect_windows, struct rraew_stats_summary *summary);
+
+#endif /* RRAEW_STATS_H */
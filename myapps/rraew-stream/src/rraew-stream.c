@@ -0,0 +1,984 @@
+/* librraew event driven AEW loop
+
+ * Copyright 2012 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include "rraew-stream.h"
+#include "rraew-stats.h"
+#include "rraew-converge.h"
+#include "rraew-meter.h"
+#include "rraew-sim.h"
+#include "rraew-trace.h"
+
+/* Wake up from poll() this often to notice a stop request */
+#define STREAM_POLL_MS 100
+
+struct rraew_stream {
+    struct rraew *aew;
+
+    /* What the stream replaced in the aew handler */
+    RraewReadStatData read_stat_data;
+    void *read_stat_data_target;
+    struct rraew_stat *aew_stats;
+    int aew_segmentation;
+    struct rraew_ae_configuration aew_ae;
+    __u32 (*metering) (struct rraew *aew);
+    RraewSetGain sensor_set_gain;
+    void *sensor_set_gain_target;
+    RraewSetExposure set_exposure;
+    void *set_exposure_target;
+    RraewSetGain digital_set_gain;
+    void *digital_set_gain_target;
+
+    /* Last values written, to skip writes that change nothing */
+    __u32 sensor_gain[3];
+    __u32 digital_gain[3];
+    __u32 exposure;
+
+    /* The runner owns buffers[front], the reader fills the other one */
+    struct rraew_stat *buffers[2];
+    long long ready_ns[2];
+    int front;
+    int pending;
+    int writing;
+
+    /* Reduced by the reader along with each buffer */
+    struct rraew_stats_soa *soa;
+    struct rraew_stats_summary summary[2];
+    struct rectangle_area rect;
+    int rect_hz_cnt;
+    int rect_windows;
+
+    /* Histogram metering, the reader owns meter and picks up changes
+     * to the configuration and regions when meter_dirty is set */
+    struct rraew_meter meter;
+    struct rraew_meter_config meter_config;
+    struct rraew_roi rois[RRAEW_METER_MAX_ROIS];
+    int n_rois;
+    int meter_enabled;
+    int meter_dirty;
+    int meter_hz_cnt;
+    int meter_vt_cnt;
+    int metered[2];
+    __u32 meter_luma[2];
+
+    /* Skips frames once the scene is stable, when enabled */
+    struct rraew_converge converge;
+    int converge_enabled;
+
+    /* Settings rraew_stream_reconfigure() left for the runner */
+    int reconfigure;
+    struct rraew_ae_configuration new_ae;
+    int new_ae_set;
+    int new_segmentation;
+    int max_windows;
+
+    /* Statistics recording for rraew-sim, when enabled */
+    FILE *record;
+
+#ifdef RRAEW_TRACE
+    /* The runner appends a record after each iteration, with the
+     * mutex it takes for the timing anyway */
+    struct rraew_trace trace;
+    long long read_ns[2];
+    __u32 trace_luma;
+    __u32 trace_flags;
+#endif
+
+    pthread_t reader;
+    pthread_t runner;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int started;
+    int running;
+
+    struct rraew_stream_timing timing;
+};
+
+/* Stream whose runner is calling rraew_run() on this thread */
+static __thread struct rraew_stream *stream_current;
+
+/****************************************************************
+ * stream_now_ns
+ ****************************************************************/
+static long long stream_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/****************************************************************
+ * stream_read_stat_data
+ *
+ * Installed as the interface's read_stat_data, the runner already
+ * pointed aew->stats to the newest frame
+ ****************************************************************/
+static int stream_read_stat_data(int *aew_fd, char *owner_aew_fd,
+    struct rraew_stat_config *stat_config, struct rraew_colorpattern colorptn,
+    struct rraew_stat *stats, void *data)
+{
+    return 0;
+}
+
+/****************************************************************
+ * stream_metering
+ *
+ * Installed as the auto exposure metering, returns the luma the
+ * reader already computed for the frame being processed. Histogram
+ * metering overrides the librraew metering type.
+ ****************************************************************/
+static __u32 stream_metering(struct rraew *aew)
+{
+    struct rraew_stream *stream = stream_current;
+    __u32 luma;
+
+    if (stream->metered[stream->front])
+        luma = stream->meter_luma[stream->front];
+    else if (aew->ae.config.meter_type == METER_SEGMENT)
+        luma = stream->metering(aew);
+    else
+        luma = stream->summary[stream->front].luma[aew->ae.config.meter_type];
+
+#ifdef RRAEW_TRACE
+    stream->trace_luma = luma;
+#endif
+    return luma;
+}
+
+/****************************************************************
+ * stream_write_gain
+ *
+ * Quantizes the gains with the device's step ranges and only
+ * writes them when the programmed value would change
+ ****************************************************************/
+static int stream_write_gain(struct rraew_stream *stream, RraewSetGain set_gain,
+    void *target, __u32 *last, const struct rraew_gain_step *steps,
+    int n_steps, float min_gain, int *fd, char *owner_fd, __u32 q10r_gain,
+    __u32 q10g_gain, __u32 q10b_gain)
+{
+    __u32 gain[3];
+    int skipped;
+    int ret = 0;
+
+    gain[0] = rraew_quantize_gain(q10r_gain, steps, n_steps, min_gain);
+    gain[1] = rraew_quantize_gain(q10g_gain, steps, n_steps, min_gain);
+    gain[2] = rraew_quantize_gain(q10b_gain, steps, n_steps, min_gain);
+
+    skipped = !memcmp(gain, last, sizeof(gain));
+    if (!skipped)
+        ret = set_gain(fd, owner_fd, gain[0], gain[1], gain[2], target);
+
+    /* The recorder reads the last values from the reader thread */
+    pthread_mutex_lock(&stream->mutex);
+    if (!skipped && !ret)
+        memcpy(last, gain, sizeof(gain));
+#ifdef RRAEW_TRACE
+    if (!skipped)
+        stream->trace_flags |= (last == stream->sensor_gain) ?
+            RRAEW_TRACE_GAIN : RRAEW_TRACE_DIGITAL;
+#endif
+    if (skipped)
+        stream->timing.writes_skipped++;
+    else
+        stream->timing.writes++;
+    pthread_mutex_unlock(&stream->mutex);
+
+    return ret;
+}
+
+/****************************************************************
+ * stream_sensor_set_gain
+ ****************************************************************/
+static int stream_sensor_set_gain(int *fd, char *owner_fd, __u32 q10r_gain,
+    __u32 q10g_gain, __u32 q10b_gain, void *data)
+{
+    struct rraew_stream *stream = data;
+    struct rraew_sensor *sensor = &stream->aew->sensor;
+
+    return stream_write_gain(stream, stream->sensor_set_gain,
+        stream->sensor_set_gain_target, stream->sensor_gain,
+        sensor->gain_steps, sensor->n_gain_steps, sensor->min_gain, fd,
+        owner_fd, q10r_gain, q10g_gain, q10b_gain);
+}
+
+/****************************************************************
+ * stream_digital_set_gain
+ ****************************************************************/
+static int stream_digital_set_gain(int *fd, char *owner_fd, __u32 q10r_gain,
+    __u32 q10g_gain, __u32 q10b_gain, void *data)
+{
+    struct rraew_stream *stream = data;
+    struct rraew_interface *interface = &stream->aew->interface;
+
+    return stream_write_gain(stream, stream->digital_set_gain,
+        stream->digital_set_gain_target, stream->digital_gain,
+        interface->gain_steps, interface->n_gain_steps, interface->min_gain,
+        fd, owner_fd, q10r_gain, q10g_gain, q10b_gain);
+}
+
+/****************************************************************
+ * stream_set_exposure
+ ****************************************************************/
+static int stream_set_exposure(int *capture_fd, char *owner_capture_fd,
+    __u32 exp_time, void *data)
+{
+    struct rraew_stream *stream = data;
+    int skipped = (exp_time == stream->exposure);
+    int ret = 0;
+
+    if (!skipped)
+        ret = stream->set_exposure(capture_fd, owner_capture_fd, exp_time,
+            stream->set_exposure_target);
+
+    pthread_mutex_lock(&stream->mutex);
+    if (!skipped && !ret)
+        stream->exposure = exp_time;
+#ifdef RRAEW_TRACE
+    if (!skipped)
+        stream->trace_flags |= RRAEW_TRACE_EXPOSURE;
+#endif
+    if (skipped)
+        stream->timing.writes_skipped++;
+    else
+        stream->timing.writes++;
+    pthread_mutex_unlock(&stream->mutex);
+
+    return ret;
+}
+
+/****************************************************************
+ * stream_reduce
+ *
+ * Runs on the reader thread, off the algorithms' critical path
+ ****************************************************************/
+static void stream_reduce(struct rraew_stream *stream, int buffer)
+{
+    struct rraew *aew = stream->aew;
+    int windows = aew->stat_config.hz_cnt * aew->stat_config.vt_cnt;
+    int meter_type = aew->ae.config.meter_type;
+    struct rraew_roi rois[RRAEW_METER_MAX_ROIS];
+    struct rectangle_area rect;
+    int n_rois = -1;
+    int metered;
+
+    pthread_mutex_lock(&stream->mutex);
+    metered = stream->meter_enabled;
+    if (metered && (stream->meter_dirty ||
+            stream->meter_hz_cnt != aew->stat_config.hz_cnt ||
+            stream->meter_vt_cnt != aew->stat_config.vt_cnt)) {
+        stream->meter.config = stream->meter_config;
+        n_rois = stream->n_rois;
+        memcpy(rois, stream->rois, n_rois * sizeof(struct rraew_roi));
+        stream->meter_dirty = 0;
+        stream->meter_hz_cnt = aew->stat_config.hz_cnt;
+        stream->meter_vt_cnt = aew->stat_config.vt_cnt;
+    }
+    pthread_mutex_unlock(&stream->mutex);
+
+    if (n_rois >= 0)
+        rraew_meter_set_rois(&stream->meter, rois, n_rois, aew->config.width,
+            aew->config.height, aew->stat_config.hz_cnt, aew->stat_config.vt_cnt);
+    /* The columns are only worth transposing for the histogram, the
+     * fused pass is faster on the array of structs, see make bench */
+    if (stream->soa->windows != windows) {
+        /* The rectangle is stale with a different grid */
+        stream->soa->windows = windows;
+        memset(stream->soa->in_rect, 0, windows);
+        stream->soa->rect_windows = 0;
+    }
+    stream->metered[buffer] = metered;
+    if (metered) {
+        rraew_stats_soa_load(stream->soa, stream->buffers[buffer], windows);
+        stream->meter_luma[buffer] = rraew_meter_histogram(&stream->meter,
+            stream->soa);
+    }
+
+    /* The runner only changes ae.config between statistics reads */
+    if (meter_type == METER_PARTIAL_AREA || meter_type == METER_RECT_WEIGHTED) {
+        rraew_stats_rect(&aew->ae.config, aew->config.width,
+            aew->config.height, aew->stat_config.hz_cnt,
+            aew->stat_config.vt_cnt, &rect);
+        if (memcmp(&rect, &stream->rect, sizeof(stream->rect)) ||
+            stream->rect_hz_cnt != aew->stat_config.hz_cnt ||
+            stream->rect_windows != windows) {
+            stream->rect = rect;
+            stream->rect_hz_cnt = aew->stat_config.hz_cnt;
+            stream->rect_windows = windows;
+            rraew_stats_soa_set_rect(stream->soa, &rect,
+                aew->stat_config.hz_cnt);
+        }
+    }
+
+    rraew_stats_reduce_aos_fused(stream->buffers[buffer], windows,
+        stream->soa->in_rect, stream->soa->rect_windows,
+        &stream->summary[buffer]);
+}
+
+/****************************************************************
+ * stream_record
+ *
+ * Saves a frame with the exposure and sensor gains last written.
+ * The sensor applies writes a couple of frames late, so frames
+ * right after a change are recorded with the new values.
+ ****************************************************************/
+static void stream_record(struct rraew_stream *stream, int buffer)
+{
+    struct rraew *aew = stream->aew;
+    struct rraew_sensor *sensor = &aew->sensor;
+    __u32 exposure;
+    __u32 gain[3];
+
+    pthread_mutex_lock(&stream->mutex);
+    exposure = stream->exposure;
+    memcpy(gain, stream->sensor_gain, sizeof(gain));
+    pthread_mutex_unlock(&stream->mutex);
+
+    /* Nothing written yet, ask the sensor */
+    if (exposure == ~0u && sensor->get_exposure)
+        sensor->get_exposure(&aew->file_descriptors.capture_fd,
+            &aew->file_descriptors.owner_capture_fd, &exposure,
+            sensor->get_exposure_target);
+    if (gain[0] == ~0u && sensor->get_gain)
+        sensor->get_gain(&aew->file_descriptors.capture_fd,
+            &aew->file_descriptors.owner_capture_fd, &gain[0], &gain[1],
+            &gain[2], sensor->get_gain_target);
+
+    if (rraew_sim_record(stream->record, exposure, gain,
+            aew->stat_config.hz_cnt, aew->stat_config.vt_cnt,
+            stream->buffers[buffer])) {
+        fprintf(stderr, "rraew-stream: can't record statistics, recording stopped\n");
+        stream->record = NULL;
+    }
+}
+
+/****************************************************************
+ * stream_reader
+ ****************************************************************/
+static void *stream_reader(void *data)
+{
+    struct rraew_stream *stream = data;
+    struct rraew *aew = stream->aew;
+    struct pollfd pfd;
+    long long start;
+    unsigned int reduce_us = 0;
+    int windows;
+    int back;
+    int converge;
+    int due;
+    int ret;
+
+    pfd.fd = aew->file_descriptors.aew_fd;
+    pfd.events = POLLIN;
+
+    pthread_mutex_lock(&stream->mutex);
+    while (stream->running) {
+        pthread_mutex_unlock(&stream->mutex);
+        ret = poll(&pfd, 1, STREAM_POLL_MS);
+        pthread_mutex_lock(&stream->mutex);
+
+        if (ret < 0 && errno != EINTR) {
+            fprintf(stderr, "rraew-stream: can't poll AEW device: %s\n",
+                strerror(errno));
+            break;
+        }
+        if (ret <= 0 || !stream->running)
+            continue;
+
+        /* A frame the runner didn't take yet gets overwritten */
+        back = !stream->front;
+        stream->writing = 1;
+        converge = stream->converge_enabled;
+        pthread_mutex_unlock(&stream->mutex);
+
+#ifdef RRAEW_TRACE
+        start = stream_now_ns();
+#endif
+        ret = stream->read_stat_data(&aew->file_descriptors.aew_fd,
+            &aew->file_descriptors.owner_aew_fd, &aew->stat_config,
+            aew->sensor.colorptn, stream->buffers[back],
+            stream->read_stat_data_target);
+#ifdef RRAEW_TRACE
+        stream->read_ns[back] = stream_now_ns() - start;
+#endif
+
+        if (ret >= 0 && stream->record)
+            stream_record(stream, back);
+
+        /* Every frame is due unless the convergence says otherwise,
+         * and it may have been disabled since the last one */
+        due = 1;
+        if (ret >= 0 && converge) {
+            windows = aew->stat_config.hz_cnt * aew->stat_config.vt_cnt;
+            pthread_mutex_lock(&stream->mutex);
+            if (stream->converge_enabled)
+                due = rraew_converge_due(&stream->converge,
+                    stream->buffers[back], windows);
+            pthread_mutex_unlock(&stream->mutex);
+        }
+
+        if (ret >= 0 && due) {
+            start = stream_now_ns();
+            stream_reduce(stream, back);
+            reduce_us = (stream_now_ns() - start) / 1000;
+        }
+
+        pthread_mutex_lock(&stream->mutex);
+        stream->writing = 0;
+        if (stream->pending)
+            stream->timing.dropped++;
+        stream->pending = (ret >= 0 && due);
+        if (ret >= 0) {
+            stream->ready_ns[back] = stream_now_ns();
+            stream->timing.frames++;
+            stream->timing.reduce_us = reduce_us;
+            if (!due)
+                stream->timing.skipped++;
+        }
+        pthread_cond_signal(&stream->cond);
+    }
+
+    /* Also stops the runner if the device failed */
+    stream->running = 0;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+
+    return NULL;
+}
+
+#ifdef RRAEW_TRACE
+/****************************************************************
+ * stream_trace
+ *
+ * Records the iteration that just ran, with the mutex held
+ ****************************************************************/
+static void stream_trace(struct rraew_stream *stream, long long ready,
+    long long start, long long end)
+{
+    struct rraew_trace_record *record = rraew_trace_next(&stream->trace);
+
+    record->frame = stream->timing.frames;
+    record->time_ms = start / 1000000;
+    record->read_us = stream->read_ns[stream->front] / 1000;
+    record->wait_us = (start - ready) / 1000;
+    record->run_us = (end - start) / 1000;
+    record->luma = stream->trace_luma;
+    record->exposure = stream->exposure;
+    memcpy(record->sensor_gain, stream->sensor_gain, sizeof(record->sensor_gain));
+    memcpy(record->digital_gain, stream->digital_gain, sizeof(record->digital_gain));
+    record->flags = stream->trace_flags |
+        (stream->timing.converged ? RRAEW_TRACE_CONVERGED : 0);
+    stream->trace_flags = 0;
+}
+#endif
+
+/****************************************************************
+ * stream_windowing
+ *
+ * Window grid for a segmentation factor, by the same rules as
+ * rraew_create(): the factor's share of the engine's windows, no
+ * smaller than the engine allows, and fewer of them while they
+ * leave more than 1% of the image uncovered
+ ****************************************************************/
+static void stream_windowing(const struct rraew *aew, int segmentation_factor,
+    struct rraew_stat_config *stat_config)
+{
+    const struct rraew_interface *interface = &aew->interface;
+    int width = aew->config.width;
+    int height = aew->config.height;
+    int hz_cnt = interface->stat_max_h_window * segmentation_factor / 100;
+    int vt_cnt = interface->stat_max_v_window * segmentation_factor / 100;
+    int win_width;
+    int win_height;
+
+    if (hz_cnt < 1)
+        hz_cnt = 1;
+    if (vt_cnt < 1)
+        vt_cnt = 1;
+
+    win_width = width / hz_cnt;
+    if (win_width < interface->stat_min_pxl_h_window) {
+        win_width = interface->stat_min_pxl_h_window;
+        hz_cnt = width / win_width;
+    }
+    win_height = height / vt_cnt;
+    if (win_height < interface->stat_min_pxl_v_window) {
+        win_height = interface->stat_min_pxl_v_window;
+        vt_cnt = height / win_height;
+    }
+
+    while (vt_cnt > 1 && height % vt_cnt &&
+        height - win_height * vt_cnt > height / 100) {
+        vt_cnt--;
+        win_height = height / vt_cnt;
+    }
+    while (hz_cnt > 1 && width % hz_cnt &&
+        width - win_width * hz_cnt > width / 100) {
+        hz_cnt--;
+        win_width = width / hz_cnt;
+    }
+
+    if (win_width > interface->stat_max_pxl_h_window)
+        win_width = interface->stat_max_pxl_h_window;
+    if (win_height > interface->stat_max_pxl_v_window)
+        win_height = interface->stat_max_pxl_v_window;
+
+    stat_config->hz_cnt = hz_cnt;
+    stat_config->vt_cnt = vt_cnt;
+    stat_config->win_width = win_width;
+    stat_config->win_height = win_height;
+}
+
+/****************************************************************
+ * stream_apply
+ *
+ * Applies the pending reconfiguration, with the mutex held and no
+ * statistics read in flight. The sensor settings and the algorithm
+ * state are left alone, only the windowing and the metering change.
+ * The reader derives the rectangle of interest from ae.config, so the
+ * metering settings take effect even if the grid can't change.
+ ****************************************************************/
+static int stream_apply(struct rraew_stream *stream)
+{
+    struct rraew *aew = stream->aew;
+    struct rraew_stat_config stat_config = aew->stat_config;
+    int segmentation = stream->new_segmentation;
+    int windows;
+    int ret = 0;
+
+    stream->reconfigure = 0;
+
+    if (stream->new_ae_set)
+        aew->ae.config = stream->new_ae;
+
+    if (segmentation && segmentation != aew->config.segmentation_factor) {
+        stream_windowing(aew, segmentation, &stat_config);
+        windows = stat_config.hz_cnt * stat_config.vt_cnt;
+
+        /* The grid only changes once the engine took it */
+        if (windows > stream->max_windows ||
+            aew->interface.set_stat_parameters(&aew->file_descriptors.aew_fd,
+                &aew->file_descriptors.owner_aew_fd, aew->config.width,
+                aew->config.height, &stat_config,
+                aew->interface.set_stat_parameters_target) < 0) {
+            ret = -1;
+        } else {
+            aew->stat_config.hz_cnt = stat_config.hz_cnt;
+            aew->stat_config.vt_cnt = stat_config.vt_cnt;
+            aew->stat_config.win_width = stat_config.win_width;
+            aew->stat_config.win_height = stat_config.win_height;
+            aew->config.segmentation_factor = segmentation;
+
+            /* A frame waiting was taken on the old grid */
+            if (stream->pending)
+                stream->timing.dropped++;
+            stream->pending = 0;
+            rraew_converge_reset(&stream->converge);
+        }
+    }
+
+    return ret;
+}
+
+/****************************************************************
+ * stream_runner
+ ****************************************************************/
+static void *stream_runner(void *data)
+{
+    struct rraew_stream *stream = data;
+    struct rraew_stream_timing *timing = &stream->timing;
+    long long ready;
+    long long start;
+    long long end;
+    unsigned int us;
+
+    stream_current = stream;
+
+    pthread_mutex_lock(&stream->mutex);
+    while (1) {
+        while (stream->running && (stream->reconfigure ? stream->writing :
+                !stream->pending || stream->writing))
+            pthread_cond_wait(&stream->cond, &stream->mutex);
+        if (!stream->running)
+            break;
+
+        /* Between iterations, with the reader idle */
+        if (stream->reconfigure) {
+            if (stream_apply(stream))
+                fprintf(stderr, "rraew-stream: reconfiguration failed\n");
+            continue;
+        }
+
+        stream->front = !stream->front;
+        stream->pending = 0;
+        ready = stream->ready_ns[stream->front];
+        stream->aew->stats = stream->buffers[stream->front];
+        pthread_mutex_unlock(&stream->mutex);
+
+        start = stream_now_ns();
+        if (rraew_run(stream->aew) < 0)
+            fprintf(stderr, "rraew-stream: AEW iteration failed\n");
+        end = stream_now_ns();
+
+        pthread_mutex_lock(&stream->mutex);
+        us = (end - start) / 1000;
+        timing->run_us = us;
+        timing->run_avg_us = timing->runs ?
+            (timing->run_avg_us * 15 + us) / 16 : us;
+        if (us > timing->run_max_us)
+            timing->run_max_us = us;
+        us = (end - ready) / 1000;
+        timing->latency_us = us;
+        if (us > timing->latency_max_us)
+            timing->latency_max_us = us;
+        timing->runs++;
+
+        if (stream->converge_enabled) {
+            rraew_converge_update(&stream->converge,
+                &stream->summary[stream->front], stream->aew->stats,
+                stream->aew->stat_config.hz_cnt * stream->aew->stat_config.vt_cnt);
+            timing->converged = stream->converge.converged;
+        }
+
+#ifdef RRAEW_TRACE
+        stream_trace(stream, ready, start, end);
+#endif
+    }
+    pthread_mutex_unlock(&stream->mutex);
+
+    return NULL;
+}
+
+/****************************************************************
+ * rraew_stream_new
+ ****************************************************************/
+struct rraew_stream *rraew_stream_new(struct rraew *aew)
+{
+    struct rraew_stream *stream;
+    int windows;
+
+    stream = calloc(1, sizeof(struct rraew_stream));
+    if (!stream)
+        return NULL;
+
+    /* Sized for the largest grid so the windowing can change later */
+    windows = aew->interface.stat_max_h_window *
+        aew->interface.stat_max_v_window;
+    if (windows < aew->stat_config.hz_cnt * aew->stat_config.vt_cnt)
+        windows = aew->stat_config.hz_cnt * aew->stat_config.vt_cnt;
+    stream->max_windows = windows;
+
+    stream->buffers[0] = calloc(windows, sizeof(struct rraew_stat));
+    stream->buffers[1] = calloc(windows, sizeof(struct rraew_stat));
+    stream->soa = rraew_stats_soa_new(windows);
+    if (!stream->buffers[0] || !stream->buffers[1] || !stream->soa ||
+        rraew_meter_init(&stream->meter, windows, NULL)) {
+        rraew_meter_cleanup(&stream->meter);
+        rraew_stats_soa_free(stream->soa);
+        free(stream->buffers[0]);
+        free(stream->buffers[1]);
+        free(stream);
+        return NULL;
+    }
+
+    stream->aew = aew;
+    stream->read_stat_data = aew->interface.read_stat_data;
+    stream->read_stat_data_target = aew->interface.read_stat_data_target;
+    /* librraew only sees the stream buffers from now on, its own
+     * one is sized for the grid it was created with */
+    stream->aew_stats = aew->stats;
+    stream->aew_segmentation = aew->config.segmentation_factor;
+    stream->aew_ae = aew->ae.config;
+    aew->stats = stream->buffers[0];
+    aew->interface.read_stat_data = stream_read_stat_data;
+    aew->interface.read_stat_data_target = stream;
+    stream->metering = aew->ae.metering;
+    aew->ae.metering = stream_metering;
+
+    stream->sensor_set_gain = aew->sensor.set_gain;
+    stream->sensor_set_gain_target = aew->sensor.set_gain_target;
+    stream->set_exposure = aew->sensor.set_exposure;
+    stream->set_exposure_target = aew->sensor.set_exposure_target;
+    stream->digital_set_gain = aew->interface.set_gain;
+    stream->digital_set_gain_target = aew->interface.set_gain_target;
+    memset(stream->sensor_gain, 0xff, sizeof(stream->sensor_gain));
+    memset(stream->digital_gain, 0xff, sizeof(stream->digital_gain));
+    stream->exposure = ~0u;
+    if (aew->sensor.set_gain) {
+        aew->sensor.set_gain = stream_sensor_set_gain;
+        aew->sensor.set_gain_target = stream;
+    }
+    if (aew->sensor.set_exposure) {
+        aew->sensor.set_exposure = stream_set_exposure;
+        aew->sensor.set_exposure_target = stream;
+    }
+    if (aew->interface.set_gain) {
+        aew->interface.set_gain = stream_digital_set_gain;
+        aew->interface.set_gain_target = stream;
+    }
+
+    pthread_mutex_init(&stream->mutex, NULL);
+    pthread_cond_init(&stream->cond, NULL);
+
+    return stream;
+}
+
+/****************************************************************
+ * rraew_stream_free
+ *
+ * Gives the statistics read back to the aew handler, on the grid
+ * its own buffer was allocated for
+ ****************************************************************/
+void rraew_stream_free(struct rraew_stream *stream)
+{
+    if (!stream)
+        return;
+
+    rraew_stream_stop(stream);
+
+    /* The librraew metering and its rectangle of interest were set up
+     * for the settings the handler was created with */
+    stream->new_ae = stream->aew_ae;
+    stream->new_ae_set = 1;
+    stream->new_segmentation = stream->aew_segmentation;
+    if (stream_apply(stream))
+        fprintf(stderr, "rraew-stream: can't restore the windowing\n");
+
+    stream->aew->interface.read_stat_data = stream->read_stat_data;
+    stream->aew->interface.read_stat_data_target =
+        stream->read_stat_data_target;
+    stream->aew->stats = stream->aew_stats;
+    stream->aew->ae.metering = stream->metering;
+    stream->aew->sensor.set_gain = stream->sensor_set_gain;
+    stream->aew->sensor.set_gain_target = stream->sensor_set_gain_target;
+    stream->aew->sensor.set_exposure = stream->set_exposure;
+    stream->aew->sensor.set_exposure_target = stream->set_exposure_target;
+    stream->aew->interface.set_gain = stream->digital_set_gain;
+    stream->aew->interface.set_gain_target = stream->digital_set_gain_target;
+
+    pthread_cond_destroy(&stream->cond);
+    pthread_mutex_destroy(&stream->mutex);
+    rraew_meter_cleanup(&stream->meter);
+    rraew_stats_soa_free(stream->soa);
+    free(stream->buffers[0]);
+    free(stream->buffers[1]);
+    free(stream);
+}
+
+/****************************************************************
+ * rraew_stream_start
+ ****************************************************************/
+int rraew_stream_start(struct rraew_stream *stream)
+{
+    if (stream->started)
+        return 0;
+
+    stream->running = 1;
+    stream->pending = 0;
+    if (pthread_create(&stream->runner, NULL, stream_runner, stream)) {
+        stream->running = 0;
+        return -1;
+    }
+    if (pthread_create(&stream->reader, NULL, stream_reader, stream)) {
+        pthread_mutex_lock(&stream->mutex);
+        stream->running = 0;
+        pthread_cond_broadcast(&stream->cond);
+        pthread_mutex_unlock(&stream->mutex);
+        pthread_join(stream->runner, NULL);
+        return -1;
+    }
+    stream->started = 1;
+
+    return 0;
+}
+
+/****************************************************************
+ * rraew_stream_stop
+ ****************************************************************/
+void rraew_stream_stop(struct rraew_stream *stream)
+{
+    if (!stream->started)
+        return;
+
+    pthread_mutex_lock(&stream->mutex);
+    stream->running = 0;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+
+    pthread_join(stream->reader, NULL);
+    pthread_join(stream->runner, NULL);
+    stream->started = 0;
+}
+
+/****************************************************************
+ * rraew_stream_set_convergence
+ ****************************************************************/
+void rraew_stream_set_convergence(struct rraew_stream *stream,
+    const struct rraew_converge_config *config)
+{
+    pthread_mutex_lock(&stream->mutex);
+    stream->converge_enabled = (config != NULL);
+    if (config)
+        rraew_converge_init(&stream->converge, config);
+    stream->timing.converged = 0;
+    pthread_mutex_unlock(&stream->mutex);
+}
+
+/****************************************************************
+ * rraew_stream_reconfigure
+ ****************************************************************/
+int rraew_stream_reconfigure(struct rraew_stream *stream,
+    const struct rraew_ae_configuration *ae_config, int segmentation_factor)
+{
+    int ret = 0;
+
+    if (ae_config && ae_config->algorithm != stream->aew->ae.config.algorithm)
+        return -1;
+    /* Segment metering is librraew's, picked when the handler was made */
+    if (ae_config && ae_config->meter_type == METER_SEGMENT &&
+        stream->aew_ae.meter_type != METER_SEGMENT)
+        return -1;
+    if (segmentation_factor && (segmentation_factor < 10 ||
+            segmentation_factor > 100))
+        return -1;
+
+    pthread_mutex_lock(&stream->mutex);
+    /* A later call replaces settings not applied yet */
+    if (!stream->reconfigure) {
+        stream->new_ae_set = 0;
+        stream->new_segmentation = 0;
+    }
+    if (ae_config) {
+        stream->new_ae = *ae_config;
+        stream->new_ae_set = 1;
+    }
+    if (segmentation_factor)
+        stream->new_segmentation = segmentation_factor;
+    stream->reconfigure = 1;
+
+    if (stream->started)
+        pthread_cond_broadcast(&stream->cond);
+    else
+        ret = stream_apply(stream);
+    pthread_mutex_unlock(&stream->mutex);
+
+    return ret;
+}
+
+/****************************************************************
+ * rraew_stream_set_histogram
+ ****************************************************************/
+void rraew_stream_set_histogram(struct rraew_stream *stream,
+    const struct rraew_meter_config *config)
+{
+    struct rraew_meter_config defaults = RRAEW_METER_DEFAULTS;
+
+    pthread_mutex_lock(&stream->mutex);
+    stream->meter_enabled = (config != NULL);
+    stream->meter_config = config ? *config : defaults;
+    stream->meter_dirty = 1;
+    pthread_mutex_unlock(&stream->mutex);
+}
+
+/****************************************************************
+ * rraew_stream_set_rois
+ ****************************************************************/
+int rraew_stream_set_rois(struct rraew_stream *stream,
+    const struct rraew_roi *rois, int n_rois)
+{
+    if (n_rois < 0 || n_rois > RRAEW_METER_MAX_ROIS)
+        return -1;
+
+    pthread_mutex_lock(&stream->mutex);
+    memcpy(stream->rois, rois, n_rois * sizeof(struct rraew_roi));
+    stream->n_rois = n_rois;
+    stream->meter_dirty = 1;
+    pthread_mutex_unlock(&stream->mutex);
+
+    return 0;
+}
+
+/****************************************************************
+ * rraew_stream_record
+ ****************************************************************/
+int rraew_stream_record(struct rraew_stream *stream, FILE *file)
+{
+    if (stream->started)
+        return -1;
+
+    if (file && rraew_sim_record_header(file))
+        return -1;
+
+    stream->record = file;
+    return 0;
+}
+
+/****************************************************************
+ * rraew_stream_trace_dump
+ ****************************************************************/
+int rraew_stream_trace_dump(struct rraew_stream *stream, FILE *file)
+{
+#ifdef RRAEW_TRACE
+    struct rraew_trace *trace;
+    int ret;
+
+    /* Copied so the runner isn't held up while printing */
+    trace = malloc(sizeof(struct rraew_trace));
+    if (!trace)
+        return -1;
+
+    pthread_mutex_lock(&stream->mutex);
+    *trace = stream->trace;
+    pthread_mutex_unlock(&stream->mutex);
+
+    ret = rraew_trace_dump(trace, file);
+    free(trace);
+
+    return ret;
+#else
+    return -1;
+#endif
+}
+
+/****************************************************************
+ * rraew_stream_timing
+ ****************************************************************/
+void rraew_stream_timing(struct rraew_stream *stream,
+    struct rraew_stream_timing *timing)
+{
+    pthread_mutex_lock(&stream->mutex);
+    *timing = stream->timing;
+    pthread_mutex_unlock(&stream->mutex);
+}
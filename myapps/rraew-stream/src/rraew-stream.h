@@ -0,0 +1,159 @@
+/* librraew event driven AEW loop
+
+ * Copyright 2012 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#ifndef RRAEW_STREAM_H
+#define RRAEW_STREAM_H
+
+#include <stdio.h>
+#include <rraew.h>
+#include "rraew-converge.h"
+#include "rraew-meter.h"
+
+/****************************************************************
+ * Statistics streaming
+ *
+ * rraew_run() reads the AEW statistics and runs both algorithms in
+ * the caller's context, so the caller either spins on it or runs one
+ * frame behind. The stream splits that in two threads:
+ *
+ *  - a reader that waits on the AEW device with poll() and fills one
+ *    of two statistics buffers with the interface's read_stat_data
+ *  - a runner that swaps in the newest complete buffer and calls
+ *    rraew_run(), whose statistics read becomes a no-op
+ *
+ * The runner always works on the latest frame; frames that arrive
+ * while it is busy overwrite each other and are counted as dropped.
+ *
+ * The reader also reduces each frame with rraew_stats_reduce() and
+ * the stream replaces the auto exposure metering with the result,
+ * except for METER_SEGMENT. Histogram metering, see rraew-meter.h,
+ * replaces every metering type while it is enabled.
+ *
+ * Gain and exposure writes go through the stream, which quantizes
+ * the gains to the device steps and drops writes of the value
+ * already programmed. With convergence scheduling enabled the
+ * algorithms only run at idle_interval once the scene is stable,
+ * see rraew-converge.h.
+ ****************************************************************/
+
+struct rraew_stream;
+
+struct rraew_stream_timing {
+    /** Statistics frames read from the AEW engine */
+    unsigned int frames;
+    /** Algorithm iterations */
+    unsigned int runs;
+    /** Frames replaced by a newer one before the algorithms saw them */
+    unsigned int dropped;
+    /** Time spent in rraew_run(), last, average and worst */
+    unsigned int run_us;
+    unsigned int run_avg_us;
+    unsigned int run_max_us;
+    /** Reduction of the last frame on the reader thread */
+    unsigned int reduce_us;
+    /** From statistics available to algorithms done, last and worst */
+    unsigned int latency_us;
+    unsigned int latency_max_us;
+    /** Frames the algorithms skipped because the scene was stable */
+    unsigned int skipped;
+    int converged;
+    /** Gain and exposure writes sent to the devices and avoided */
+    unsigned int writes;
+    unsigned int writes_skipped;
+};
+
+/**
+ * Takes over the statistics read of an aew handler created with
+ * rraew_create(). The handler must not be run by anyone else until
+ * the stream is freed.
+ */
+struct rraew_stream *rraew_stream_new(struct rraew *aew);
+void rraew_stream_free(struct rraew_stream *stream);
+
+int rraew_stream_start(struct rraew_stream *stream);
+void rraew_stream_stop(struct rraew_stream *stream);
+
+/**
+ * Enables convergence scheduling with the given thresholds, NULL
+ * runs the algorithms on every frame
+ */
+void rraew_stream_set_convergence(struct rraew_stream *stream,
+    const struct rraew_converge_config *config);
+
+/**
+ * Changes the auto exposure metering and the segmentation factor
+ * without recreating the aew handler. NULL and 0 keep the current
+ * value. The auto exposure algorithm itself can't change, and segment
+ * metering is only available if the handler was created with it.
+ *
+ * On a running stream the runner applies them before its next
+ * iteration and the call returns right away; calls made before that
+ * replace the pending settings. The stream buffers are sized for the
+ * engine's largest grid when the stream is created, so nothing is
+ * allocated here. Returns -1, with the previous grid still in use,
+ * if the engine doesn't take the new one; the metering settings are
+ * applied regardless. The exposure and gains the algorithms reached
+ * carry over, and freeing the stream goes back to the metering and
+ * the segmentation factor the handler was created with.
+ */
+int rraew_stream_reconfigure(struct rraew_stream *stream,
+    const struct rraew_ae_configuration *ae_config, int segmentation_factor);
+
+/**
+ * Enables histogram metering with the given percentile and
+ * background weight, NULL goes back to the librraew metering type
+ */
+void rraew_stream_set_histogram(struct rraew_stream *stream,
+    const struct rraew_meter_config *config);
+
+/**
+ * Replaces the regions of interest of the histogram metering, up to
+ * RRAEW_METER_MAX_ROIS. Safe to call from any thread while the
+ * stream runs, the next frame read uses them.
+ */
+int rraew_stream_set_rois(struct rraew_stream *stream,
+    const struct rraew_roi *rois, int n_rois);
+
+/**
+ * Saves every frame read to file in the rraew-sim recording format,
+ * NULL stops recording. Only while the stream is stopped; the file
+ * stays open until the caller closes it.
+ */
+int rraew_stream_record(struct rraew_stream *stream, FILE *file);
+
+/**
+ * Prints the last iterations, see rraew-trace.h. Fails when the
+ * stream was built without RRAEW_TRACE.
+ */
+int rraew_stream_trace_dump(struct rraew_stream *stream, FILE *file);
+
+void rraew_stream_timing(struct rraew_stream *stream,
+    struct rraew_stream_timing *timing);
+
+#endif /* RRAEW_STREAM_H */
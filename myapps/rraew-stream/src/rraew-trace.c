@@ -0,0 +1,63 @@
+/* librraew event driven AEW loop
+
+ * Copyright 2012 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#include <stdio.h>
+#include "rraew-trace.h"
+
+/****************************************************************
+ * rraew_trace_dump
+ ****************************************************************/
+int rraew_trace_dump(const struct rraew_trace *trace, FILE *file)
+{
+    const struct rraew_trace_record *record;
+    unsigned int first = 0;
+    unsigned int i;
+
+    if (trace->count > RRAEW_TRACE_RECORDS)
+        first = trace->count - RRAEW_TRACE_RECORDS;
+
+    fprintf(file, "# frame time_ms read_us wait_us run_us luma exposure "
+        "sensor_gain(r,g,b) digital_gain(r,g,b) writes\n");
+
+    for (i = first; i < trace->count; i++) {
+        record = &trace->records[i % RRAEW_TRACE_RECORDS];
+        fprintf(file, "%u %u %u %u %u %u %u %u,%u,%u %u,%u,%u %s%s%s%s\n",
+            record->frame, record->time_ms, record->read_us, record->wait_us,
+            record->run_us, record->luma, record->exposure,
+            record->sensor_gain[0], record->sensor_gain[1],
+            record->sensor_gain[2], record->digital_gain[0],
+            record->digital_gain[1], record->digital_gain[2],
+            record->flags & RRAEW_TRACE_EXPOSURE ? "E" : "-",
+            record->flags & RRAEW_TRACE_GAIN ? "G" : "-",
+            record->flags & RRAEW_TRACE_DIGITAL ? "D" : "-",
+            record->flags & RRAEW_TRACE_CONVERGED ? "C" : "-");
+    }
+
+    return ferror(file) ? -1 : 0;
+}
@@ -0,0 +1,84 @@
+/* librraew event driven AEW loop
+
+ * Copyright 2012 RidgeRun. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY RIDGERUN ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL RIDGERUN OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of RidgeRun.
+ */
+
+#ifndef RRAEW_TRACE_H
+#define RRAEW_TRACE_H
+
+#include <stdio.h>
+#include <rraew.h>
+
+/****************************************************************
+ * Iteration trace
+ *
+ * A fixed ring with what went into and came out of the last
+ * RRAEW_TRACE_RECORDS algorithm iterations, to find out in the
+ * field why the exposure oscillates. Recording is a copy into
+ * preallocated memory; the stream only does it when built with
+ * RRAEW_TRACE (USER_APPS_RRAEW_STREAM_TRACE in the SDK config).
+ ****************************************************************/
+
+#define RRAEW_TRACE_RECORDS 256
+
+#define RRAEW_TRACE_EXPOSURE (1 << 0)	/* exposure written */
+#define RRAEW_TRACE_GAIN (1 << 1)	/* sensor gain written */
+#define RRAEW_TRACE_DIGITAL (1 << 2)	/* digital gain written */
+#define RRAEW_TRACE_CONVERGED (1 << 3)
+
+struct rraew_trace_record {
+    /** Frame number and monotonic time of the run, in ms */
+    __u32 frame;
+    __u32 time_ms;
+    /** Statistics read, wait for the runner and rraew_run() */
+    __u32 read_us;
+    __u32 wait_us;
+    __u32 run_us;
+    /** Metering result the auto exposure worked with */
+    __u32 luma;
+    /** Values programmed after the run, ~0 until first written */
+    __u32 exposure;
+    __u32 sensor_gain[3];
+    __u32 digital_gain[3];
+    __u32 flags;
+};
+
+struct rraew_trace {
+    struct rraew_trace_record records[RRAEW_TRACE_RECORDS];
+    unsigned int count;
+};
+
+/** Next record to fill, overwrites the oldest once the ring is full */
+static inline struct rraew_trace_record *rraew_trace_next(struct rraew_trace *trace)
+{
+    return &trace->records[trace->count++ % RRAEW_TRACE_RECORDS];
+}
+
+/** Prints the records oldest first, one per line */
+int rraew_trace_dump(const struct rraew_trace *trace, FILE *file);
+
+#endif /* RRAEW_TRACE_H */